@@ -0,0 +1,501 @@
+/*****************************************************************************
+ 
+ Copyright (c) 1994, 2009-2011, Martin Riedmiller, Sascha Lange
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+
+/* N++2: Microbenchmarks of the layer types and of complete training epochs.
+ *
+ * Times forwardPass, backwardPass and updateWeights of the individual layer
+ * types for different sizes and numbers of threads as well as complete 
+ * epochs of Net::train and Net::test on synthetic pattern sets. The results
+ * are written as JSON (to stdout or to a file) in order to compare them 
+ * between different versions of the library. 
+ *
+ * The FLOP and byte counts are estimates derived from the operations done 
+ * and the data touched by each of the operations (no cache re-use assumed).
+ * Exemplary usage: ./npp2_bench --quick --output results.json
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "npp2.h"
+#include "kernels.h"
+#include "PatternSet.h"
+#include "AdvancedLayerTypes.h"
+
+using namespace std;
+using namespace NPP2;
+
+enum Operation { FORWARD=0, BACKWARD, UPDATE, TRAIN, TEST };
+static const char* operationNames[] = { "forward", "backward", "update", "train", "test" };
+
+/** result of a single benchmark */
+struct Result {
+  string name;       ///< name of the layer type or the net
+  Operation op;      ///< operation that has been timed
+  int size;          ///< number of units of the layer (or patterns in the set)
+  int threads;       ///< number of threads used
+  long iterations;   ///< number of timed repetitions (patterns, updates or epochs)
+  double seconds;    ///< total time of all repetitions
+  double patterns;   ///< number of patterns processed (weight updates for update)
+  double flops;      ///< estimated floating point operations
+  double bytes;      ///< estimated bytes moved from / to memory
+};
+
+/** estimated costs of propagating or updating a layer once */
+struct Cost {
+  double flops;
+  double bytes;
+  Cost(double flops=0., double bytes=0.) : flops(flops), bytes(bytes) {}
+};
+
+static double now()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Cost model
+#endif
+
+// estimates the costs of an operation on the layer. threads is the number of
+// copies that have to be summed up during the update.
+static Cost estimateCost(const BasicLayerType* layer, Operation op, int threads, bool dedout=true)
+{
+  const double f = sizeof(FTYPE);
+  double units = layer->numUnits;
+  
+  const IndividuallyConnectedLayer* ilayer = dynamic_cast<const IndividuallyConnectedLayer*>(layer);
+  if (ilayer) {
+    double c = ilayer->connections.size();
+    double w = ilayer->weights.size();
+    double ci = sizeof(IndividuallyConnectedLayer::Connection);
+    switch (op) {
+      case FORWARD:  return Cost(2*c + 4*units, c * (ci + 4*f) + 2*units*f);
+      case BACKWARD: return Cost((dedout ? 4 : 2)*c + units, c * (ci + (dedout ? 7 : 4)*f) + 3*units*f);
+      case UPDATE:   return Cost(10*w + (threads > 1 ? threads*w : 0), 10*w*f + (threads > 1 ? 3*threads*w*f : 0));
+      default: break;
+    }
+    return Cost();
+  }
+  double prev = layer->net->layers[layer->layerId-1]->numUnits + 1;
+  double w = prev * units;
+  double softmax = dynamic_cast<const MultimodalCrossEntropyOutputLayer*>(layer) ? 3*units : 0.;
+  switch (op) {
+    case FORWARD:  return Cost(2*w + 4*units + softmax, (w + prev + 2*units)*f);
+    case BACKWARD: return Cost((dedout ? 4 : 2)*w + units, ((dedout ? 4 : 3)*w + 2*prev + 3*units)*f);
+    case UPDATE:   return Cost(10*w + (threads > 1 ? threads*w : 0), 10*w*f + (threads > 1 ? 3*threads*w*f : 0));
+    default: break;
+  }
+  return Cost();
+}
+
+// costs of training (forward and backward) resp. testing (forward) a single
+// pattern with the given net. the first hidden layer does not calculate the
+// derivatives in respect to the input.
+static Cost estimatePatternCost(const Net& net, bool train)
+{
+  Cost cost;
+  for (unsigned int i=1; i < net.layers.size(); i++) {
+    Cost c = estimateCost(net.layers[i], FORWARD, 1);
+    cost.flops += c.flops; cost.bytes += c.bytes;
+    if (train) {
+      c = estimateCost(net.layers[i], BACKWARD, 1, i > 1);
+      cost.flops += c.flops; cost.bytes += c.bytes;
+    }
+  }
+  return cost;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Layer benchmarks
+#endif
+
+/** data of a thread that repeatedly propagates through one layer */
+struct LayerWorker {
+  Net* net;
+  BasicLayerType* layer;
+  Operation op;
+  int copy;
+  long iterations;
+  pthread_t threadId;
+};
+
+static void* runLayerWorker(void* arg)
+{
+  LayerWorker* w = (LayerWorker*) arg;
+  BasicLayerType* layer = w->layer;
+  BasicLayerType* prev = w->net->layers[layer->layerId-1];
+  FTYPE* input = &prev->out[w->copy*(prev->numUnits+1)];
+  FTYPE* dEdo = &layer->dEdo[w->copy*(layer->numUnits+1)];
+  FTYPE* dedout = &prev->dEdo[w->copy*(prev->numUnits+1)+1];   // same as in Net::backwardPass
+  
+  for (long n=0; n < w->iterations; n++) {
+    if (w->op == FORWARD) {
+      layer->forwardPass(input, w->copy);
+    }
+    else {
+      for (int i=1; i <= layer->numUnits; i++) {  // backwardPass consumes (clears) dEdo
+        dEdo[i] = .01 * i;
+      }
+      layer->backwardPass(dedout, w->copy);
+    }
+  }
+  return 0;
+}
+
+// runs iterations of the operation in the given number of threads and 
+// returns the time needed. uses copies 1..threads in parallel, like 
+// Net::train does, and copy 0 when running single-threaded.
+static double timeLayer(Net& net, BasicLayerType* layer, Operation op, int threads, long iterations)
+{
+  double start = now();
+  if (op == UPDATE) {
+    for (long n=0; n < iterations; n++) {
+      layer->updateWeights(threads > 1 ? threads : 0);
+    }
+    return now() - start;
+  }
+  vector<LayerWorker> workers(threads);
+  for (int t=0; t < threads; t++) {
+    workers[t].net = &net;
+    workers[t].layer = layer;
+    workers[t].op = op;
+    workers[t].copy = threads > 1 ? t+1 : 0;
+    workers[t].iterations = iterations;
+  }
+  start = now();
+  for (int t=0; t < threads-1; t++) {
+    pthread_create(&workers[t].threadId, 0, runLayerWorker, (void*) &workers[t]);
+  }
+  runLayerWorker(&workers[threads-1]);
+  for (int t=0; t < threads-1; t++) {
+    pthread_join(workers[t].threadId, 0);
+  }
+  return now() - start;
+}
+
+// doubles the number of iterations until the benchmark runs for at least 
+// minTime seconds.
+static Result measureLayer(const string& name, Net& net, int layerId, Operation op, int threads, double minTime)
+{
+  BasicLayerType* layer = net.layers[layerId];
+  long iterations = 1;
+  double seconds = timeLayer(net, layer, op, threads, iterations); // warm-up
+  while ((seconds = timeLayer(net, layer, op, threads, iterations)) < minTime) {
+    iterations *= 2;
+  }
+  Cost cost = estimateCost(layer, op, threads);
+  double repetitions = op == UPDATE ? iterations : (double) iterations * threads;
+  
+  Result result;
+  result.name = name;
+  result.op = op;
+  result.size = layer->numUnits;
+  result.threads = threads;
+  result.iterations = iterations;
+  result.seconds = seconds;
+  result.patterns = repetitions;
+  result.flops = cost.flops * repetitions;
+  result.bytes = cost.bytes * repetitions;
+  return result;
+}
+
+// connects each unit to fanIn randomly chosen units of the previous layer
+// (and the bias) using individual weights.
+static void connectRandomly(IndividuallyConnectedLayer* layer, int prevUnits, int fanIn)
+{
+  int index = 0;
+  for (int to=1; to <= layer->numUnits; to++) {
+    layer->addConnection(0, to, index++);
+    for (int k=0; k < fanIn; k++) {
+      layer->addConnection(1 + (int) (drand48() * prevUnits), to, index++);
+    }
+  }
+}
+
+// constructs a net with an input layer of inputCols x inputRows units and
+// the given layer as its second (benchmarked) layer.
+static Net* createLayerNet(int inputCols, int inputRows, LayerArguments* args, int threads, int fanIn=0)
+{
+  vector<LayerArguments*> spec;
+  spec.push_back(new FullyConnectedLayer::FullyConnectedLayerArguments(inputCols, inputRows));
+  spec.push_back(args);
+  
+  Net* net = new Net(threads > 1 ? threads : 0);
+  net->createLayers(spec, threads > 1 ? threads : 0, true);
+  if (fanIn) {
+    connectRandomly(dynamic_cast<IndividuallyConnectedLayer*>(net->layers[1]), inputCols * inputRows, fanIn);
+  }
+  double params[MAX_PARAMS] = { 0.01, 0.1, 0. };
+  net->setUpdateFunc(0, params);
+  net->connectLayers();
+  net->initWeights(0, .1);
+  
+  BasicLayerType* input = net->layers[0];
+  for (int c=0; c <= input->numCopies; c++) {
+    for (int i=1; i <= input->numUnits; i++) {
+      input->out[c*(input->numUnits+1)+i] = drand48();
+    }
+  }
+  return net;
+}
+
+static void benchLayers(const vector<int>& sizes, const vector<int>& threadCounts, double minTime, vector<Result>& results)
+{
+  for (unsigned int t=0; t < threadCounts.size(); t++) {
+    int threads = threadCounts[t];
+    for (unsigned int s=0; s < sizes.size(); s++) {
+      int size = sizes[s];
+      vector<pair<string, Net*> > nets;
+      nets.push_back(make_pair(string("FullyConnectedLayer"), 
+                               createLayerNet(size, 1, new FullyConnectedLayer::FullyConnectedLayerArguments(size), threads)));
+      nets.push_back(make_pair(string("MultimodalCrossEntropyOutputLayer"), 
+                               createLayerNet(size, 1, new MultimodalCrossEntropyOutputLayer::MultimodalCrossEntropyOutputLayerArguments(size), threads)));
+      nets.push_back(make_pair(string("IndividuallyConnectedLayer"), 
+                               createLayerNet(size, 1, new IndividuallyConnectedLayer::IndividuallyConnectedLayerArguments(size, 1), threads, 16)));
+      int side = 1;                     // square input image of about size units
+      while ((side+1)*(side+1) <= size) side++;
+      nets.push_back(make_pair(string("ConvolutionLayer"),    // 4 shared 5x5 kernels at every pixel
+                               createLayerNet(side, side, new ConvolutionLayer::ConvolutionLayerArguments(side*4, side, 4, 5, 1, true, true, false), threads)));
+      
+      for (unsigned int n=0; n < nets.size(); n++) {
+        cerr << "Benchmarking " << nets[n].first << " with " << nets[n].second->layers[1]->numUnits 
+             << " units and " << threads << " thread(s)." << endl;
+        for (int op=FORWARD; op <= UPDATE; op++) {
+          results.push_back(measureLayer(nets[n].first, *nets[n].second, 1, (Operation) op, threads, minTime));
+        }
+        delete nets[n].second;
+      }
+    }
+  }
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark End-to-end benchmarks
+#endif
+
+// creates a classification problem with numPatterns random patterns and
+// numClasses classes.
+static PatternSet* createPatternSet(int numPatterns, int inputDim, int numClasses)
+{
+  PatternSet* pattern = new PatternSet();
+  pattern->pattern_count = numPatterns;
+  pattern->input_count = inputDim;
+  pattern->target_count = numClasses;
+  pattern->input = new FTYPE*[numPatterns];
+  pattern->target = new FTYPE*[numPatterns];
+  for (int i=0; i < numPatterns; i++) {
+    pattern->input[i] = new FTYPE[inputDim];
+    pattern->target[i] = new FTYPE[numClasses];
+    for (int d=0; d < inputDim; d++) {
+      pattern->input[i][d] = drand48();
+    }
+    for (int d=0; d < numClasses; d++) {
+      pattern->target[i][d] = d == i % numClasses ? 1. : 0.;
+    }
+  }
+  return pattern;
+}
+
+static Result measureEpochs(const string& name, Net& net, const PatternSet* pattern, Operation op, int threads, double minTime)
+{
+  MultimodalCrossEntropy errorFunction;
+  long epochs = 0;
+  double seconds = 0.;
+  if (op == TRAIN) net.train(pattern, threads, false, &errorFunction); // warm-up
+  else net.test(pattern, threads, false, &errorFunction);
+  
+  double start = now();
+  do {
+    if (op == TRAIN) net.train(pattern, threads, false, &errorFunction);
+    else net.test(pattern, threads, false, &errorFunction);
+    epochs++;
+  } while ((seconds = now() - start) < minTime);
+  
+  Cost cost = estimatePatternCost(net, op == TRAIN);
+  double patterns = (double) epochs * pattern->pattern_count;
+  if (op == TRAIN) {  // one update of all layers per epoch
+    for (unsigned int i=1; i < net.layers.size(); i++) {
+      Cost c = estimateCost(net.layers[i], UPDATE, threads);
+      cost.flops += c.flops / pattern->pattern_count;
+      cost.bytes += c.bytes / pattern->pattern_count;
+    }
+  }
+  
+  Result result;
+  result.name = name;
+  result.op = op;
+  result.size = pattern->pattern_count;
+  result.threads = threads;
+  result.iterations = epochs;
+  result.seconds = seconds;
+  result.patterns = patterns;
+  result.flops = cost.flops * patterns;
+  result.bytes = cost.bytes * patterns;
+  return result;
+}
+
+static void benchNets(int numPatterns, const vector<int>& threadCounts, double minTime, vector<Result>& results)
+{
+  PatternSet* pattern = createPatternSet(numPatterns, 256, 10);
+  
+  for (unsigned int t=0; t < threadCounts.size(); t++) {
+    int threads = threadCounts[t];
+    int copies = threads > 1 ? threads : 0;
+    double params[MAX_PARAMS] = { 0.01, 0.1, 0. };
+    
+    vector<pair<string, vector<LayerArguments*> > > specs;
+    vector<LayerArguments*> mlp;      // multi-layer perceptron
+    mlp.push_back(new FullyConnectedLayer::FullyConnectedLayerArguments(256));
+    mlp.push_back(new FullyConnectedLayer::FullyConnectedLayerArguments(256));
+    mlp.push_back(new FullyConnectedLayer::FullyConnectedLayerArguments(128));
+    mlp.push_back(new MultimodalCrossEntropyOutputLayer::MultimodalCrossEntropyOutputLayerArguments(10));
+    specs.push_back(make_pair(string("mlp-256-256-128-10"), mlp));
+    vector<LayerArguments*> cnn;      // convolutional net on 16x16 images
+    cnn.push_back(new FullyConnectedLayer::FullyConnectedLayerArguments(16, 16));
+    cnn.push_back(new ConvolutionLayer::ConvolutionLayerArguments(64, 16, 4, 5, 1, true, true, false));
+    cnn.push_back(new FullyConnectedLayer::FullyConnectedLayerArguments(64));
+    cnn.push_back(new MultimodalCrossEntropyOutputLayer::MultimodalCrossEntropyOutputLayerArguments(10));
+    specs.push_back(make_pair(string("cnn-16x16-4x5x5-64-10"), cnn));
+    
+    for (unsigned int n=0; n < specs.size(); n++) {
+      cerr << "Benchmarking epochs of " << specs[n].first << " with " << threads << " thread(s)." << endl;
+      Net net(copies);
+      net.createLayers(specs[n].second, copies, true);
+      net.setUpdateFunc(0, params);
+      net.connectLayers();
+      net.initWeights(0, .1);
+      results.push_back(measureEpochs(specs[n].first, net, pattern, TRAIN, threads, minTime));
+      results.push_back(measureEpochs(specs[n].first, net, pattern, TEST, threads, minTime));
+    }
+  }
+  delete pattern;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Output
+#endif
+
+static void writeJSON(ostream& out, const vector<Result>& results, double minTime)
+{
+  out << "{" << endl;
+  out << "  \"library\": \"npp2\"," << endl;
+  out << "  \"kernels\": \"" << getKernelVariant() << "\"," << endl;
+  out << "  \"processors\": " << sysconf(_SC_NPROCESSORS_ONLN) << "," << endl;
+  out << "  \"precision_bytes\": " << sizeof(FTYPE) << "," << endl;
+  out << "  \"min_time_s\": " << minTime << "," << endl;
+  out << "  \"results\": [" << endl;
+  for (unsigned int i=0; i < results.size(); i++) {
+    const Result& r = results[i];
+    out << "    { \"name\": \"" << r.name << "\", \"op\": \"" << operationNames[r.op] << "\""
+        << ", \"size\": " << r.size << ", \"threads\": " << r.threads 
+        << ", \"iterations\": " << r.iterations << ", \"seconds\": " << r.seconds
+        << ", \"" << (r.op == UPDATE ? "updates_per_s" : "patterns_per_s") << "\": " << r.patterns / r.seconds
+        << ", \"gflops\": " << r.flops / r.seconds * 1e-9
+        << ", \"gbytes_per_s\": " << r.bytes / r.seconds * 1e-9 << " }"
+        << (i+1 < results.size() ? "," : "") << endl;
+  }
+  out << "  ]" << endl;
+  out << "}" << endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+  double minTime = .2;             // minimal duration of each benchmark in seconds
+  bool quick = false;
+  string output;
+  
+  for (int i=1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      quick = true;
+    }
+    else if (strcmp(argv[i], "--min-time") == 0 && i+1 < argc) {
+      minTime = atof(argv[++i]);
+    }
+    else if (strcmp(argv[i], "--output") == 0 && i+1 < argc) {
+      output = argv[++i];
+    }
+    else {                      // --help or an unknown (or incomplete) argument
+      bool help = strcmp(argv[i], "--help") == 0;
+      (help ? cout : cerr) << "Usage: " << argv[0] << " [--quick] [--min-time <seconds>] [--output <file.json>]" << endl;
+      exit(help ? 0 : 1);
+    }
+  }
+  
+  srand48(1);
+  int processors = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  vector<int> threadCounts;
+  for (int t=1; t <= processors && t <= (quick ? 2 : 8); t*=2) {
+    threadCounts.push_back(t);
+  }
+  vector<int> sizes;
+  sizes.push_back(64);
+  sizes.push_back(256);
+  if (!quick) sizes.push_back(1024);
+  
+  vector<Result> results;
+  benchLayers(sizes, threadCounts, minTime, results);
+  benchNets(quick ? 500 : 2000, threadCounts, minTime, results);
+  
+  if (output.empty()) {
+    writeJSON(cout, results, minTime);
+  }
+  else {
+    ofstream out(output.c_str());
+    if (!out) {
+      cerr << "Could not open " << output << " for writing." << endl;
+      exit(1);
+    }
+    writeJSON(out, results, minTime);
+  }
+  return 0;
+}
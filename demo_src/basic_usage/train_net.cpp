@@ -72,7 +72,7 @@ int main( int argc, char *argv[] )
     pattern.target_count            // size of target layer depends on the patern
   };
   Net net;
-  double param[MAX_PARAMS];               // RPROP parameters
+  double param[MAX_PARAMS] = { 0. };      // RPROP parameters
   param[0] = 0.1;                            // delta 0
   param[1] = 0.8;                            // delta max
   param[2] = 0.0;                             // weight-decay
@@ -0,0 +1,162 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/* N++2: demo of data-parallel training by several processes. Starts the
+ * given number of worker processes on this host, each training its own copy
+ * of the net on a shard of the patterns. The processes sum up the 
+ * derivatives with an allreduce over Unix domain sockets before each weight
+ * update. Afterwards, the first process compares its net to a net trained 
+ * on all patterns in a single process.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "npp2.h"
+#include "PatternSet.h"
+#include "UnixSocketCommunicator.h"
+#include "DistributedTrainer.h"
+
+#define SEED 4711
+
+using namespace std;
+using namespace NPP2;
+
+/** creates the same, randomly initialized net in every process */
+static void createNet(Net& net, const PatternSet& pattern)
+{
+  int topology[4] = { pattern.input_count, 10, 10, pattern.target_count };
+  double param[MAX_PARAMS] = { 0.1,  // delta 0
+                               0.8,  // delta max
+                               0.0 };// weight-decay
+  
+  net.createLayers(4, &topology[0]);
+  net.setUpdateFunc(0, &param[0]);
+  net.connectLayers();
+  srand48(SEED);
+  net.initWeights(0, .5);
+}
+
+/** the work of one process */
+static int runWorker(const PatternSet& pattern, int rank, int size, int numEpochs, const string& socketPath)
+{
+  try {
+    Net net;
+    createNet(net, pattern);
+    PatternSet* shard = DistributedTrainer::createShard(pattern, rank, size);
+    UnixSocketCommunicator communicator(socketPath, rank, size);
+    DistributedTrainer trainer(&net, &communicator);
+    trainer.broadcastWeights();
+    
+    SquaredError error;
+    for (int n=0; n < numEpochs; n++) {
+      double tss = trainer.train(shard, &error);
+      if (rank == 0) {
+        cerr << "Epoche " << n << ", tss: " << tss << endl; 
+      }
+    }
+    Error testError = trainer.test(shard, &error);
+    delete shard;
+    
+    if (rank == 0) {
+      cerr << "Test: tss " << testError.regrError << ", classification error " << testError.classError << "%" << endl;
+      
+      Net reference;                 // the same training in a single process
+      createNet(reference, pattern);
+      for (int n=0; n < numEpochs; n++) {
+        reference.train(&pattern, 1, false, &error);
+      }
+      double maxDeviation = 0.;
+      for (int n=0; n < pattern.pattern_count; n++) {
+        net.forwardPass(pattern.input[n], net.outVec);
+        reference.forwardPass(pattern.input[n], reference.outVec);
+        for (int i=0; i < net.getTopologyData().outCount; i++) {
+          maxDeviation = max(maxDeviation, fabs(net.outVec[i] - reference.outVec[i]));
+        }
+      }
+      cerr << "Max. deviation from training in a single process: " << maxDeviation << endl;
+      net.saveNet("trained.net");
+    }
+  }
+  catch (NPPException& e) {
+    cerr << "Process " << rank << " failed: " << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
+
+/** Examplary usage: ./bin/train_distributed examples/xor.pat 4 100 */
+int main( int argc, char *argv[] )
+{
+  if (argc < 4) {
+    cerr << "Usage: " << argv[0] << " <Patterndatei> <Prozesse> <Epochen> [Socket]" << endl;
+    exit(0);
+  }
+  
+  PatternSet pattern;
+  pattern.load_pattern(argv[1]);
+  int numProcesses = atoi(argv[2]);
+  int numEpochs = atoi(argv[3]);
+  ostringstream socketPath;
+  if (argc > 4) {
+    socketPath << argv[4];
+  }
+  else {
+    socketPath << "/tmp/npp2-ring-" << getpid();
+  }
+  if (numProcesses < 1) numProcesses = 1;
+  
+  for (int rank=1; rank < numProcesses; rank++) { // the other processes are children of this one
+    pid_t pid = fork();
+    if (pid < 0) {
+      cerr << "Could not start process " << rank << "." << endl;
+      exit(1);
+    }
+    if (pid == 0) {
+      exit(runWorker(pattern, rank, numProcesses, numEpochs, socketPath.str()));
+    }
+  }
+  int result = runWorker(pattern, 0, numProcesses, numEpochs, socketPath.str());
+  
+  for (int rank=1; rank < numProcesses; rank++) {
+    int status;
+    if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      result = 1;
+    }
+  }
+  return result;
+}
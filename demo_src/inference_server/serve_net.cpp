@@ -0,0 +1,145 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/* N++2: demo of the inference server. Serves a trained net on a Unix domain
+ * socket. Optionally, runs a number of local clients in parallel that send
+ * random patterns to the server and compares the answers to the outputs of
+ * the net propagating the patterns one by one.
+ */
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <pthread.h>
+#include "npp2.h"
+#include "InferenceServer.h"
+#include "InferenceClient.h"
+
+#define REQUESTS_PER_CLIENT 200
+
+using namespace std;
+using namespace NPP2;
+
+/** the patterns sent by one of the test clients and the answers received */
+struct TestClient {
+  string socketPath;
+  pthread_t threadId;
+  vector<FTYPE> in;
+  vector<FTYPE> out;
+  bool ok;
+};
+
+static void* runClient(void* arg)
+{
+  TestClient* test = (TestClient*) arg;
+  test->ok = false;
+  try {
+    InferenceClient client;
+    client.connect(test->socketPath);
+    test->in.resize(REQUESTS_PER_CLIENT * client.getInCount());
+    test->out.resize(REQUESTS_PER_CLIENT * client.getOutCount());
+    for (unsigned int i=0; i < test->in.size(); i++) {
+      test->in[i] = (FTYPE) rand() / RAND_MAX;
+    }
+    for (int n=0; n < REQUESTS_PER_CLIENT; n++) {
+      client.forwardPass(&test->in[n*client.getInCount()], &test->out[n*client.getOutCount()]);
+    }
+    test->ok = true;
+  }
+  catch (NPPException& e) {
+    cerr << "Client failed: " << e.what() << endl;
+  }
+  return 0;
+}
+
+/** Examplary usage: ./bin/serve_net trained.net /tmp/npp2.sock 32 500 8 */
+int main( int argc, char *argv[] )
+{
+  if (argc < 3) {
+    cerr << "Usage: " << argv[0] << " <Netzdatei> <Socket> [max. Batch] [Latenzbudget in us] [Testclients]" << endl;
+    exit(0);
+  }
+  int maxBatch = argc > 3 ? atoi(argv[3]) : 32;
+  int latencyBudget = argc > 4 ? atoi(argv[4]) : 1000;
+  int numClients = argc > 5 ? atoi(argv[5]) : 0;
+  
+  try {
+    InferenceServer server(argv[1]);
+    server.setMaxBatch(maxBatch);
+    server.setLatencyBudget(latencyBudget);
+    server.start(argv[2]);
+    
+    if (numClients <= 0) {           // serve until the user hits return
+      cerr << "Serving " << argv[1] << " on " << argv[2] << ". Press return to stop." << endl;
+      cin.get();
+    }
+    else {                           // test the server with local clients
+      vector<TestClient> clients(numClients);
+      for (int c=0; c < numClients; c++) {
+        clients[c].socketPath = argv[2];
+        pthread_create(&clients[c].threadId, 0, runClient, &clients[c]);
+      }
+      for (int c=0; c < numClients; c++) {
+        pthread_join(clients[c].threadId, 0);
+      }
+      
+      Net net;                       // reference: the same net, propagating the patterns one by one
+      net.loadNet(argv[1]);
+      double maxError = 0.;
+      for (int c=0; c < numClients; c++) {
+        if (!clients[c].ok) {
+          cerr << "Client " << c << " failed." << endl;
+          return 1;
+        }
+        int inCount = net.getTopologyData().inCount;
+        int outCount = net.getTopologyData().outCount;
+        for (int n=0; n < REQUESTS_PER_CLIENT; n++) {
+          net.forwardPass(&clients[c].in[n*inCount], net.outVec);
+          for (int i=0; i < outCount; i++) {
+            maxError = max(maxError, fabs(net.outVec[i] - clients[c].out[n*outCount+i]));
+          }
+        }
+      }
+      cerr << "Answered " << server.getNumRequests() << " requests in " << server.getNumBatches() 
+           << " batches (average size " << (double) server.getNumRequests() / server.getNumBatches() 
+           << "), maximal deviation from forwardPass: " << maxError << endl;
+    }
+    server.stop();
+  }
+  catch (NPPException& e) {
+    cerr << e.what() << endl;
+    return 1;
+  }
+  return 0;
+}
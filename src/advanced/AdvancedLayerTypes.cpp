@@ -48,6 +48,7 @@
 #include <cblas.h>
 #endif
 #include <map>
+#include <algorithm>
 #include <cassert>
 
 
@@ -166,7 +167,6 @@ void MultimodalCrossEntropyOutputLayer::backwardPass(FTYPE *dedout, int copy)
   }
   
   int pos = copy*(numUnits+1);
-  int posWeightMatrices = copy*(previousDim+1) * numUnits;
   
   for (int i=1; i <= numUnits; i++) {
     dEdnet[pos+i] = dEdo[pos+i];  // ATTENTION: expects (  o - t  )  in dEdo.    
@@ -180,31 +180,57 @@ void MultimodalCrossEntropyOutputLayer::backwardPass(FTYPE *dedout, int copy)
   } */
   
   // given dEdnet, now calculate partial derivatives for the individual weights.
-  // uses a blas matrix-matrix operation to achieve this (output will be a matrix).
-  cblas_dgemm( CblasRowMajor,            // Row-Major encoding of matrix
-               CblasNoTrans,             // no matrix needs
-               CblasNoTrans,             // to be transposed 
-               numUnits, 
-               previousDim+1, 
-               1, 
-               1., 
-               &dEdnet[pos+1],           // input matrix with dEdnet
-               1, 
-               &net->layers[layerId-1]->out[copy*(previousDim+1)],// input with activations (actually a vector, but used here as a matrix)
-               previousDim+1, 
-               1.,                       // in order to sum up over the pattern!
-               &dEdw[posWeightMatrices], // sum up in copy-th copy of dEdw
-               previousDim+1) ; 
+  // uses a blas matrix-matrix operation to achieve this (output will be a matrix,
+  // see FullyConnectedLayer::accumulateGradients). frozen layers skip this step.
+  if (trainable) {
+    accumulateGradients(copy);     // with shared gradients, the pattern is staged instead
+  }
   
   // now sum up the partial derivatives comming from different outgoing connections
   // for each of the previous layer's neurons. This uses a BLAS 
-  // matrix-vector operation.
-  cblas_dgemv(CblasRowMajor, CblasTrans, numUnits, previousDim, 1., weights+1, previousDim+1, &dEdnet[pos+1], 1, 0., dedout, 1);  // skip bias
+  // matrix-vector operation. Skipped, if the caller does not need them.
+  if (dedout) {
+    cblas_dgemv(CblasRowMajor, CblasTrans, numUnits, previousDim, 1., weights+1, previousDim+1, &dEdnet[pos+1], 1, 0., dedout, 1);  // skip bias
+  }
   
 }
 
 
 
+void MultimodalCrossEntropyOutputLayer::forwardPassSparse(FTYPE *input, const int* activeIndex, const FTYPE* activeValue, int numActive, int copy)
+{
+  BasicLayerType::forwardPassSparse(input, activeIndex, activeValue, numActive, copy);
+}
+
+void MultimodalCrossEntropyOutputLayer::backwardPassSparse(FTYPE *dedout, const int* activeIndex, const FTYPE* activeValue, int numActive, int copy)
+{
+  BasicLayerType::backwardPassSparse(dedout, activeIndex, activeValue, numActive, copy);
+}
+
+void MultimodalCrossEntropyOutputLayer::forwardPassPart(FTYPE *input, int part, int numParts, int copy)
+{
+  BasicLayerType::forwardPassPart(input, part, numParts, copy);
+}
+
+void MultimodalCrossEntropyOutputLayer::forwardPassBatch(const FTYPE *input, FTYPE *netin, FTYPE *out, int numPatterns)
+{
+  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, numPatterns, numUnits, previousDim+1,
+              1., input, previousDim+1, weights, previousDim+1, 0., &netin[1], numUnits+1);
+  for (int p=0; p < numPatterns; p++) {
+    int pos = p*(numUnits+1);
+    double sum = 0.;
+    for (int i=1; i <= numUnits; i++) {
+      sum += exp(netin[pos+i]);
+    }
+    out[pos] = 1.;
+    for (int i=1; i <= numUnits; i++) {
+      out[pos+i] = exp(netin[pos+i]) / sum;
+    }
+  }
+}
+
+
+
 #ifdef __APPLE__
 #pragma mark -
 #pragma mark Individually Connected Layer
@@ -218,13 +244,13 @@ LayerArguments* IndividuallyConnectedLayer::getArguments() const
 
 
 IndividuallyConnectedLayer::IndividuallyConnectedLayer() 
-: BasicLayerType(0, 0, 0, 0, 0, 0)
+: BasicLayerType(0, 0, 0, 0, 0, 0), connected(false)
 {
   identifer = "IndividuallyConnectedLayer";
 }
 
 IndividuallyConnectedLayer::IndividuallyConnectedLayer(Net* net, int layerId, const LayerArguments* args)
-: BasicLayerType(net, layerId, args)
+: BasicLayerType(net, layerId, args), connected(false)
 {
   identifer = "IndividuallyConnectedLayer";
   if (layerId > 0 &&  !net->layers[layerId-1]) {
@@ -252,8 +278,70 @@ void IndividuallyConnectedLayer::forwardPass(FTYPE *input, int copy)
     netin[pos+connections[i].to] += weights[connections[i].index] * input[connections[i].from];
   }
   
-  for (int i=1; i <= numUnits; i++) {
-    out[pos+i] = act_f(netin[pos+i]);
+  applyActivation(&netin[pos+1], &out[pos+1], numUnits);
+}
+
+void IndividuallyConnectedLayer::forwardPassPart(FTYPE *input, int part, int numParts, int copy)
+{
+  if ((int) partBegin.size() != numParts+1) {  // not prepared for this number of parts
+    BasicLayerType::forwardPassPart(input, part, numParts, copy);
+    return;
+  }
+  int begin, end;
+  getPartRange(part, numParts, connections.size(), &begin, &end);
+  if (begin >= end) return;
+  
+  int pos  = copy*(numUnits+1);
+  for (int i=begin; i < end; i++) {
+    netin[pos+i] = (FTYPE) 0;
+  }
+  for (int k=partBegin[part]; k < partBegin[part+1]; k++) {
+    const Connection& c = connections[partConnections[k]];
+    netin[pos+c.to] += weights[c.index] * input[c.from];
+  }
+  applyActivation(&netin[pos+begin], &out[pos+begin], end-begin);
+}
+
+void IndividuallyConnectedLayer::preparePartition(int numParts)
+{
+  // stable counting sort of the connections by their target unit. keeps the 
+  // order of the connections of each unit and thus the order of summation.
+  std::vector<int> first(numUnits+2, 0);
+  for (unsigned int i=0; i < connections.size(); i++) {
+    first[connections[i].to+1]++;
+  }
+  for (int u=1; u < numUnits+2; u++) {
+    first[u] += first[u-1];
+  }
+  partConnections.resize(connections.size());
+  std::vector<int> next(first);
+  for (unsigned int i=0; i < connections.size(); i++) {
+    partConnections[next[connections[i].to]++] = i;
+  }
+  
+  partBegin.resize(numParts+1);
+  for (int p=0; p < numParts; p++) {
+    int begin, end;
+    getPartRange(p, numParts, connections.size(), &begin, &end);
+    partBegin[p] = first[begin];
+  }
+  partBegin[numParts] = connections.size();
+}
+
+void IndividuallyConnectedLayer::forwardPassBatch(const FTYPE *input, FTYPE *netin, FTYPE *out, int numPatterns)
+{
+  int prevDim = net->layers[layerId-1]->numUnits;
+  for (int p=0; p < numPatterns; p++) {
+    const FTYPE* in = &input[p*(prevDim+1)];
+    int pos = p*(numUnits+1);
+    for (int i=1; i <= numUnits; i++) {
+      netin[pos+i] = (FTYPE) 0;
+    }
+    for (unsigned int i=0; i < connections.size(); i++) {
+      netin[pos+connections[i].to] += weights[connections[i].index] * in[connections[i].from];
+    }
+    out[pos] = 1.;
+    applyActivation(&netin[pos+1], &out[pos+1], numUnits);
   }
 }
 
@@ -263,19 +351,34 @@ void IndividuallyConnectedLayer::backwardPass(FTYPE *dedout, int copy)
   int pos = copy*(numUnits+1);
 
   
-  for (int i=1; i <= numUnits; i++) {
-    dEdnet[pos+i] = dEdo[pos+i] * deriv_f(out[pos+i], netin[pos+i]);
-    dEdo[pos+i] = (FTYPE) 0;
-  }
+  applyDerivative(&dEdo[pos+1], &out[pos+1], &netin[pos+1], &dEdnet[pos+1], numUnits);
   
   if (getLayerType() == INPUT_LAYER) {
-    memcpy(dedout, &(dEdnet[pos+1]), sizeof (FTYPE) * numUnits);
+    if (dedout) {
+      memcpy(dedout, &(dEdnet[pos+1]), sizeof (FTYPE) * numUnits);
+    }
     return; // ready. Otherwise calc derivs for weights and output of previous layer.
   }
   
   int posPrev = copy*(net->layers[layerId-1]->numUnits+1);
   int posWeights = copy*(weights.size());
   
+  if (!trainable) { // frozen layer: only the derivatives in respect to the previous layer's output, if any
+    if (dedout) {
+      for (unsigned int i=0; i < connections.size(); i++) {
+        dedout[connections[i].from-1] += dEdnet[pos+connections[i].to] * weights[connections[i].index]; 
+      }
+    }
+    return;
+  }
+  
+  if (!dedout) { // derivatives in respect to the previous layer's output are not needed; just scatter into dEdw
+    for (unsigned int i=0; i < connections.size(); i++) {
+      dEdw[posWeights+connections[i].index] += dEdnet[pos+connections[i].to] * net->layers[layerId-1]->out[posPrev+connections[i].from];
+    }
+    return;
+  }
+  
   for (unsigned int i=0; i < connections.size(); i++) {
     dEdw[posWeights+connections[i].index] += dEdnet[pos+connections[i].to] * net->layers[layerId-1]->out[posPrev+connections[i].from]; // ok, die Ausgabe von out[copy + 0] muesste 1 sein
       // Achtung: dedout wird nicht inklusive Bias-neuron übergeben!!!
@@ -283,25 +386,56 @@ void IndividuallyConnectedLayer::backwardPass(FTYPE *dedout, int copy)
   }
 }
 
-void IndividuallyConnectedLayer::updateWeights(int numThreads)
+bool IndividuallyConnectedLayer::reduceGradients(int numThreads)
 {
-  if (!updateFunction || !weights.size() || !variables.size()) {
-    cerr << "Layer " << layerId << " not correctly initialized." << endl;
-    exit(1);
-  }
-  
+  if (!trainable) return true;
   if (numThreads > 1) {
     for (int i=1; i <= numThreads; i++) {
       cblas_daxpy(weights.size(), 1., &dEdw[weights.size()*i], 1, &dEdw[0], 1);  // Gewichständerungen zusammensummieren: N*N kernel-weights + 1 Biasgewicht
       cblas_dscal(weights.size(), 0., &dEdw[weights.size()*i], 1);           // und auf null setzen
     }
   }
+  return true;
+}
+
+bool IndividuallyConnectedLayer::mergeGradients(int copy)
+{
+  if (!trainable) return true;
+  if (copy > 0) {
+    cblas_daxpy(weights.size(), 1., &dEdw[weights.size()*copy], 1, &dEdw[0], 1);
+    cblas_dscal(weights.size(), 0., &dEdw[weights.size()*copy], 1);
+  }
+  return true;
+}
+
+FTYPE* IndividuallyConnectedLayer::getGradients(int* count)
+{
+  if (dEdw.empty()) {  // frozen layers do not have any derivatives
+    *count = 0;
+    return 0;
+  }
+  *count = weights.size();
+  return &dEdw[0];
+}
+
+FTYPE* IndividuallyConnectedLayer::getWeights(int* count)
+{
+  *count = weights.size();
+  return weights.empty() ? 0 : &weights[0];
+}
+
+void IndividuallyConnectedLayer::updateWeights(int numThreads)
+{
+  if (!trainable) return; // frozen weights are never changed
   
-  int numVariables = updateFunction->getNumVariables();
+  if (!updateFunction || !weights.size() || !variables.size()) {
+    cerr << "Layer " << layerId << " not correctly initialized." << endl;
+    exit(1);
+  }
   
-  for (unsigned int pos=0; pos < weights.size(); pos++) {  // nun alle Gewichte aller numKernels Kernel updaten
-    (*updateFunction) (&weights[pos], &delta[pos], &dEdw[pos], &variables[pos*numVariables]);
-  }  
+  reduceGradients(numThreads);
+  
+  updateFunction->update(&weights[0], delta.size() ? &delta[0] : 0, &dEdw[0], &variables[0], weights.size());  // nun alle Gewichte aller numKernels Kernel updaten
 }
 
 
@@ -311,8 +445,13 @@ void IndividuallyConnectedLayer::connectLayer(const BasicLayerType* previousLaye
 {  
   assert(weights.size() > 0);  // at least one weight is necessary
   
-  delta.resize(weights.size(), 0.);
-  dEdw.resize(weights.size() * (numCopies+1), 0.);  // n-copies, used by the n-threads to accumulate deriv. for patterns
+  connected = true;
+  if (!updateFunction || updateFunction->usesDelta()) {
+    delta.resize(weights.size(), 0.);
+  }
+  if (trainable) {  // frozen layers do not accumulate any derivatives
+    dEdw.resize(weights.size() * (numCopies+1), 0.);  // n-copies, used by the n-threads to accumulate deriv. for patterns
+  }
   
   if (updateFunction) {
     setUpdateFunction(updateFunction);  // re-set the updateFunction in order to create and initialize the variable-vector
@@ -328,6 +467,13 @@ void IndividuallyConnectedLayer::setUpdateFunction(const UpdateFunction* updateF
     delete oldf;
   }
 
+  if (!this->updateFunction->usesDelta()) {  // the state is completely held in the variables
+    std::vector<FTYPE>().swap(delta);
+  }
+  else if (connected) {
+    delta.resize(weights.size(), 0.);
+  }
+  
   int numVariables = this->updateFunction->getNumVariables();
   variables.resize(weights.size() * numVariables, 0.);
   for (unsigned int i=0; i < weights.size(); i++) {
@@ -337,6 +483,58 @@ void IndividuallyConnectedLayer::setUpdateFunction(const UpdateFunction* updateF
 
 
 
+void IndividuallyConnectedLayer::setTrainable(bool trainable)
+{
+  BasicLayerType::setTrainable(trainable);
+  
+  if (!connected) return;  // connectLayer will take care of dEdw
+  
+  if (!trainable) {           // frozen: release the derivatives of all copies
+    std::vector<FTYPE>().swap(dEdw);
+  }
+  else if (!dEdw.size()) {    // unfrozen: start with fresh derivatives
+    dEdw.resize(weights.size() * (numCopies+1), 0.);
+  }
+}
+
+
+void IndividuallyConnectedLayer::setNumCopies(int numCopies)
+{
+  if (dEdw.size()) {
+    reduceGradients(this->numCopies);  // keep the derivatives accumulated in all copies
+    std::vector<FTYPE> resized(weights.size() * (numCopies+1), 0.);  // copy instead of resize in order to release the memory when shrinking
+    std::copy(dEdw.begin(), dEdw.begin() + weights.size(), resized.begin());
+    dEdw.swap(resized);
+  }
+  BasicLayerType::setNumCopies(numCopies);
+}
+
+void IndividuallyConnectedLayer::getMemoryUsage(MemoryUsage& usage) const
+{
+  BasicLayerType::getMemoryUsage(usage);
+  
+  usage.add(MEMORY_WEIGHTS, weights.capacity(), sizeof(FTYPE));
+  usage.add(MEMORY_DELTA, delta.capacity(), sizeof(FTYPE));
+  usage.add(MEMORY_DEDW, dEdw.capacity(), sizeof(FTYPE));
+  usage.add(MEMORY_VARIABLES, variables.capacity(), sizeof(FTYPE));
+  usage.add(MEMORY_CONNECTIONS, connections.capacity(), sizeof(Connection));
+}
+
+void IndividuallyConnectedLayer::estimateMemoryUsage(const BasicLayerType* previousLayer, int numCopies, const UpdateFunction* updateFunction, MemoryUsage& usage) const
+{
+  BasicLayerType::estimateMemoryUsage(previousLayer, numCopies, updateFunction, usage);
+  
+  if (!weights.size()) {  // connections will be added later on
+    usage.complete = false;
+    return;
+  }
+  
+  size_t n = weights.size();
+  estimateWeightUsage(n, numCopies, updateFunction, usage);
+  usage.add(MEMORY_CONNECTIONS, connections.size(), sizeof(Connection));
+}
+
+
 void IndividuallyConnectedLayer::initWeights(int mode, FTYPE range)
 {
   if(mode == 0){
@@ -426,7 +624,7 @@ void IndividuallyConnectedLayer::readFromStream(std::istream& in)
 
 void IndividuallyConnectedLayer::addConnection(int from, int to, int index)
 {
-  if (delta.size()) {
+  if (connected) {
     cerr << "ERROR: add all connections BEFORE calling connect_layer." << endl;
     exit(1);
   }
@@ -500,6 +698,23 @@ ConvolutionLayer::ConvolutionLayer(Net* net, int layerId, const LayerArguments*
   }
 }
 
+void ConvolutionLayer::estimateMemoryUsage(const BasicLayerType* previousLayer, int numCopies, const UpdateFunction* updateFunction, MemoryUsage& usage) const
+{
+  BasicLayerType::estimateMemoryUsage(previousLayer, numCopies, updateFunction, usage);
+
+  // same number of weights as calculated in connectLayer
+  size_t n = 
+    (shareBias ? (sum ? 1 : numKernels) :  numUnits) +
+    (shareWeights ? kernelSize * kernelSize * numKernels :
+     (sum ? kernelSize * kernelSize * numKernels * numUnits : kernelSize * kernelSize * numUnits));
+  // a bias connection and a complete kernel per unit; kernels overlapping 
+  // the boundary are cut-off, thus this is an upper bound.
+  size_t c = (size_t) numUnits * (1 + kernelSize * kernelSize * (sum ? numKernels : 1));
+  
+  estimateWeightUsage(n, numCopies, updateFunction, usage);
+  usage.add(MEMORY_CONNECTIONS, c, sizeof(Connection));
+}
+
 void ConvolutionLayer::connectKernels(int x, int y, int to, int k)
 {
  // cerr << "Connect to " << to << " from " << x << "/" << y << " for kernel " << k << endl;
@@ -72,6 +72,17 @@ namespace NPP2 {
     /** replaces the 'standard' back-propagation of errors in order to match
      * the cross-entropy activation in the forward pass. */
     void backwardPass(FTYPE *dedo, int copy=0);
+    /** the softmax activation is not implemented for sparse inputs; falls
+     * back to the dense forwardPass. */
+    void forwardPassSparse(FTYPE *input, const int* activeIndex, const FTYPE* activeValue, int numActive, int copy=0);
+    /** falls back to the dense backwardPass. */
+    void backwardPassSparse(FTYPE *dedo, const int* activeIndex, const FTYPE* activeValue, int numActive, int copy=0);
+    /** the softmax needs the net inputs of all units; propagates the
+     * complete layer in part 0. */
+    void forwardPassPart(FTYPE *input, int part, int numParts, int copy=0);
+    /** calculates the net inputs of all patterns like the fully connected 
+     * layer and applies the softmax to each of the patterns. */
+    void forwardPassBatch(const FTYPE *input, FTYPE *netin, FTYPE *out, int numPatterns);
     
     MultimodalCrossEntropyOutputLayer();
     MultimodalCrossEntropyOutputLayer(Net* net, int layerId, const LayerArguments* args);
@@ -119,10 +130,27 @@ namespace NPP2 {
     std::vector<FTYPE> dEdw;     ///< holding the part. deriv. of all connections
 
     std::vector<Connection> connections; ///< list off all connection to this layer
+    bool connected;                      ///< true, after connectLayer has been called. No more connections can be added then.
+    
+    std::vector<int> partConnections;    ///< indices of all connections ordered by their target units (see preparePartition)
+    std::vector<int> partBegin;          ///< first entry in partConnections of each part (plus the end)
     
     void forwardPass(FTYPE *input, int copy=0);  
+    /** propagates the units of a range of targets, using the connections
+     * ordered by preparePartition. */
+    void forwardPassPart(FTYPE *input, int part, int numParts, int copy=0);
+    /** orders the connections by their target units and finds the range of
+     * connections of each part. */
+    void preparePartition(int numParts);
+    /** propagates the patterns one after the other without touching the 
+     * copies of the layer. */
+    void forwardPassBatch(const FTYPE *input, FTYPE *netin, FTYPE *out, int numPatterns);
     void backwardPass(FTYPE *dedo, int copy=0);
     void updateWeights(int numCopies=0);
+    bool reduceGradients(int numCopies);
+    bool mergeGradients(int copy);
+    FTYPE* getGradients(int* count);
+    FTYPE* getWeights(int* count);
     void connectLayer(const BasicLayerType* previousLayer);
     void initWeights(int mode, FTYPE range);
 
@@ -134,6 +162,13 @@ namespace NPP2 {
     void addConnection(int from, int to, int index);
     
     void setUpdateFunction(const UpdateFunction* updateFunction);
+    void setTrainable(bool trainable);
+    void setNumCopies(int numCopies);
+    
+    void getMemoryUsage(MemoryUsage& usage) const;
+    /** the weights of this layer are only known in advance, if the 
+     * connections have been added before connecting the layer. */
+    void estimateMemoryUsage(const BasicLayerType* previousLayer, int numCopies, const UpdateFunction* updateFunction, MemoryUsage& usage) const;
     
     void writeToStream(std::ostream& out) const;
     void readFromStream(std::istream& in);
@@ -229,6 +264,9 @@ namespace NPP2 {
     /** contructs the connection and weights structures according to the setting
      * of the parameters. */
     virtual void connectLayer(const BasicLayerType*);
+    /** calculates the number of weights and (an upper bound of) the number 
+     * of connections from the layer's parameters. */
+    virtual void estimateMemoryUsage(const BasicLayerType* previousLayer, int numCopies, const UpdateFunction* updateFunction, MemoryUsage& usage) const;
     
     ConvolutionLayer();
     ConvolutionLayer(Net* net, int layerId, const LayerArguments* args);
@@ -0,0 +1,382 @@
+#ifndef _NPP2_FIXEDNET_H_
+#define _NPP2_FIXEDNET_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  FixedNet.h
+ *
+ *  Multi-layer perceptrons with a topology that is fixed at compile time.
+ *  For tiny nets (e.g. 2-10-10-1 for the XOR problem), the calls of the 
+ *  BLAS routines, the virtual methods of the layers and the activation 
+ *  functions called through pointers dominate the runtime of Net. Here, all 
+ *  sizes and activation functions are template parameters, so the compiler
+ *  is able to completely unroll and vectorize the propagation and to keep
+ *  the whole net on the stack. The weights are stored in the same order as
+ *  in a net of FullyConnectedLayers and updated by the same RPROP
+ *  implementation. A FixedNet can be converted to and from a Net and thus
+ *  be saved and loaded in the format of Net.
+ *
+ *  Example:
+ *    typedef FixedLayer<2, 10, NPP_LOGISTIC,
+ *            FixedLayer<10, 10, NPP_LOGISTIC,
+ *            FixedLayer<10, 1, NPP_LOGISTIC> > > XorLayers;
+ *    FixedNet<XorLayers> net;
+ *    net.initWeights(0, .5);
+ *    net.train(&pattern, &squaredError);
+ */
+
+#include <string>
+#include <cstring>
+#include "npp2.h"
+#include "FullyConnectedLayer.h"
+#include "PatternSet.h"
+#include "NPPException.h"
+
+namespace NPP2 {
+  
+  /** marks the end of a chain of FixedLayers */
+  struct FixedEnd {
+    enum { NUM_INPUTS = -1, NUM_LAYERS = 0, NUM_WEIGHTS = 0 };
+    
+    void forwardPass(const FTYPE*, const FTYPE*) {}
+    void backwardPass(const FTYPE*, FTYPE*, const FTYPE*, FTYPE*) {}
+    const FTYPE* getOutput() const { return 0; }
+    FTYPE* getOutputDeriv() { return 0; }
+    void getTopology(int*, int*) const {}
+  };
+  
+  /** returns the number of units of the last layer of a chain */
+  template <int NUM_UNITS, class NEXT> struct FixedOutputCount { enum { N = NEXT::NUM_OUTPUTS }; };
+  template <int NUM_UNITS> struct FixedOutputCount<NUM_UNITS, FixedEnd> { enum { N = NUM_UNITS }; };
+  
+  /** A fully connected layer with IN inputs, OUT units and the activation
+   * function ACT (NPP_LOGISTIC or NPP_LINEAR), followed by the layers NEXT. 
+   * The layer holds the activations of its units, but not its weights; the 
+   * weights of all layers are passed in one array with the weights of this
+   * layer first. The weights of each unit start with its bias weight, as 
+   * in FullyConnectedLayer. */
+  template <int IN, int OUT, int ACT=NPP_LOGISTIC, class NEXT=FixedEnd>
+  struct FixedLayer {
+    enum { 
+      NUM_INPUTS = IN, 
+      NUM_UNITS = OUT,
+      ACTIVATION = ACT,
+      NUM_LAYERS = 1 + NEXT::NUM_LAYERS,                  ///< number of layers in the chain, starting with this one
+      LAYER_WEIGHTS = (IN+1) * OUT,                       ///< weights of this layer
+      NUM_WEIGHTS = LAYER_WEIGHTS + NEXT::NUM_WEIGHTS,    ///< weights of the whole chain
+      NUM_OUTPUTS = FixedOutputCount<OUT, NEXT>::N        ///< units of the last layer
+    };
+    typedef char InputOfNextLayerMustMatchThisLayer[(NEXT::NUM_LAYERS == 0 || NEXT::NUM_INPUTS == OUT) ? 1 : -1];
+    
+    FTYPE netin[OUT];   ///< net input of each unit
+    FTYPE out[OUT];     ///< activation of each unit
+    FTYPE dEdo[OUT];    ///< derivative in respect to the activation of each unit
+    NEXT next;          ///< subsequent layers
+    
+    /** propagates the input through this and all subsequent layers */
+    void forwardPass(const FTYPE* weights, const FTYPE* input) 
+    {
+      for (int j=0; j < OUT; j++) {
+        const FTYPE* w = &weights[j*(IN+1)];
+        FTYPE sum = w[0];                                 // bias
+        for (int i=0; i < IN; i++) {
+          sum += w[i+1] * input[i];
+        }
+        netin[j] = sum;
+        out[j] = ACT == NPP_LINEAR ? sum : logistic(sum);
+      }
+      next.forwardPass(&weights[LAYER_WEIGHTS], out);
+    }
+    
+    /** back-propagates the derivatives in dEdo of the last layer through
+     * all layers, starting with the last one. Accumulates the derivatives 
+     * of the weights in dEdw and clears dEdo. Writes the derivatives in 
+     * respect to the input to dEdin, if not 0. */
+    void backwardPass(const FTYPE* weights, FTYPE* dEdw, const FTYPE* input, FTYPE* dEdin)
+    {
+      next.backwardPass(&weights[LAYER_WEIGHTS], &dEdw[LAYER_WEIGHTS], out, dEdo); // fills dEdo, unless this is the last layer
+      
+      FTYPE dEdnet[OUT];
+      for (int j=0; j < OUT; j++) {
+        dEdnet[j] = ACT == NPP_LINEAR ? dEdo[j] : dEdo[j] * ((1.0 - out[j]) * out[j]);
+        dEdo[j] = (FTYPE) 0;
+      }
+      for (int j=0; j < OUT; j++) {
+        FTYPE* d = &dEdw[j*(IN+1)];
+        d[0] += dEdnet[j];
+        for (int i=0; i < IN; i++) {
+          d[i+1] += dEdnet[j] * input[i];
+        }
+      }
+      if (dEdin) {
+        for (int i=0; i < IN; i++) {
+          dEdin[i] = (FTYPE) 0;
+        }
+        for (int j=0; j < OUT; j++) {
+          const FTYPE* w = &weights[j*(IN+1)];
+          for (int i=0; i < IN; i++) {
+            dEdin[i] += w[i+1] * dEdnet[j];
+          }
+        }
+      }
+    }
+    
+    /** returns the activations of the last layer */
+    const FTYPE* getOutput() const { return NEXT::NUM_LAYERS ? next.getOutput() : out; }
+    /** returns the derivatives in respect to the activations of the last layer */
+    FTYPE* getOutputDeriv() { return NEXT::NUM_LAYERS ? next.getOutputDeriv() : dEdo; }
+    /** writes the number of units (starting with the inputs) and the 
+     * activation function of each layer */
+    void getTopology(int* units, int* actIds) const
+    {
+      units[0] = IN;
+      units[1] = OUT;
+      actIds[0] = ACT;
+      next.getTopology(&units[1], &actIds[1]);
+    }
+  };
+  
+  
+  /** Multi-layer perceptron built from a chain of FixedLayers. Offers the 
+   * propagation, training and testing methods of Net for a single thread. 
+   * Training uses RPROP with the parameters and semantics of Net 
+   * (see Net::setUpdateFunc). */
+  template <class LAYERS>
+  class FixedNet {
+  public:
+    enum { 
+      NUM_INPUTS = LAYERS::NUM_INPUTS, 
+      NUM_OUTPUTS = LAYERS::NUM_OUTPUTS, 
+      NUM_LAYERS = LAYERS::NUM_LAYERS + 1,   ///< including the input layer, as in Net
+      NUM_WEIGHTS = LAYERS::NUM_WEIGHTS 
+    };
+    
+    FTYPE weights[NUM_WEIGHTS];   ///< weights of all layers, ordered as in the FullyConnectedLayers of a Net
+    
+    /** constructs a net with zero weights, using RPROP with its default 
+     * parameters. */
+    FixedNet() : rprop(defaultParams()) { clear(); }
+    /** constructs a net with zero weights, using RPROP with the given
+     * parameters. */
+    FixedNet(FTYPE* params) : rprop(params) { clear(); }
+    
+    /** sets the parameters of RPROP (see Net::setUpdateFunc) and restarts
+     * the adaptation of the step sizes. */
+    void setUpdateFunc(FTYPE* params)
+    {
+      rprop = RPROP(params);
+      clear();
+    }
+    
+    /** initializes the weights like Net::initWeights */
+    void initWeights(int mode, FTYPE range)
+    {
+      if (mode == 0) {
+        for (int i=0; i < NUM_WEIGHTS; i++) {
+          weights[i] = (FTYPE)((2.0 * range * drand48()) -range);
+        }
+      }
+    }
+    
+    /** propagates one pattern */
+    void forwardPass(const FTYPE* inVec, FTYPE* outVec)
+    {
+      memcpy(input, inVec, sizeof(FTYPE) * NUM_INPUTS);
+      layers.forwardPass(weights, input);
+      memcpy(outVec, layers.getOutput(), sizeof(FTYPE) * NUM_OUTPUTS);
+    }
+    
+    /** back-propagates the derivatives of the error in respect to the 
+     * outputs of the last forwardPass and accumulates the derivatives of the
+     * weights. dedin may be 0. */
+    void backwardPass(const FTYPE* dedout, FTYPE* dedin=0)
+    {
+      memcpy(layers.getOutputDeriv(), dedout, sizeof(FTYPE) * NUM_OUTPUTS);
+      layers.backwardPass(weights, dEdw, input, dedin);
+    }
+    
+    /** updates all weights with the accumulated derivatives */
+    void updateWeights()
+    {
+      rprop.update(weights, 0, dEdw, variables, NUM_WEIGHTS);
+    }
+    
+    /** trains the net for one epoch, like the single-threaded Net::train */
+    double train(const PatternSet* pattern, const ErrorFunction* errorFunction, bool id=false, int numMiniBatches=1)
+    {
+      double tss = 0.;
+      FTYPE outVec[NUM_OUTPUTS];
+      int perBatch = pattern->pattern_count / numMiniBatches;
+      for (int batch = 0; batch < numMiniBatches; batch++) {
+        for (int i=perBatch * batch; i < pattern->pattern_count && (i < perBatch*(batch+1) || batch == numMiniBatches-1); i++) {
+          forwardPass(pattern->input[i], outVec);
+          FTYPE* target = id ? pattern->input[i] : pattern->target[i];
+          tss = errorFunction->errorAndDeriv(outVec, target, outVec, NUM_OUTPUTS, tss);
+          backwardPass(outVec);
+        }
+        updateWeights();
+      }
+      return tss;
+    }
+    
+    /** tests the net like the single-threaded Net::test */
+    Error test(const PatternSet* pattern, const ErrorFunction* errorFunction, bool id=false)
+    {
+      Error error;
+      error.regrError = 0.;
+      int countwrong = 0;
+      FTYPE outVec[NUM_OUTPUTS];
+      for (int i=0; i < pattern->pattern_count; i++) {
+        forwardPass(pattern->input[i], outVec);
+        FTYPE* target = id ? pattern->input[i] : pattern->target[i];
+        int outI=-1, targetI=-1; double targetMax=0., outMax=0.;
+        for (int d=0; d < NUM_OUTPUTS; d++) {
+          error.regrError += errorFunction->error(outVec[d], target[d]);
+          if (outVec[d] >= outMax) {
+            outMax = outVec[d];
+            outI = d;
+          }
+          if (target[d] >= targetMax) {
+            targetMax = target[d];
+            targetI = d;
+          }
+        }
+        if (targetI != outI) countwrong++;
+      }
+      error.classError = (countwrong / (double)pattern->pattern_count) * 100.;
+      return error;
+    }
+    
+    /** creates a Net of FullyConnectedLayers with the same topology, 
+     * activation functions, weights and update parameters. The step sizes
+     * of RPROP are not copied. The caller has to delete the net. */
+    Net* toNet(int numCopies=0) const
+    {
+      int units[NUM_LAYERS], actIds[NUM_LAYERS];
+      layers.getTopology(units, actIds);
+      Net* net = new Net(numCopies);
+      net->createLayers(NUM_LAYERS, units, numCopies);
+      FTYPE params[MAX_PARAMS];
+      memset(params, 0, sizeof(params));
+      rprop.getParameters(params);
+      net->setUpdateFunc(NPP_RPROP, params);
+      net->connectLayers();
+      for (int l=1, pos=0; l < NUM_LAYERS; l++) {
+        net->setLayerActivationFunction(l, actIds[l-1]);
+        FullyConnectedLayer* layer = (FullyConnectedLayer*) net->layers[l];
+        memcpy(layer->weights, &weights[pos], sizeof(FTYPE) * layer->numWeights);
+        pos += layer->numWeights;
+      }
+      return net;
+    }
+    
+    /** copies the weights and update parameters of a Net, that has to 
+     * consist of FullyConnectedLayers with the same numbers of units and 
+     * activation functions. Restarts the adaptation of the step sizes. */
+    void fromNet(const Net& net) throw (NPPException)
+    {
+      int units[NUM_LAYERS], actIds[NUM_LAYERS];
+      layers.getTopology(units, actIds);
+      if (net.getTopologyData().layerCount != NUM_LAYERS) {
+        throw NPPException("The net has a different number of layers than the FixedNet.");
+      }
+      for (int l=0; l < NUM_LAYERS; l++) {
+        const BasicLayerType* layer = net.layers[l];
+        if (layer->numUnits != units[l] || (l > 0 && (layer->identifer != "FullyConnectedLayer" || layer->actId != actIds[l-1]))) {
+          throw NPPException("The layers of the net do not match the layers of the FixedNet.");
+        }
+      }
+      if (net.layers[1]->updateFunction) {
+        FTYPE params[MAX_PARAMS];
+        memset(params, 0, sizeof(params));
+        net.layers[1]->updateFunction->getParameters(params);
+        rprop = RPROP(params);
+      }
+      clear();
+      for (int l=1, pos=0; l < NUM_LAYERS; l++) {
+        const FullyConnectedLayer* layer = (const FullyConnectedLayer*) net.layers[l];
+        memcpy(&weights[pos], layer->weights, sizeof(FTYPE) * layer->numWeights);
+        pos += layer->numWeights;
+      }
+    }
+    
+    /** saves the net in the format of Net::saveNet */
+    void saveNet(const std::string& filename) const throw (NPPException)
+    {
+      Net* net = toNet();
+      try {
+        net->saveNet(filename);
+      }
+      catch (NPPException&) {
+        delete net;
+        throw;
+      }
+      delete net;
+    }
+    
+    /** loads a net saved by Net::saveNet (see fromNet) */
+    void loadNet(const std::string& filename) throw (NPPException)
+    {
+      Net net;
+      net.loadNet(filename);
+      fromNet(net);
+    }
+    
+  protected:
+    LAYERS layers;                    ///< activations of all layers
+    FTYPE input[NUM_INPUTS];          ///< input of the last forwardPass
+    FTYPE dEdw[NUM_WEIGHTS];          ///< accumulated derivatives of the weights
+    FTYPE variables[2*NUM_WEIGHTS];   ///< state of RPROP (at most two variables per weight)
+    RPROP rprop;
+    
+    /** clears the derivatives and the state of RPROP */
+    void clear()
+    {
+      memset(dEdw, 0, sizeof(dEdw));
+      for (int i=0; i < NUM_WEIGHTS; i++) {
+        rprop.initVariables(&variables[i * rprop.getNumVariables()]);
+      }
+      memset(layers.getOutputDeriv(), 0, sizeof(FTYPE) * NUM_OUTPUTS);
+    }
+    
+    static FTYPE* defaultParams()
+    {
+      static FTYPE params[MAX_PARAMS] = { 0. };  // RPROP uses its defaults for zero parameters
+      return params;
+    }
+  };
+  
+}
+
+#endif
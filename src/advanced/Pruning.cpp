@@ -0,0 +1,213 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  Pruning.cpp
+ */
+
+#include "Pruning.h"
+#include "npp2.h"
+#include "FullyConnectedLayer.h"
+#include "AdvancedLayerTypes.h"
+#include "MemoryReport.h"
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <sstream>
+#include <cstdlib>
+#include <cmath>
+#include <sys/time.h>
+
+using namespace std;
+using namespace NPP2;
+
+#define MIN_TIMING 0.02   // each layer is propagated for at least this time (seconds) when measuring its speed
+
+static double currentTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+// propagates the output of the previous layer (copy 0) through the layer 
+// repeatedly and returns the time per pattern. 
+static double timeForwardPass(Net& net, BasicLayerType* layer)
+{
+  FTYPE* input = net.layers[layer->layerId-1]->out;
+  int repetitions = 0;
+  double start = currentTime(), elapsed = 0.;
+  do {
+    for (int i=0; i < 10; i++) {
+      layer->forwardPass(input, 0);
+    }
+    repetitions += 10;
+    elapsed = currentTime() - start;
+  } while (elapsed < MIN_TIMING);
+  return elapsed / repetitions;
+}
+
+static size_t getBytes(const BasicLayerType* layer)
+{
+  MemoryUsage usage;
+  layer->getMemoryUsage(usage);
+  return usage.getTotal();
+}
+
+// replaces the fully connected layer by an individually connected layer 
+// with the connections marked in keep (one flag per weight, bias first in
+// each row) and returns the result.
+static PruningReport::LayerResult replaceLayer(Net& net, int layerNo, const vector<bool>& keep)
+{
+  FullyConnectedLayer* dense = (FullyConnectedLayer*) net.layers[layerNo];
+  PruningReport::LayerResult result;
+  result.layer = layerNo;
+  result.weightsBefore = dense->numWeights;
+  result.bytesBefore = getBytes(dense);
+  result.timeBefore = timeForwardPass(net, dense);
+  
+  IndividuallyConnectedLayer::IndividuallyConnectedLayerArguments args(dense->numCols, dense->numRows);
+  IndividuallyConnectedLayer* sparse = new IndividuallyConnectedLayer(&net, layerNo, &args);
+  sparse->firstUnitId = dense->firstUnitId;
+  sparse->setActivationFunction(dense->actId);
+  sparse->trainable = dense->trainable;
+  
+  vector<int> kept;            // weights of the dense layer in the order of the connections
+  for (int to=1; to <= dense->numUnits; to++) {
+    for (int from=0; from <= dense->previousDim; from++) {
+      int index = (to-1) * (dense->previousDim+1) + from;
+      if (keep[index]) {
+        sparse->addConnection(from, to, (int) kept.size());
+        kept.push_back(index);
+      }
+    }
+  }
+  for (unsigned int i=0; i < kept.size(); i++) {
+    sparse->weights[i] = dense->weights[kept[i]];
+  }
+  if (dense->updateFunction) {
+    sparse->setUpdateFunction(dense->updateFunction);
+  }
+  sparse->connectLayer(net.layers[layerNo-1]);   // initializes the variables of the update function
+  sparse->numWeights = (int) kept.size();
+  sparse->setNetInputInPlace(dense->netin == dense->out);  // keep the memory mode of the net
+  if (net.getLatencyThreads() > 1) {
+    sparse->preparePartition(net.getLatencyThreads());
+  }
+  if (dense->updateFunction) {  // continues with the state of the update function (e.g. the step sizes of RProp)
+    int numVariables = dense->updateFunction->getNumVariables();
+    assert(sparse->variables.size() == kept.size() * numVariables);
+    for (unsigned int i=0; i < kept.size(); i++) {
+      for (int v=0; v < numVariables; v++) {
+        sparse->variables[i*numVariables+v] = dense->variables[kept[i]*numVariables+v];
+      }
+    }
+  }
+  
+  net.layers[layerNo] = sparse;
+  delete dense;
+  
+  result.weightsAfter = sparse->numWeights;
+  result.bytesAfter = getBytes(sparse);
+  result.timeAfter = timeForwardPass(net, sparse);
+  return result;
+}
+
+// the layers to prune: all fully connected layers or the selected one
+static vector<int> selectLayers(const Net& net, int layerNo) throw (NPPException)
+{
+  vector<int> selected;
+  for (int l=1; l < net.getTopologyData().layerCount; l++) {
+    if ((layerNo < 0 || l == layerNo) && net.layers[l]->identifer == "FullyConnectedLayer") {
+      selected.push_back(l);
+    }
+  }
+  if (layerNo >= 0 && selected.empty()) {
+    ostringstream msg;
+    msg << "Can only prune fully connected layers, but layer " << layerNo << " is not.";
+    throw NPPException(msg.str());
+  }
+  return selected;
+}
+
+PruningReport NPP2::pruneByThreshold(Net& net, FTYPE threshold, int layerNo) throw (NPPException)
+{
+  PruningReport report;
+  vector<int> selected = selectLayers(net, layerNo);
+  for (unsigned int s=0; s < selected.size(); s++) {
+    const FullyConnectedLayer* dense = (const FullyConnectedLayer*) net.layers[selected[s]];
+    vector<bool> keep(dense->numWeights);
+    for (int i=0; i < dense->numWeights; i++) {
+      keep[i] = i % (dense->previousDim+1) == 0 || fabs(dense->weights[i]) >= threshold;
+    }
+    report.layers.push_back(replaceLayer(net, selected[s], keep));
+  }
+  return report;
+}
+
+PruningReport NPP2::pruneTopK(Net& net, int k, int layerNo) throw (NPPException)
+{
+  PruningReport report;
+  vector<int> selected = selectLayers(net, layerNo);
+  for (unsigned int s=0; s < selected.size(); s++) {
+    const FullyConnectedLayer* dense = (const FullyConnectedLayer*) net.layers[selected[s]];
+    int rowSize = dense->previousDim+1;
+    vector<bool> keep(dense->numWeights, false);
+    vector<pair<FTYPE, int> > row(dense->previousDim);
+    for (int j=0; j < dense->numUnits; j++) {
+      keep[j*rowSize] = true;                       // bias
+      for (int i=1; i < rowSize; i++) {
+        row[i-1] = make_pair(-fabs(dense->weights[j*rowSize+i]), i);
+      }
+      int numKept = k < dense->previousDim ? k : dense->previousDim;
+      partial_sort(row.begin(), row.begin()+numKept, row.end());
+      for (int i=0; i < numKept; i++) {
+        keep[j*rowSize+row[i].second] = true;
+      }
+    }
+    report.layers.push_back(replaceLayer(net, selected[s], keep));
+  }
+  return report;
+}
+
+void PruningReport::writeToStream(std::ostream& out) const
+{
+  out << setw(6) << "layer" << setw(12) << "weights" << setw(12) << "remaining" << setw(12) << "KiB" << setw(12) << "KiB saved" 
+      << setw(14) << "us before" << setw(14) << "us after" << setw(10) << "speedup" << endl;
+  out << fixed << setprecision(1);
+  for (unsigned int l=0; l < layers.size(); l++) {
+    const LayerResult& r = layers[l];
+    out << setw(6) << r.layer << setw(12) << r.weightsBefore << setw(12) << r.weightsAfter 
+        << setw(12) << r.bytesAfter / 1024. << setw(12) << ((double) r.bytesBefore - (double) r.bytesAfter) / 1024.
+        << setw(14) << r.timeBefore * 1e6 << setw(14) << r.timeAfter * 1e6 << setw(10) << r.timeBefore / r.timeAfter << endl;
+  }
+}
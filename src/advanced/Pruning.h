@@ -0,0 +1,90 @@
+#ifndef _NPP2_PRUNING_H_
+#define _NPP2_PRUNING_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  Pruning.h
+ *
+ *  Magnitude pruning of trained nets. Removes the small weights of 
+ *  FullyConnectedLayers and replaces each pruned layer by an
+ *  IndividuallyConnectedLayer holding only the remaining connections. The 
+ *  pruned net can be trained further (fine-tuning) with its sparse 
+ *  structure; removed connections stay removed.
+ */
+
+#include <iostream>
+#include <vector>
+#include <cstddef>
+#include "functions.h"
+#include "NPPException.h"
+
+namespace NPP2 {
+  
+  class Net;
+  
+  /** Result of pruning the layers of a net */
+  struct PruningReport {
+    /** result of pruning a single layer */
+    struct LayerResult {
+      int layer;             ///< number of the layer in the net
+      int weightsBefore;     ///< number of weights (including the biases) before pruning
+      int weightsAfter;      ///< number of remaining weights
+      size_t bytesBefore;    ///< memory of the layer before pruning (see BasicLayerType::getMemoryUsage)
+      size_t bytesAfter;     ///< memory of the pruned layer
+      double timeBefore;     ///< time of propagating one pattern through the layer before pruning (seconds)
+      double timeAfter;      ///< time of propagating one pattern through the pruned layer
+    };
+    std::vector<LayerResult> layers;  ///< the pruned layers
+    
+    /** writes the report as a small table, including the speedup and the
+     * memory saved */
+    void writeToStream(std::ostream& out) const;
+  };
+  
+  /** removes all weights of the FullyConnectedLayers of the net with an 
+   * absolute value below threshold. The bias weights are always kept. 
+   * \param layerNo number of the layer to prune; all fully connected 
+   *                layers, if -1. Other layer types are skipped, but 
+   *                pruning an explicitly selected layer of another type 
+   *                throws an NPPException. */
+  PruningReport pruneByThreshold(Net& net, FTYPE threshold, int layerNo=-1) throw (NPPException);
+  
+  /** keeps the k weights with the largest absolute values of each unit of 
+   * the FullyConnectedLayers of the net (plus its bias weight) and removes 
+   * all others. See pruneByThreshold for layerNo. */
+  PruningReport pruneTopK(Net& net, int k, int layerNo=-1) throw (NPPException);
+  
+}
+
+#endif
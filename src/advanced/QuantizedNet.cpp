@@ -0,0 +1,225 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  QuantizedNet.cpp
+ */
+
+#include "QuantizedNet.h"
+#include "FullyConnectedLayer.h"
+#include "AdvancedLayerTypes.h"
+#include "PatternSet.h"
+#include "kernels.h"
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+
+using namespace std;
+using namespace NPP2;
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Quantization
+#endif
+
+FTYPE QuantizedNet::quantize(const FTYPE* x, signed char* q, int n)
+{
+  FTYPE max = 0.;
+  for (int i=0; i < n; i++) {
+    max = fabs(x[i]) > max ? fabs(x[i]) : max;
+  }
+  if (max == 0.) {
+    memset(q, 0, n);
+    return 0.;
+  }
+  FTYPE scale = max / 127.;
+  for (int i=0; i < n; i++) {
+    q[i] = (signed char) floor(x[i] / scale + .5);   // |x[i] / scale| <= 127
+  }
+  return scale;
+}
+
+QuantizedNet::QuantizedNet(const Net& net) throw (NPPException)
+{
+  const Net::TopologyData& topo = net.getTopologyData();
+  inCount = topo.inCount;
+  outCount = topo.outCount;
+  
+  size_t maxUnits = inCount;
+  layers.resize(topo.layerCount-1);
+  for (int l=1; l < topo.layerCount; l++) {
+    const FullyConnectedLayer* source = dynamic_cast<const FullyConnectedLayer*>(net.layers[l]);
+    bool softmax = dynamic_cast<const MultimodalCrossEntropyOutputLayer*>(net.layers[l]) != 0;
+    if (!source || (source->identifer != "FullyConnectedLayer" && !softmax)) {
+      throw NPPException("Only fully connected layers and a softmax output layer can be quantized, but layer " + 
+                         net.layers[l]->identifer + " is not.");
+    }
+    Layer& layer = layers[l-1];
+    layer.numInputs = source->previousDim;
+    layer.numUnits = source->numUnits;
+    layer.actId = source->actId;
+    layer.softmax = softmax;
+    layer.weights.resize((size_t) layer.numUnits * layer.numInputs);
+    layer.scales.resize(layer.numUnits);
+    layer.bias.resize(layer.numUnits);
+    for (int j=0; j < layer.numUnits; j++) {
+      const FTYPE* row = &source->weights[(size_t) j * (layer.numInputs+1)];
+      layer.bias[j] = row[0];
+      layer.scales[j] = quantize(&row[1], &layer.weights[(size_t) j * layer.numInputs], layer.numInputs);
+    }
+    maxUnits = (size_t) layer.numUnits > maxUnits ? layer.numUnits : maxUnits;
+  }
+  activations[0].resize(maxUnits);
+  activations[1].resize(maxUnits);
+  quantized.resize(maxUnits);
+  sums.resize(maxUnits);
+}
+
+size_t QuantizedNet::getMemoryBytes() const
+{
+  size_t bytes = 0;
+  for (unsigned int l=0; l < layers.size(); l++) {
+    bytes += layers[l].weights.size() * sizeof(signed char) + (layers[l].scales.size() + layers[l].bias.size()) * sizeof(FTYPE);
+  }
+  return bytes;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Propagation
+#endif
+
+void QuantizedNet::forwardPass(const FTYPE* inVec, FTYPE* outVec)
+{
+  FTYPE* input = &activations[0][0];
+  FTYPE* output = &activations[1][0];
+  memcpy(input, inVec, sizeof(FTYPE) * inCount);
+  
+  for (unsigned int l=0; l < layers.size(); l++) {
+    const Layer& layer = layers[l];
+    FTYPE inScale = quantize(input, &quantized[0], layer.numInputs);
+    kernels().gemvInt8(&layer.weights[0], &quantized[0], &sums[0], layer.numUnits, layer.numInputs);
+    for (int j=0; j < layer.numUnits; j++) {    // net inputs
+      output[j] = layer.bias[j] + layer.scales[j] * inScale * sums[j];
+    }
+    if (layer.softmax) {
+      double sum = 0.;
+      for (int j=0; j < layer.numUnits; j++) {
+        sum += exp(output[j]);
+      }
+      for (int j=0; j < layer.numUnits; j++) {
+        output[j] = exp(output[j]) / sum;
+      }
+    }
+    else if (layer.actId == NPP_LOGISTIC) {
+      kernels().logistic(output, output, layer.numUnits);
+    }
+    std::swap(input, output);
+  }
+  memcpy(outVec, input, sizeof(FTYPE) * outCount);
+}
+
+Error QuantizedNet::test(const PatternSet* pattern, const ErrorFunction* errorFunction, bool id)
+{
+  Error error;
+  error.regrError = 0.;
+  int countwrong = 0;
+  vector<FTYPE> outVec(outCount);
+  for (int i=0; i < pattern->pattern_count; i++) {
+    forwardPass(pattern->input[i], &outVec[0]);
+    FTYPE* target = id ? pattern->input[i] : pattern->target[i];
+    int outI=-1, targetI=-1; double targetMax=0., outMax=0.;
+    for (int d=0; d < outCount; d++) {
+      error.regrError += errorFunction->error(outVec[d], target[d]);
+      if (outVec[d] >= outMax) {
+        outMax = outVec[d];
+        outI = d;
+      }
+      if (target[d] >= targetMax) {
+        targetMax = target[d];
+        targetI = d;
+      }
+    }
+    if (targetI != outI) countwrong++;
+  }
+  error.classError = (countwrong / (double)pattern->pattern_count) * 100.;
+  return error;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Comparison with the original net
+#endif
+
+QuantizationReport QuantizedNet::compare(Net& net, const PatternSet* pattern, const ErrorFunction* errorFunction, bool id)
+{
+  QuantizationReport report;
+  report.numPatterns = pattern->pattern_count;
+  report.floatError = net.test(pattern, 1, id, errorFunction);
+  report.quantizedError = test(pattern, errorFunction, id);
+  
+  report.maxDeviation = report.meanDeviation = 0.;
+  vector<FTYPE> floatOut(outCount), quantizedOut(outCount);
+  for (int i=0; i < pattern->pattern_count; i++) {
+    net.forwardPass(pattern->input[i], &floatOut[0]);
+    forwardPass(pattern->input[i], &quantizedOut[0]);
+    for (int d=0; d < outCount; d++) {
+      double deviation = fabs(floatOut[d] - quantizedOut[d]);
+      report.maxDeviation = deviation > report.maxDeviation ? deviation : report.maxDeviation;
+      report.meanDeviation += deviation;
+    }
+  }
+  if (pattern->pattern_count > 0 && outCount > 0) {
+    report.meanDeviation /= (double) pattern->pattern_count * outCount;
+  }
+  
+  report.floatBytes = 0;
+  for (unsigned int l=1; l < net.layers.size(); l++) {
+    report.floatBytes += (size_t) net.layers[l]->numWeights * sizeof(FTYPE);
+  }
+  report.quantizedBytes = getMemoryBytes();
+  return report;
+}
+
+void QuantizationReport::writeToStream(std::ostream& out) const
+{
+  out << "Quantization (" << numPatterns << " patterns)" << endl;
+  out << setw(12) << "" << setw(14) << "regr. error" << setw(14) << "class. error" << setw(12) << "KiB" << endl;
+  out << setw(12) << "float" << setw(14) << floatError.regrError << setw(14) << floatError.classError 
+      << setw(12) << floatBytes / 1024. << endl;
+  out << setw(12) << "int8" << setw(14) << quantizedError.regrError << setw(14) << quantizedError.classError 
+      << setw(12) << quantizedBytes / 1024. << endl;
+  out << "output deviation: max " << maxDeviation << ", mean " << meanDeviation << endl;
+}
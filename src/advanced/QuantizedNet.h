@@ -0,0 +1,124 @@
+#ifndef _NPP2_QUANTIZEDNET_H_
+#define _NPP2_QUANTIZEDNET_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  QuantizedNet.h
+ *
+ *  Post-training quantization of trained nets for inference. The weights of
+ *  fully connected layers (and of the softmax output layer) are quantized 
+ *  to 8 bit integers with one scale per unit (row of the weight matrix); 
+ *  the biases stay in floating point. During propagation, the input of each
+ *  layer is quantized to 8 bit integers with one scale per pattern and the 
+ *  net inputs are calculated with integer dot products that sum up in 32 
+ *  bit integers (KernelTable::gemvInt8). This reduces the weights streamed
+ *  per pattern to an eighth.
+ */
+
+#include <iostream>
+#include <vector>
+#include <cstddef>
+#include "npp2.h"
+#include "NPPException.h"
+
+namespace NPP2 {
+  
+  class PatternSet;
+  class ErrorFunction;
+  
+  /** Result of comparing a quantized net to the net it has been created 
+   * from on a pattern set (see QuantizedNet::compare) */
+  struct QuantizationReport {
+    int numPatterns;          ///< number of patterns compared
+    Error floatError;         ///< error of the original net (see Net::test)
+    Error quantizedError;     ///< error of the quantized net
+    double maxDeviation;      ///< largest absolute difference of an output
+    double meanDeviation;     ///< mean absolute difference of the outputs
+    size_t floatBytes;        ///< bytes of the weights of the original net
+    size_t quantizedBytes;    ///< bytes of the weights, biases and scales of the quantized net
+    
+    /** writes the report as a small table */
+    void writeToStream(std::ostream& out) const;
+  };
+  
+  /** Forward-only copy of a trained net with 8 bit integer weights. The net
+   * has to consist of FullyConnectedLayers, optionally followed by a 
+   * MultimodalCrossEntropyOutputLayer. Changes of the original net after
+   * the quantization are not reflected. */
+  class QuantizedNet {
+  public:
+    /** quantizes the weights of the given net. Throws an exception, if the
+     * net contains layers of other types. */
+    QuantizedNet(const Net& net) throw (NPPException);
+    
+    /** propagates one pattern */
+    void forwardPass(const FTYPE* inVec, FTYPE* outVec);
+    /** tests the net like Net::test with a single thread */
+    Error test(const PatternSet* pattern, const ErrorFunction* errorFunction, bool id=false);
+    /** compares the outputs and errors of this net to those of the net it 
+     * has been created from on the given patterns */
+    QuantizationReport compare(Net& net, const PatternSet* pattern, const ErrorFunction* errorFunction, bool id=false);
+    
+    int getInCount() const { return inCount; }    ///< number of inputs
+    int getOutCount() const { return outCount; }  ///< number of outputs
+    /** returns the bytes of the weights, biases and scales of all layers */
+    size_t getMemoryBytes() const;
+    
+  protected:
+    /** a quantized layer */
+    struct Layer {
+      int numInputs;
+      int numUnits;
+      int actId;                        ///< NPP_LOGISTIC or NPP_LINEAR
+      bool softmax;                     ///< MultimodalCrossEntropyOutputLayer
+      std::vector<signed char> weights; ///< numUnits rows of numInputs weights (without the bias)
+      std::vector<FTYPE> scales;        ///< weight = scale * quantized weight, one scale per unit
+      std::vector<FTYPE> bias;          ///< bias weight of each unit
+    };
+    
+    int inCount;
+    int outCount;
+    std::vector<Layer> layers;          ///< all layers but the input layer
+    
+    std::vector<FTYPE> activations[2];  ///< input and output of the layer being propagated
+    std::vector<signed char> quantized; ///< quantized input of the layer
+    std::vector<int> sums;              ///< integer net inputs
+    
+    /** quantizes the n values x to the range -127..127 and returns the scale */
+    static FTYPE quantize(const FTYPE* x, signed char* q, int n);
+  };
+  
+}
+
+#endif
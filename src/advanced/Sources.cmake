@@ -1,8 +1,13 @@
 include_directories(${NPP2_SOURCE_DIR}/advanced)
 LIST(APPEND advanced_srcs 
 	${NPP2_SOURCE_DIR}/advanced/AdvancedLayerTypes.cpp
+	${NPP2_SOURCE_DIR}/advanced/Pruning.cpp
+	${NPP2_SOURCE_DIR}/advanced/QuantizedNet.cpp
 ) 
 
 LIST(APPEND advanced_headers
 	${NPP2_SOURCE_DIR}/advanced/AdvancedLayerTypes.h
+	${NPP2_SOURCE_DIR}/advanced/FixedNet.h
+	${NPP2_SOURCE_DIR}/advanced/Pruning.h
+	${NPP2_SOURCE_DIR}/advanced/QuantizedNet.h
 )
\ No newline at end of file
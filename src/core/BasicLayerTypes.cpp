@@ -39,10 +39,12 @@
 #include "BasicLayerTypes.h"
 #include "npp2.h"
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <functions.h>
 #include "PatternSet.h"
 #include "Registry.h"
+#include "kernels.h"
 #include <cassert>
 
 
@@ -73,8 +75,157 @@ void BasicLayerType::setActivationFunction(int actId)
 
 
 
+void BasicLayerType::forwardPassSparse(FTYPE *input, const int*, const FTYPE*, int, int copy)
+{
+  forwardPass(input, copy);  // input holds the complete (dense) vector as well
+}
+
+void BasicLayerType::backwardPassSparse(FTYPE *dedout, const int*, const FTYPE*, int, int copy)
+{
+  backwardPass(dedout, copy);
+}
+
+bool BasicLayerType::reduceGradients(int)
+{
+  return false;
+}
+
+// the built-in activation functions are identified by their address, since
+// act_f and deriv_f may be set directly without changing actId.
+void BasicLayerType::forwardPassPart(FTYPE *input, int part, int numParts, int copy)
+{
+  if (part == 0) {
+    forwardPass(input, copy);
+  }
+}
+
+void BasicLayerType::forwardPassBatch(const FTYPE *input, FTYPE *netin, FTYPE *out, int numPatterns)
+{
+  int prevDim = net->layers[layerId-1]->numUnits;
+  for (int p=0; p < numPatterns; p++) {
+    forwardPass(const_cast<FTYPE*>(&input[p*(prevDim+1)]), 0);
+    memcpy(&netin[p*(numUnits+1)], this->netin, sizeof(FTYPE) * (numUnits+1));
+    memcpy(&out[p*(numUnits+1)], this->out, sizeof(FTYPE) * (numUnits+1));
+    out[p*(numUnits+1)] = 1.;
+  }
+}
+
+#define MIN_PART_WORK 8192   // layers with less connections are not split
+#define PART_UNITS 8         // granularity of the parts: a cache line of net inputs and outputs
+
+void BasicLayerType::getPartRange(int part, int numParts, size_t work, int* begin, int* end) const
+{
+  if (work < MIN_PART_WORK || numParts <= 1) {
+    *begin = part == 0 ? 1 : numUnits+1;
+    *end = numUnits+1;
+    return;
+  }
+  int size = (numUnits + numParts - 1) / numParts;
+  size = (size + PART_UNITS - 1) / PART_UNITS * PART_UNITS;
+  *begin = 1 + part * size < numUnits+1 ? 1 + part * size : numUnits+1;
+  *end = *begin + size < numUnits+1 ? *begin + size : numUnits+1;
+}
+
+void BasicLayerType::applyActivation(const FTYPE* netin, FTYPE* out, int n) const
+{
+  if (act_f == logistic) {
+    kernels().logistic(netin, out, n);
+  }
+  else if (act_f == linear) {
+    if (out != netin) memcpy(out, netin, sizeof(FTYPE) * n);
+  }
+  else {
+    for (int i=0; i < n; i++) {
+      out[i] = act_f(netin[i]);
+    }
+  }
+}
+
+void BasicLayerType::applyDerivative(FTYPE* dEdo, const FTYPE* out, const FTYPE* netin, FTYPE* dEdnet, int n) const
+{
+  if (deriv_f == logistic_deriv) {
+    kernels().logisticDeriv(dEdo, out, dEdnet, n);
+  }
+  else if (deriv_f == linear_deriv) {
+    kernels().linearDeriv(dEdo, dEdnet, n);
+  }
+  else {
+    for (int i=0; i < n; i++) {
+      dEdnet[i] = dEdo[i] * deriv_f(out[i], netin[i]);
+      dEdo[i] = (FTYPE) 0;
+    }
+  }
+}
+
+void BasicLayerType::setTrainable(bool trainable)
+{
+  this->trainable = trainable;
+}
+
+FTYPE* BasicLayerType::resizeCopies(FTYPE* buffer, size_t n, int numCopies) const
+{
+  FTYPE* resized = allocBuffer(n * (numCopies+1));
+  memcpy(resized, buffer, sizeof(FTYPE) * n);
+  memset(&resized[n], 0, sizeof(FTYPE) * n * numCopies);
+  freeBuffer(buffer);
+  return resized;
+}
+
+void BasicLayerType::setNumCopies(int numCopies)
+{
+  if (numUnits > 0) {
+    bool inPlace = netin == out;
+    dEdo   = resizeCopies(dEdo, numUnits+1, numCopies);
+    dEdnet = resizeCopies(dEdnet, numUnits+1, numCopies);
+    out    = resizeCopies(out, numUnits+1, numCopies);
+    netin  = inPlace ? out : resizeCopies(netin, numUnits+1, numCopies);
+    
+    for (int i=1; i < numCopies+1; i++) {  // set bias weight to 1
+      out[i * (numUnits+1)] = (FTYPE) 1.;
+    }
+  }
+  this->numCopies = numCopies;
+}
+
+bool BasicLayerType::canComputeNetInputInPlace() const
+{
+  return deriv_f == logistic_deriv || deriv_f == linear_deriv;
+}
+
+bool BasicLayerType::setNetInputInPlace(bool inPlace)
+{
+  if (numUnits <= 0) return false;
+  
+  if (inPlace && netin != out && canComputeNetInputInPlace()) {
+    freeBuffer(netin);
+    netin = out;        // the activation functions can be applied in place
+  }
+  else if (!inPlace && netin == out) {
+    netin = allocBuffer((numUnits+1)*(numCopies+1));
+    memset(netin, 0, sizeof(FTYPE) * (numUnits+1)*(numCopies+1));
+  }
+  return netin == out;
+}
+
+void BasicLayerType::getMemoryUsage(MemoryUsage& usage) const
+{
+  usage.identifier = identifer;
+  if (numUnits > 0) {   // dEdo, dEdnet, out and netin (unless computed in place)
+    usage.add(MEMORY_ACTIVATIONS, (netin == out ? 3 : 4) * (numUnits+1) * (numCopies+1), sizeof(FTYPE));
+  }
+}
+
+void BasicLayerType::estimateMemoryUsage(const BasicLayerType* previousLayer, int numCopies, const UpdateFunction* updateFunction, MemoryUsage& usage) const
+{
+  usage.identifier = identifer;
+  if (numUnits > 0) {
+    usage.add(MEMORY_ACTIVATIONS, 4 * (numUnits+1) * (numCopies+1), sizeof(FTYPE));
+  }
+}
+
+
 BasicLayerType::BasicLayerType(Net* net, int layerId, const LayerArguments* args)
-: identifer("BasicLayerType"), net(net), layerId(layerId), firstUnitId(0), numWeights(0), updateFunction(0)
+: identifer("BasicLayerType"), net(net), layerId(layerId), firstUnitId(0), numWeights(0), trainable(true), dEdo(0), dEdnet(0), out(0), netin(0), updateFunction(0)
 {
   const BasicLayerType::BasicLayerArguments* bargs = dynamic_cast<const BasicLayerType::BasicLayerArguments*> (args);
 
@@ -93,7 +244,7 @@ BasicLayerType::BasicLayerType(Net* net, int layerId, const LayerArguments* args
 
 BasicLayerType::BasicLayerType(Net* net, int layerId, int firstUnitId, int unitsPerRow, int numRows, int numCopies)
 : identifer("BasicLayerType"), net(net), layerId(layerId), firstUnitId(firstUnitId), numUnits(unitsPerRow * numRows), numRows(numRows), 
-numCols(unitsPerRow), numCopies(numCopies), numWeights(0), updateFunction(0)
+numCols(unitsPerRow), numCopies(numCopies), numWeights(0), trainable(true), dEdo(0), dEdnet(0), out(0), netin(0), updateFunction(0)
 {
   actId = NPP_LOGISTIC;
   
@@ -110,18 +261,21 @@ void BasicLayerType::initLayer()
     // create and zero-initialize the needed vectors to hold net-input, 
     // output, and partial derivatives for each neuron. there is one entry for
     // each of the neurons (including the bias neuron 0) in each of the copies. 
-    dEdo   = new FTYPE[(numUnits+1)*(numCopies+1)];
-    dEdnet = new FTYPE[(numUnits+1)*(numCopies+1)]; 
-    out    = new FTYPE[(numUnits+1)*(numCopies+1)]; 
-    netin  = new FTYPE[(numUnits+1)*(numCopies+1)];
-  
-    memset(dEdo,   0, sizeof(FTYPE) * (numUnits+1)*(numCopies+1));
-    memset(dEdnet, 0, sizeof(FTYPE) * (numUnits+1)*(numCopies+1));
-    memset(out,    0, sizeof(FTYPE) * (numUnits+1)*(numCopies+1));
-    memset(netin,  0, sizeof(FTYPE) * (numUnits+1)*(numCopies+1));
-  
-    for (int i=0; i < numCopies+1; i++) {  // set bias weight to 1
-      out[i * (numUnits+1)] = (FTYPE) 1.;
+    // the layers of the temporary net of Net::estimateMemory do without.
+    if (!(net && net->structureOnly)) {
+      dEdo   = allocBuffer((numUnits+1)*(numCopies+1));
+      dEdnet = allocBuffer((numUnits+1)*(numCopies+1)); 
+      out    = allocBuffer((numUnits+1)*(numCopies+1)); 
+      netin  = allocBuffer((numUnits+1)*(numCopies+1));
+    
+      memset(dEdo,   0, sizeof(FTYPE) * (numUnits+1)*(numCopies+1));
+      memset(dEdnet, 0, sizeof(FTYPE) * (numUnits+1)*(numCopies+1));
+      memset(out,    0, sizeof(FTYPE) * (numUnits+1)*(numCopies+1));
+      memset(netin,  0, sizeof(FTYPE) * (numUnits+1)*(numCopies+1));
+    
+      for (int i=0; i < numCopies+1; i++) {  // set bias weight to 1
+        out[i * (numUnits+1)] = (FTYPE) 1.;
+      }
     }
     
     // set activation function and its derivative. this could also 
@@ -141,13 +295,48 @@ void BasicLayerType::initLayer()
   }
 }
 
+void BasicLayerType::estimateWeightUsage(size_t n, int numCopies, const UpdateFunction* updateFunction, MemoryUsage& usage) const
+{
+  usage.add(MEMORY_WEIGHTS, n, sizeof(FTYPE));
+  if (updateFunction && updateFunction->usesDelta()) {  // rprop does not need the delta vector
+    usage.add(MEMORY_DELTA, n, sizeof(FTYPE));
+  }
+  if (trainable) {
+    usage.add(MEMORY_DEDW, n * (numCopies+1), sizeof(FTYPE));
+  }
+  usage.add(MEMORY_VARIABLES, n * (updateFunction ? updateFunction->getNumVariables() : 2), sizeof(FTYPE));
+}
+
+FTYPE* BasicLayerType::allocBuffer(size_t n) const
+{
+  if (net) {
+    return (FTYPE*) net->arena->allocate(n * sizeof(FTYPE));
+  }
+  return new FTYPE[n];   // layer does not belong to a net
+}
+
+void BasicLayerType::freeBuffer(FTYPE* buffer) const
+{
+  if (net && net->arena->isClearing()) {
+    return;   // the net is destroyed and all its buffers are released with the arena
+  }
+  if (net && net->arena->owns(buffer)) {
+    net->arena->free(buffer);
+  }
+  else {
+    delete [] buffer;
+  }
+}
+
 BasicLayerType::~BasicLayerType()
 {
   if (numUnits > 0) {
-    delete [] dEdo;
-    delete [] dEdnet;
-    delete [] out;
-    delete [] netin;
+    freeBuffer(dEdo);
+    freeBuffer(dEdnet);
+    freeBuffer(out);
+    if (netin != out) {
+      freeBuffer(netin);
+    }
   }
 }
 
@@ -38,6 +38,7 @@
 #include <string>
 #include "functions.h"
 #include "LayerRegistry.h"
+#include "MemoryReport.h"
 
 namespace NPP2 {
   
@@ -141,6 +142,7 @@ namespace NPP2 {
     int numCols;            ///< number of units per column
     int numCopies;          ///< number of copies of this layer (used during parallel processing)
     int numWeights;         ///< total number of weights (connections) TO this layer.
+    bool trainable;         ///< indicates whether the weights of this layer are adapted during training. Frozen (non-trainable) layers neither accumulate derivatives for their weights nor update them.
     
     
 #ifdef __APPLE__
@@ -185,11 +187,86 @@ namespace NPP2 {
     virtual void forwardPass(FTYPE *input, int copy=0)=0;  
     /** back-propagates the given "input" through the layer, using the specified
      * copy. The net's backpropagation method will call this method with dedout
-     * "received" from the subsequent layer */
+     * "received" from the subsequent layer. If dedout is 0, the layer only
+     * accumulates the derivatives of its weights and skips calculating the
+     * derivatives in respect to the previous layer's output. */
     virtual void backwardPass(FTYPE *dedout, int copy=0)=0;
+    /** propagates a sparse input through the layer. The net uses this method
+     * in its first hidden layer, if the input pattern is given by the indices
+     * and values of its numActive non-zero entries. input still points to the
+     * complete output of the previous (input) layer. Layers that can exploit
+     * the sparsity should override this method; the default implementation
+     * simply calls forwardPass. */
+    virtual void forwardPassSparse(FTYPE *input, const int* activeIndex, const FTYPE* activeValue, int numActive, int copy=0);
+    /** back-propagates through a layer that has been propagated with 
+     * forwardPassSparse. Layers that override forwardPassSparse may use the
+     * sparsity of the input to only touch the derivatives of the weights of
+     * the active inputs. The default implementation calls backwardPass. */
+    virtual void backwardPassSparse(FTYPE *dedout, const int* activeIndex, const FTYPE* activeValue, int numActive, int copy=0);
+    /** propagates the part-th of numParts parts of the units of this layer.
+     * Used by the latency mode of the net, where the parts are propagated
+     * in parallel by numParts threads. The default implementation 
+     * propagates the complete layer in part 0. Layers that override this
+     * method should only split large layers (see getPartRange). */
+    virtual void forwardPassPart(FTYPE *input, int part, int numParts, int copy=0);
+    /** prepares the data structures for propagating the layer in numParts
+     * parts. Called by the net before its layers are propagated in parts 
+     * and after they have been connected. */
+    virtual void preparePartition(int numParts) {}
+    /** calculates the range [begin, end) of the units (counted from 1) of
+     * the part-th of numParts parts of this layer, given the total work 
+     * of the layer (e.g. its number of connections). Layers with little 
+     * work are not split (part 0 gets all units), the parts are multiples
+     * of 8 units (a cache line) otherwise. */
+    void getPartRange(int part, int numParts, size_t work, int* begin, int* end) const;
+    /** propagates numPatterns patterns at once. input holds the outputs of
+     * the previous layer for all patterns, one row of its numUnits+1 values
+     * (including the bias) per pattern. netin and out receive one row of 
+     * numUnits+1 values per pattern; the bias entries of out are set to 1.
+     * Layers should override this method with a matrix-matrix product. The 
+     * default implementation propagates one pattern after the other through 
+     * copy 0 and thus overwrites its activations. */
+    virtual void forwardPassBatch(const FTYPE *input, FTYPE *netin, FTYPE *out, int numPatterns);
+    
     /** updates the weights according to the caclulated error terms using an
      * appropriate learning method (e.g. backpropagation or RProp). */
     virtual void updateWeights(int numCopies=0)=0;
+    /** sums up the derivatives of the weights that have been accumulated in
+     * the given number of copies into copy 0 and clears the other copies. 
+     * After a successful reduction, updateWeights has to be called with 
+     * numCopies=0. Returns false, if the layer does not separate the 
+     * reduction from the update (default); then updateWeights has to be 
+     * called with the number of copies. */
+    virtual bool reduceGradients(int numCopies);
+    /** adds the derivatives of the weights accumulated in the given copy to
+     * copy 0 and clears that copy. Used for summing up blocks of patterns 
+     * in a fixed order (Net::setDeterministic). Copy 0 is left unchanged, 
+     * thus mergeGradients(0) only tells whether the layer supports merging.
+     * Returns false, if it does not (default). */
+    virtual bool mergeGradients(int copy) { return false; }
+    /** returns the derivatives of the weights accumulated in copy 0 and 
+     * stores their number in count. Used for combining the derivatives of
+     * several nets (GradientReducer). Returns 0 and sets count to 0 for 
+     * layers that do not support this (default). */
+    virtual FTYPE* getGradients(int* count) { *count = 0; return 0; }
+    /** returns the weights of the layer and stores their number in count.
+     * Returns 0 and sets count to 0 for layers that do not support this 
+     * (default). */
+    virtual FTYPE* getWeights(int* count) { *count = 0; return 0; }
+    /** lets all copies accumulate the derivatives of the weights in a single
+     * buffer, collecting stageSize patterns per copy before adding them 
+     * (0: one buffer per copy). Returns false, if the layer does not 
+     * support shared derivatives (default). */
+    virtual bool setSharedGradients(int stageSize) { return false; }
+    
+    /** applies the layer's activation function to n net inputs: 
+     * out[i] = act_f(netin[i]). Uses the vectorized kernels for the built-in
+     * activation functions. */
+    void applyActivation(const FTYPE* netin, FTYPE* out, int n) const;
+    /** calculates the derivatives in respect to the net input of n units
+     * (dEdnet[i] = dEdo[i] * deriv_f(out[i], netin[i])) and clears dEdo. 
+     * Uses the vectorized kernels for the built-in activation functions. */
+    void applyDerivative(FTYPE* dEdo, const FTYPE* out, const FTYPE* netin, FTYPE* dEdnet, int n) const;
     
 
 #ifdef __APPLE__
@@ -210,6 +287,26 @@ namespace NPP2 {
     /** sets the activation function that is used by all of this layer's neurons. 
      * \param actId either NPP_LINEAR or NPP_LOGISTIC . */ 
     virtual void setActivationFunction(int actId);
+    /** freezes (trainable = false) or unfreezes the weights of this layer. 
+     * Implementations may release the per-copy buffers for accumulating the
+     * derivatives of frozen weights and should re-create them, when the
+     * layer becomes trainable again. */
+    virtual void setTrainable(bool trainable);
+    /** changes the number of copies of this layer. Re-allocates all per-copy
+     * buffers, keeping the contents of copy 0. The derivatives accumulated 
+     * in the other copies are summed up into copy 0 first. The weights and
+     * the state of the update function are not changed. Derived classes 
+     * with per-copy buffers of their own have to extend this method. */
+    virtual void setNumCopies(int numCopies);
+    /** lets the activation function write the outputs over the net inputs,
+     * so that the layer does not need a buffer for the net inputs of its 
+     * copies. This is only possible, if the derivative of the activation 
+     * function does not depend on the net input (canComputeNetInputInPlace).
+     * Returns true, if the net inputs are computed in place afterwards. */
+    bool setNetInputInPlace(bool inPlace);
+    /** returns true, if the derivative of the activation function only 
+     * depends on the output (logistic, linear) */
+    bool canComputeNetInputInPlace() const;
     
     /** serializes this layer to the given output stream. */
     virtual void writeToStream(std::ostream& out) const;
@@ -228,6 +325,22 @@ namespace NPP2 {
     /** returns the arguments that have been used to construct this layer. */
     virtual LayerArguments* getArguments() const=0; // describe itself by returning arguments creating this layer.
     
+    
+#ifdef __APPLE__
+#pragma mark Memory accounting
+#endif 
+    /** adds the bytes of all buffers presently allocated by this layer to 
+     * usage. The base implementation accounts the four per-copy vectors of
+     * the units; derived classes add their weight structures. */
+    virtual void getMemoryUsage(MemoryUsage& usage) const;
+    /** predicts the bytes this layer will use after being connected to
+     * previousLayer (0 for the input layer) in a net with numCopies copies
+     * and the given update function (0 for RProp with default parameters).
+     * This is called on layers that have been constructed with no copies 
+     * and are not connected. Sets usage.complete to false, if the size of 
+     * the connection structure can not be known in advance. */
+    virtual void estimateMemoryUsage(const BasicLayerType* previousLayer, int numCopies, const UpdateFunction* updateFunction, MemoryUsage& usage) const;
+    
     /** Base constructor using the Arguments-Objekt. */
     BasicLayerType(Net* net, int layerId, const LayerArguments*);
     /** Base constructor where the arguments are specified directly. */
@@ -238,6 +351,19 @@ namespace NPP2 {
     
   protected:
     virtual void initLayer(); ///< internal helper function that actually sets up all data structures. To be extended by derived classes.
+    /** returns an uninitialized, 64-byte aligned buffer of n values from the
+     * arena of the net. Layers that do not belong to a net use new[]. */
+    FTYPE* allocBuffer(size_t n) const;
+    /** frees a buffer returned by allocBuffer. Does nothing for 0 or while
+     * the net is destroyed, as its arena then releases all buffers at once. */
+    void freeBuffer(FTYPE* buffer) const;
+    /** returns a buffer with numCopies+1 copies of n values each, holding
+     * the first copy of the given buffer, which is freed. The other copies
+     * are zero-initialized. */
+    FTYPE* resizeCopies(FTYPE* buffer, size_t n, int numCopies) const;
+    /** adds the predicted size of the weights and of the per-weight buffers
+     * of n weights (see estimateMemoryUsage) to usage. */
+    void estimateWeightUsage(size_t n, int numCopies, const UpdateFunction* updateFunction, MemoryUsage& usage) const;
   };
     
   
@@ -40,6 +40,8 @@
 #include "FullyConnectedLayer.h"
 #include "npp2.h"
 #include <cstdlib>
+#include <cstring>
+#include <vector>
 #include <iostream>
 #include <functions.h>
 #include "PatternSet.h"
@@ -56,6 +58,8 @@
 using namespace std;
 using namespace NPP2;
 
+#define ROW_BLOCK_MIN 8   // minimal number of rows of dEdw locked together with shared gradients
+
 
 FullyConnectedLayer::FullyConnectedLayerArguments::FullyConnectedLayerArguments( int numUnits)
 : BasicLayerArguments(numUnits, 1)
@@ -67,19 +71,19 @@ FullyConnectedLayer::FullyConnectedLayerArguments::FullyConnectedLayerArguments(
 
 
 FullyConnectedLayer::FullyConnectedLayer(Net* net, int layerId, int firstUnitId, int unitsPerRow, int numRows, int numCopies)
-: BasicLayerType(net, layerId, firstUnitId, unitsPerRow, numRows, numCopies), weights(0), variables(0), previousDim(0)
+: BasicLayerType(net, layerId, firstUnitId, unitsPerRow, numRows, numCopies), weights(0), dEdw(0), delta(0), variables(0), previousDim(0), stageSize(0), stage(0), numStaged(0), rowLocks(0), numRowBlocks(0), rowBlockDone(0)
 {
   identifer = "FullyConnectedLayer";
 }
 
 FullyConnectedLayer::FullyConnectedLayer() 
-: BasicLayerType(0, 0, 0, 0, 0, 0), weights(0), dEdw(0), delta(0), variables(0), previousDim(0) 
+: BasicLayerType(0, 0, 0, 0, 0, 0), weights(0), dEdw(0), delta(0), variables(0), previousDim(0), stageSize(0), stage(0), numStaged(0), rowLocks(0), numRowBlocks(0), rowBlockDone(0) 
 {
   identifer = "FullyConnectedLayer";
 }
 
 FullyConnectedLayer::FullyConnectedLayer(Net* net, int layerId, const LayerArguments* args)
-: BasicLayerType(net, layerId, args), weights(0), variables(0), previousDim(0)
+: BasicLayerType(net, layerId, args), weights(0), dEdw(0), delta(0), variables(0), previousDim(0), stageSize(0), stage(0), numStaged(0), rowLocks(0), numRowBlocks(0), rowBlockDone(0)
 {
   identifer = "FullyConnectedLayer";
 }
@@ -93,12 +97,13 @@ LayerArguments* FullyConnectedLayer::getArguments() const
 FullyConnectedLayer::~FullyConnectedLayer() 
 {
   if (weights) {
-    delete [] weights;
-    delete [] dEdw;
-    delete [] delta;
+    freeBuffer(weights);
+    freeBuffer(dEdw);
+    freeBuffer(delta);
   }
+  freeStage();
   if (variables) {
-    delete [] variables;
+    freeBuffer(variables);
   }
   if (updateFunction) {
     delete updateFunction;
@@ -110,12 +115,20 @@ void FullyConnectedLayer::connectLayer(const BasicLayerType* previousLayer)
   this->previousDim = previousLayer->numUnits;
   this->numWeights = (previousDim+1) * numUnits;
   
-  weights = new FTYPE[(previousDim+1) * numUnits];
-  delta = new FTYPE[(previousDim+1) * numUnits];
-  dEdw = new FTYPE[(previousDim+1) * numUnits * (numCopies+1)];  // n-copies, used by the n-threads to accumulate deriv. for patterns
+  weights = allocBuffer((previousDim+1) * numUnits);
+  if (!updateFunction || updateFunction->usesDelta()) {
+    delta = allocBuffer((previousDim+1) * numUnits);
+    memset(delta, 0, sizeof(FTYPE) * (previousDim+1)*numUnits);
+  }
   
-  memset(delta, 0, sizeof(FTYPE) * (previousDim+1)*numUnits);
-  memset(dEdw, 0, sizeof(FTYPE) * (previousDim+1)*numUnits*(numCopies+1));
+  if (trainable) {  // frozen layers do not accumulate any derivatives
+    int numBuffers = stageSize > 0 ? 1 : numCopies+1;                // n-copies, used by the n-threads to accumulate deriv. for patterns, or one shared by all
+    dEdw = allocBuffer((previousDim+1) * numUnits * numBuffers);
+    memset(dEdw, 0, sizeof(FTYPE) * (previousDim+1)*numUnits*numBuffers);
+    if (stageSize > 0) {
+      allocStage();
+    }
+  }
   
   if (updateFunction) {
     setUpdateFunction(updateFunction);  // re-set the updateFunction in order to create and initialize the variable-vector
@@ -132,11 +145,19 @@ void FullyConnectedLayer::setUpdateFunction(const UpdateFunction* updateFunction
   }
   
   if (weights) {
+    if (!this->updateFunction->usesDelta() && delta) {  // the state is completely held in the variables
+      freeBuffer(delta);
+      delta = 0;
+    }
+    else if (this->updateFunction->usesDelta() && !delta) {
+      delta = allocBuffer((previousDim+1) * numUnits);
+      memset(delta, 0, sizeof(FTYPE) * (previousDim+1)*numUnits);
+    }
     if (variables) {
-      delete [] variables;
+      freeBuffer(variables);
     }
     int numVariables = this->updateFunction->getNumVariables();
-    variables = new FTYPE[(previousDim+1) * numUnits * numVariables];
+    variables = allocBuffer((previousDim+1) * numUnits * numVariables);
     for (int i=0; i < (previousDim+1) * numUnits; i++) {
       this->updateFunction->initVariables(&variables[i*numVariables]);
     }
@@ -145,6 +166,148 @@ void FullyConnectedLayer::setUpdateFunction(const UpdateFunction* updateFunction
 
 
 
+void FullyConnectedLayer::setTrainable(bool trainable)
+{
+  BasicLayerType::setTrainable(trainable);
+  
+  if (!weights) return;  // not yet connected; connectLayer will take care of dEdw
+  
+  if (!trainable && dEdw) {       // frozen: release the derivatives of all copies
+    freeBuffer(dEdw);
+    dEdw = 0;
+    freeStage();
+  }
+  else if (trainable && !dEdw) {  // unfrozen: start with fresh derivatives
+    int numBuffers = stageSize > 0 ? 1 : numCopies+1;
+    dEdw = allocBuffer((previousDim+1) * numUnits * numBuffers);
+    memset(dEdw, 0, sizeof(FTYPE) * (previousDim+1)*numUnits*numBuffers);
+    if (stageSize > 0) {
+      allocStage();
+    }
+  }
+}
+
+
+void FullyConnectedLayer::setNumCopies(int numCopies)
+{
+  if (dEdw) {
+    reduceGradients(this->numCopies);  // keep the derivatives accumulated in all copies
+    if (stageSize > 0) {               // the shared dEdw stays, the stages are needed for the new copies
+      freeStage();
+    }
+    else {
+      dEdw = resizeCopies(dEdw, (previousDim+1) * numUnits, numCopies);
+    }
+  }
+  BasicLayerType::setNumCopies(numCopies);
+  if (dEdw && stageSize > 0) {
+    allocStage();
+  }
+}
+
+bool FullyConnectedLayer::setSharedGradients(int stageSize)
+{
+  stageSize = stageSize < 0 ? 0 : stageSize;
+  if (stageSize == this->stageSize) return true;
+  
+  if (dEdw) {
+    int n = (previousDim+1) * numUnits;
+    reduceGradients(numCopies);        // sum up everything accumulated so far in copy 0
+    FTYPE* resized = allocBuffer(n * (stageSize > 0 ? 1 : numCopies+1));
+    memcpy(resized, dEdw, sizeof(FTYPE) * n);
+    if (stageSize == 0) {
+      memset(&resized[n], 0, sizeof(FTYPE) * n * numCopies);
+    }
+    freeBuffer(dEdw);
+    dEdw = resized;
+    freeStage();
+    this->stageSize = stageSize;
+    if (stageSize > 0) {
+      allocStage();
+    }
+  }
+  else {
+    this->stageSize = stageSize;       // connectLayer or setTrainable will allocate the buffers
+  }
+  return true;
+}
+
+void FullyConnectedLayer::allocStage()
+{
+  stage = allocBuffer(getStageBlockSize() * (numCopies+1));
+  numStaged = new int[numCopies+1];
+  memset(numStaged, 0, sizeof(int) * (numCopies+1));
+  
+  // more blocks than copies, so that copies flushing at the same time 
+  // rarely wait for each other, but not less than ROW_BLOCK_MIN rows each
+  numRowBlocks = 4 * (numCopies+1);
+  if (numRowBlocks > numUnits / ROW_BLOCK_MIN) {
+    numRowBlocks = numUnits / ROW_BLOCK_MIN > 0 ? numUnits / ROW_BLOCK_MIN : 1;
+  }
+  rowLocks = new pthread_mutex_t[numRowBlocks];
+  for (int b=0; b < numRowBlocks; b++) {
+    pthread_mutex_init(&rowLocks[b], 0);
+  }
+  rowBlockDone = new bool[numRowBlocks * (numCopies+1)];
+}
+
+void FullyConnectedLayer::freeStage()
+{
+  if (stage) {
+    freeBuffer(stage);
+    stage = 0;
+  }
+  delete [] numStaged;
+  numStaged = 0;
+  if (rowLocks) {
+    for (int b=0; b < numRowBlocks; b++) {
+      pthread_mutex_destroy(&rowLocks[b]);
+    }
+    delete [] rowLocks;
+    rowLocks = 0;
+  }
+  delete [] rowBlockDone;
+  rowBlockDone = 0;
+  numRowBlocks = 0;
+}
+
+void FullyConnectedLayer::getMemoryUsage(MemoryUsage& usage) const
+{
+  BasicLayerType::getMemoryUsage(usage);
+  
+  if (!weights) return;  // input layer or not yet connected
+  
+  int n = (previousDim+1) * numUnits;
+  usage.add(MEMORY_WEIGHTS, n, sizeof(FTYPE));
+  if (delta) {
+    usage.add(MEMORY_DELTA, n, sizeof(FTYPE));
+  }
+  if (dEdw) {
+    usage.add(MEMORY_DEDW, n * (stageSize > 0 ? 1 : numCopies+1), sizeof(FTYPE));
+  }
+  if (stage) {
+    usage.add(MEMORY_DEDW, getStageBlockSize() * (numCopies+1), sizeof(FTYPE));
+  }
+  if (variables) {
+    usage.add(MEMORY_VARIABLES, n * updateFunction->getNumVariables(), sizeof(FTYPE));
+  }
+}
+
+void FullyConnectedLayer::estimateMemoryUsage(const BasicLayerType* previousLayer, int numCopies, const UpdateFunction* updateFunction, MemoryUsage& usage) const
+{
+  BasicLayerType::estimateMemoryUsage(previousLayer, numCopies, updateFunction, usage);
+  
+  if (!previousLayer) return;  // the input layer does not have any weights
+  
+  size_t n = (size_t) (previousLayer->numUnits+1) * numUnits;
+  estimateWeightUsage(n, numCopies, updateFunction, usage);
+  if (trainable && stageSize > 0) {  // shared gradients: a single dEdw plus the stages of all copies
+    usage.bytes[MEMORY_DEDW] -= sizeof(FTYPE) * n * numCopies;
+    usage.add(MEMORY_DEDW, (size_t) stageSize * (numUnits + previousLayer->numUnits+1) * (numCopies+1), sizeof(FTYPE));
+  }
+}
+
+
 void FullyConnectedLayer::initWeights(int mode, FTYPE range)
 {
   if(mode == 0){
@@ -171,52 +334,221 @@ void FullyConnectedLayer::forwardPass(FTYPE *input, int copy)
   int pos = copy*(numUnits+1);
   cblas_dgemv (CblasRowMajor, CblasNoTrans, numUnits, previousDim+1,    // M = Ausgabevektor mit netins. N = Eingabevektor mit Ausgabe der vorherigen Schicht (+1 Bias-Neuron)
                1., weights, previousDim+1, input, 1, 0., &netin[pos+1], 1); // lda ist bei row-major die Spaltenanzahl previousDim+1
-  for (int i=1; i <= numUnits; i++) {
-    out[pos+i] = act_f(netin[pos+i]);
+  applyActivation(&netin[pos+1], &out[pos+1], numUnits);
+}
+
+void FullyConnectedLayer::forwardPassPart(FTYPE *input, int part, int numParts, int copy)
+{
+  int begin, end;
+  getPartRange(part, numParts, (size_t) (previousDim+1) * numUnits, &begin, &end);
+  if (begin >= end) return;
+  
+  int pos = copy*(numUnits+1);
+  cblas_dgemv (CblasRowMajor, CblasNoTrans, end-begin, previousDim+1,  // only the rows of the units begin..end-1
+               1., &weights[(begin-1)*(previousDim+1)], previousDim+1, input, 1, 0., &netin[pos+begin], 1);
+  applyActivation(&netin[pos+begin], &out[pos+begin], end-begin);
+}
+
+void FullyConnectedLayer::forwardPassBatch(const FTYPE *input, FTYPE *netin, FTYPE *out, int numPatterns)
+{
+  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasTrans, numPatterns, numUnits, previousDim+1, // one row of net inputs per pattern: input * weights^T
+              1., input, previousDim+1, weights, previousDim+1, 0., &netin[1], numUnits+1); // the rows of netin and out start with the bias
+  for (int p=0; p < numPatterns; p++) {
+    int pos = p*(numUnits+1);
+    out[pos] = 1.;
+    applyActivation(&netin[pos+1], &out[pos+1], numUnits);
   }
 }
 
 void FullyConnectedLayer::backwardPass(FTYPE *dedout, int copy)
 {
   int pos = copy*(numUnits+1);
-  int posWeightMatrices = copy*(previousDim+1) * numUnits; // this points to the correct copy of the weights matrices and the corresponding derivatives
-  for (int i=1; i <= numUnits; i++) {
-    dEdnet[pos+i] = dEdo[pos+i] * deriv_f(out[pos+i], netin[pos+i]);
-    dEdo[pos+i] = (FTYPE) 0;
-  }
+  applyDerivative(&dEdo[pos+1], &out[pos+1], &netin[pos+1], &dEdnet[pos+1], numUnits);
   if (getLayerType() == INPUT_LAYER) {
-    memcpy(dedout, &(dEdnet[pos+1]), sizeof (FTYPE) * numUnits);
+    if (dedout) {
+      memcpy(dedout, &(dEdnet[pos+1]), sizeof (FTYPE) * numUnits);
+    }
     return; // ready. Otherwise calc derivs for weights and output of previous layer.
   }
-  cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, numUnits, previousDim+1, 1, 1., &dEdnet[pos+1], 1, 
-              &net->layers[layerId-1]->out[copy*(previousDim+1)], previousDim+1, 1.,  // -> 1 in order to sum up over the patterns!
-              &dEdw[posWeightMatrices], previousDim+1); // sum up in correct copy of dEdw
+  if (trainable) { // frozen layers skip the derivatives of their weights
+    accumulateGradients(copy);
+  }
   
-  cblas_dgemv(CblasRowMajor, CblasTrans, numUnits, previousDim, 1., weights+1, previousDim+1, &dEdnet[pos+1], 1, 0., dedout, 1);  // skip bias
+  if (dedout) { // derivatives in respect to the previous layer's output only when asked for
+    cblas_dgemv(CblasRowMajor, CblasTrans, numUnits, previousDim, 1., weights+1, previousDim+1, &dEdnet[pos+1], 1, 0., dedout, 1);  // skip bias
+  }
 }
 
-void FullyConnectedLayer::updateWeights(int numThreads)
+// sparse version of the forward pass: only the weights of active inputs 
+// (and the bias weight) contribute to the net input. the loop runs over the
+// rows of the weight matrix, gathering the active columns in each row.
+void FullyConnectedLayer::forwardPassSparse(FTYPE *, const int* activeIndex, const FTYPE* activeValue, int numActive, int copy)
 {
-  if (!updateFunction || !weights || !variables) {
-    cerr << "Layer " << layerId << " not correctly initialized." << endl;
-    exit(1);
+  int pos = copy*(numUnits+1);
+  for (int i=0; i < numUnits; i++) {
+    const FTYPE* row = &weights[i*(previousDim+1)];
+    FTYPE sum = row[0];                                     // bias neuron is always on
+    for (int k=0; k < numActive; k++) {
+      sum += row[activeIndex[k]+1] * activeValue[k];        // +1 skips the bias column
+    }
+    netin[pos+i+1] = sum;
+  }
+  applyActivation(&netin[pos+1], &out[pos+1], numUnits);
+}
+
+void FullyConnectedLayer::backwardPassSparse(FTYPE *dedout, const int* activeIndex, const FTYPE* activeValue, int numActive, int copy)
+{
+  int pos = copy*(numUnits+1);
+  int posWeightMatrices = copy*(previousDim+1) * numUnits;
+  applyDerivative(&dEdo[pos+1], &out[pos+1], &netin[pos+1], &dEdnet[pos+1], numUnits);
+  if (getLayerType() == INPUT_LAYER) {
+    if (dedout) {
+      memcpy(dedout, &(dEdnet[pos+1]), sizeof (FTYPE) * numUnits);
+    }
+    return;
+  }
+  if (trainable && stageSize > 0) { // shared gradients: the complete input is staged (the input layer holds the dense input)
+    accumulateGradients(copy);
+  }
+  else if (trainable) { // inactive inputs are zero and would not change dEdw; only update the active columns
+    for (int i=0; i < numUnits; i++) {
+      FTYPE* row = &dEdw[posWeightMatrices + i*(previousDim+1)];
+      FTYPE d = dEdnet[pos+i+1];
+      row[0] += d;                                          // bias
+      for (int k=0; k < numActive; k++) {
+        row[activeIndex[k]+1] += d * activeValue[k];
+      }
+    }
+  }
+  if (dedout) { // derivatives in respect to the input are dense, though
+    cblas_dgemv(CblasRowMajor, CblasTrans, numUnits, previousDim, 1., weights+1, previousDim+1, &dEdnet[pos+1], 1, 0., dedout, 1);  // skip bias
+  }
+}
+
+void FullyConnectedLayer::accumulateGradients(int copy)
+{
+  int pos = copy*(numUnits+1);
+  const FTYPE* input = &net->layers[layerId-1]->out[copy*(previousDim+1)];
+  
+  if (stageSize == 0) {
+    cblas_dgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, numUnits, previousDim+1, 1, 1., &dEdnet[pos+1], 1, 
+                input, previousDim+1, 1.,                                   // -> 1 in order to sum up over the patterns!
+                &dEdw[copy*(previousDim+1) * numUnits], previousDim+1);     // sum up in correct copy of dEdw
+    return;
   }
   
+  FTYPE* deltas = &stage[copy * getStageBlockSize()];   // stageSize rows of dEdnet
+  FTYPE* inputs = &deltas[stageSize * numUnits];        // stageSize rows of inputs (including the bias)
+  int k = numStaged[copy];
+  memcpy(&deltas[k * numUnits], &dEdnet[pos+1], sizeof(FTYPE) * numUnits);
+  memcpy(&inputs[k * (previousDim+1)], input, sizeof(FTYPE) * (previousDim+1));
+  numStaged[copy] = k+1;
+  if (k+1 == stageSize) {
+    flushStage(copy, true);
+  }
+}
+
+void FullyConnectedLayer::flushStage(int copy, bool lock)
+{
+  int k = numStaged[copy];
+  if (k == 0) return;
+  const FTYPE* deltas = &stage[copy * getStageBlockSize()];
+  const FTYPE* inputs = &deltas[stageSize * numUnits];
+  
+  // dEdw += deltas^T * inputs, block of rows by block of rows. The copies 
+  // start at different blocks and skip blocks that are locked by other 
+  // copies, as long as there are free blocks left.
+  int rowsPerBlock = (numUnits + numRowBlocks - 1) / numRowBlocks;
+  int first = (int) ((long) copy * numRowBlocks / (numCopies+1));
+  bool* done = &rowBlockDone[copy * numRowBlocks];
+  memset(done, 0, sizeof(bool) * numRowBlocks);
+  int remaining = numRowBlocks;
+  bool wait = false;
+  while (remaining > 0) {
+    bool progress = false;
+    for (int i=0; i < numRowBlocks; i++) {
+      int b = (first + i) % numRowBlocks;
+      if (done[b]) continue;
+      if (lock) {
+        if (wait) {
+          pthread_mutex_lock(&rowLocks[b]);
+        }
+        else if (pthread_mutex_trylock(&rowLocks[b]) != 0) {
+          continue;
+        }
+      }
+      int begin = b * rowsPerBlock;
+      int end = begin + rowsPerBlock < numUnits ? begin + rowsPerBlock : numUnits;
+      if (end > begin) {
+        cblas_dgemm(CblasRowMajor, CblasTrans, CblasNoTrans, end-begin, previousDim+1, k, 1.,
+                    &deltas[begin], numUnits, inputs, previousDim+1, 1., 
+                    &dEdw[begin*(previousDim+1)], previousDim+1);
+      }
+      if (lock) {
+        pthread_mutex_unlock(&rowLocks[b]);
+      }
+      done[b] = true;
+      remaining--;
+      progress = true;
+      if (wait) break;          // try the other blocks again without waiting
+    }
+    wait = lock && !progress;   // all remaining blocks are locked: wait for the next one
+  }
+  numStaged[copy] = 0;
+}
+
+bool FullyConnectedLayer::reduceGradients(int numThreads)
+{
+  if (!trainable) return true;
+  if (stageSize > 0) {          // the workers have finished: add what is left in the stages of all copies
+    for (int i=0; i <= numCopies; i++) {
+      flushStage(i, false);
+    }
+    return true;
+  }
   if (numThreads > 1) {
     for (int i=1; i <= numThreads; i++) {
       cblas_daxpy((previousDim+1)*numUnits, 1., &dEdw[(previousDim+1)*numUnits*i], 1, dEdw, 1); // sum the partial sums of the derivatives
       cblas_dscal((previousDim+1)*numUnits, 0., &dEdw[(previousDim+1)*numUnits*i], 1);          // and set the copies back to zero (for the next iteration)
     }
   }
+  return true;
+}
+
+bool FullyConnectedLayer::mergeGradients(int copy)
+{
+  if (!trainable) return true;
+  if (stageSize > 0) return false; // the copies share one buffer
+  if (copy > 0) {
+    cblas_daxpy((previousDim+1)*numUnits, 1., &dEdw[(previousDim+1)*numUnits*copy], 1, dEdw, 1);
+    cblas_dscal((previousDim+1)*numUnits, 0., &dEdw[(previousDim+1)*numUnits*copy], 1);
+  }
+  return true;
+}
+
+FTYPE* FullyConnectedLayer::getGradients(int* count)
+{
+  *count = dEdw ? (previousDim+1)*numUnits : 0;  // frozen layers do not have any derivatives
+  return dEdw;
+}
+
+FTYPE* FullyConnectedLayer::getWeights(int* count)
+{
+  *count = weights ? (previousDim+1)*numUnits : 0;
+  return weights;
+}
+
+void FullyConnectedLayer::updateWeights(int numThreads)
+{
+  if (!trainable) return; // frozen weights are never changed
   
-  int numVariables = updateFunction->getNumVariables();
-  for (int to=0; to < numUnits; to++) {
-    for (int from=0; from < previousDim+1; from++) {
-      int pos = (previousDim+1)*to+from;
-      //double save = weights[pos];
-      (*updateFunction) (&weights[pos], &delta[pos], &dEdw[pos], &variables[pos*numVariables]); // now calculte the weight change and apply it
-    }
-  }  
+  if (!updateFunction || !weights || !variables) {
+    cerr << "Layer " << layerId << " not correctly initialized." << endl;
+    exit(1);
+  }
+  
+  reduceGradients(numThreads);
+  updateFunction->update(weights, delta, dEdw, variables, (previousDim+1)*numUnits); // now calculte the weight changes and apply them
 }
 
 
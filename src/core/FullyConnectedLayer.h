@@ -36,6 +36,7 @@
 
 #include <iostream>
 #include <string>
+#include <pthread.h>
 
 #include "BasicLayerTypes.h"
 
@@ -64,15 +65,49 @@ namespace NPP2 {
     
     int previousDim;  ///< dimension of the previous layer. The total number of connections is given by multiplying the previous layer's dimension with this layer's dimension.
     
+    int stageSize;    ///< with shared gradients: number of patterns each copy collects before adding their derivatives to dEdw. 0, if each copy has its own copy of dEdw (default).
+    FTYPE* stage;     ///< with shared gradients: per copy the derivatives of the net inputs and the inputs of up to stageSize patterns
+    int* numStaged;   ///< with shared gradients: per copy the number of patterns in the stage
+    pthread_mutex_t* rowLocks; ///< with shared gradients: one lock per block of rows of dEdw
+    int numRowBlocks; ///< with shared gradients: number of blocks of rows of dEdw
+    bool* rowBlockDone; ///< with shared gradients: per copy one flag per block of rows, marks the blocks flushStage has added
+    
   
     void forwardPass(FTYPE *input, int copy=0);  
     void backwardPass(FTYPE *dedo, int copy=0);
+    /** calculates the net input by gathering only the columns of the weight
+     * matrix that belong to the active inputs. */
+    void forwardPassSparse(FTYPE *input, const int* activeIndex, const FTYPE* activeValue, int numActive, int copy=0);
+    /** accumulates only the columns of dEdw that belong to the active inputs
+     * (and the bias). */
+    void backwardPassSparse(FTYPE *dedo, const int* activeIndex, const FTYPE* activeValue, int numActive, int copy=0);
+    /** propagates a block of rows of the weight matrix */
+    void forwardPassPart(FTYPE *input, int part, int numParts, int copy=0);
+    /** calculates the net inputs of all patterns with a single matrix-matrix
+     * product. Does not touch the copies of the layer. */
+    void forwardPassBatch(const FTYPE *input, FTYPE *netin, FTYPE *out, int numPatterns);
     void updateWeights(int numCopies=0);
+    bool reduceGradients(int numCopies);
+    bool mergeGradients(int copy);
+    FTYPE* getGradients(int* count);
+    FTYPE* getWeights(int* count);
+    /** lets all copies accumulate the derivatives of the weights in a single
+     * dEdw instead of one copy of dEdw per copy of the layer. Each copy 
+     * collects the derivatives of the net inputs and the inputs of 
+     * stageSize patterns and then adds their products to dEdw with one 
+     * matrix-matrix product per block of rows, locking only that block. 
+     * Pass 0 to return to a copy of dEdw per copy. */
+    bool setSharedGradients(int stageSize);
     void connectLayer(const BasicLayerType* previousLayer);
     
     void initWeights(int mode, FTYPE range);
     
     void setUpdateFunction(const UpdateFunction* updateFunction);
+    void setTrainable(bool trainable);
+    void setNumCopies(int numCopies);
+    
+    void getMemoryUsage(MemoryUsage& usage) const;
+    void estimateMemoryUsage(const BasicLayerType* previousLayer, int numCopies, const UpdateFunction* updateFunction, MemoryUsage& usage) const;
     
     void writeToStream(std::ostream& out) const;
     void readFromStream(std::istream& in);
@@ -89,6 +124,18 @@ namespace NPP2 {
     virtual LayerArguments* getArguments() const;  
     
     virtual void copyWeights(const BasicLayerType* layer);  
+    
+  protected:
+    /** adds the product of the derivatives of the net inputs and the inputs
+     * of the present pattern to the copy's dEdw, or collects them in the 
+     * copy's stage (shared gradients) */
+    void accumulateGradients(int copy);
+    /** adds the patterns collected in the copy's stage to the shared dEdw.
+     * Locks the blocks of rows, unless the copies are known to be idle. */
+    void flushStage(int copy, bool lock);
+    void allocStage();  ///< allocates stage and locks for the present number of copies
+    void freeStage();   ///< releases stage and locks
+    size_t getStageBlockSize() const { return (size_t) stageSize * (numUnits + previousDim+1); } ///< size of the stage of one copy
   };
 
 }
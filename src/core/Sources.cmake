@@ -3,6 +3,7 @@ LIST(APPEND core_srcs
 	${NPP2_SOURCE_DIR}/core/BasicLayerTypes.cpp
 	${NPP2_SOURCE_DIR}/core/FullyConnectedLayer.cpp
 	${NPP2_SOURCE_DIR}/core/functions.cpp
+	${NPP2_SOURCE_DIR}/core/kernels.cpp
 	${NPP2_SOURCE_DIR}/core/npp2.cpp
 	${NPP2_SOURCE_DIR}/core/NPPException.cpp
 ) 
@@ -11,6 +12,13 @@ LIST(APPEND core_headers
 	${NPP2_SOURCE_DIR}/core/BasicLayerTypes.h
 	${NPP2_SOURCE_DIR}/core/FullyConnectedLayer.h
 	${NPP2_SOURCE_DIR}/core/functions.h
+	${NPP2_SOURCE_DIR}/core/kernels.h
 	${NPP2_SOURCE_DIR}/core/npp2.h
 	${NPP2_SOURCE_DIR}/core/NPPException.h
-)
\ No newline at end of file
+)
+# the kernels are compiled in several variants for different instruction sets.
+# they need to be vectorized by the compiler and must not use fused 
+# multiply-add, in order to produce identical results in all variants.
+IF(CMAKE_COMPILER_IS_GNUCXX OR CMAKE_CXX_COMPILER_ID MATCHES "Clang")
+  SET_SOURCE_FILES_PROPERTIES(${NPP2_SOURCE_DIR}/core/kernels.cpp PROPERTIES COMPILE_FLAGS "-O3 -ffp-contract=off")
+ENDIF(CMAKE_COMPILER_IS_GNUCXX OR CMAKE_CXX_COMPILER_ID MATCHES "Clang")
@@ -39,6 +39,7 @@
  */
 
 #include "functions.h"
+#include "kernels.h"
 #include <cassert>
 #include <iostream>
 
@@ -56,11 +57,17 @@ using namespace NPP2;
 UpdateFunction::UpdateFunction() : numVariables(0)
 {}
 
+void UpdateFunction::update(FTYPE* weights, FTYPE* delta, FTYPE* dEdw, FTYPE* variables, int n)
+{
+  for (int i=0; i < n; i++) {
+    (*this) (&weights[i], &delta[i], &dEdw[i], &variables[i*numVariables]);
+  }
+}
 
-RPROP::RPROP(FTYPE* params)
-: UpdateFunction(), delta0(UPDATE_VALUE), deltaMax(DELTA_MAX), weightDecay(0.)
+
+RPROP::RPROP(FTYPE* params, bool compact)
+: UpdateFunction(), delta0(UPDATE_VALUE), deltaMax(DELTA_MAX), weightDecay(0.), compact(compact), firstStep(.1)
 {
-  numVariables = 2;
   setParameters(params);
 }
 
@@ -73,6 +80,8 @@ void RPROP::setParameters(const FTYPE* params)
   if (!delta0) delta0 = UPDATE_VALUE;
   if (!deltaMax) deltaMax = DELTA_MAX;
   if (delta0 > deltaMax) delta0 = deltaMax; // nonsense value?!
+  
+  numVariables = compact ? (sizeof(CompactState) + sizeof(FTYPE) - 1) / sizeof(FTYPE) : sizeof(State) / sizeof(FTYPE);
 }
 
 void RPROP::getParameters(FTYPE* params) const
@@ -84,8 +93,16 @@ void RPROP::getParameters(FTYPE* params) const
 
 void RPROP::initVariables(FTYPE* variables) const
 {
-  variables[0] = delta0; // this holds the weight's individual step length that is adapted by rprop
-  variables[1] = .1; // this is a term that reduces the step-length in the very first weight-update to 1/10th of the original length. this was thought to be useful when assembling individual (pre-trained) layers into a larger, deep network (last step of pre-training might be way to long for the first step in the deep net). Actually, reducing the length in such a way and only in the first step doesn't help much (if at all). I've nevertheless left it in here, in order to be able to reproduce my dissertation's results exactly.
+  // the weight's individual step length that is adapted by rprop. there has
+  // not been a weight change yet.
+  if (compact) {
+    ((CompactState*) variables)->step = (float) delta0;
+    ((CompactState*) variables)->sign = 0.f;
+  }
+  else {
+    ((State*) variables)->step = delta0;
+    ((State*) variables)->sign = 0.;
+  }
 }
 
 
@@ -97,39 +114,35 @@ UpdateFunction* RPROP::clone() const
 
 void RPROP::operator() (FTYPE* weight, FTYPE* delta, FTYPE* dEdw, FTYPE* variables)
 {
-  register double direction, update_value, dEdwl;
-  
-  update_value = variables[0];
-      
-  dEdwl = *dEdw + weightDecay * *weight; // this implementation of weight decay has been debatted for quite some time in the group. either ignore or please ask a senior member for it's consequences ;-)
-  direction = *delta * dEdwl;
-      
-  if(direction<0.0) {
-    update_value = MIN(update_value * ETAPLUS,deltaMax);
-    if(dEdwl>0.0) {
-      *delta = - update_value;
-    }
-    else { // dEdw<0.0
-      *delta = update_value;
-    }
+  const FTYPE params[6] = { ETAPLUS, ETAMINUS, DELTA_MIN, deltaMax, weightDecay, firstStep };
+  if (compact) {
+    kernels().rpropCompact(weight, (CompactState*) variables, dEdw, 1, params);
   }
-  else if(direction>0.0){
-    update_value = MAX(update_value * ETAMINUS,DELTA_MIN);
-    *delta = 0.0;  // restart adaptation in next step
+  else {
+    kernels().rprop(weight, (State*) variables, dEdw, 1, params);
   }
-  else{ /* direction == 0.0 */
-    if(dEdwl>0.0)
-      *delta = - update_value;
-    else if(dEdwl<0.0)
-      *delta = update_value;
-    else
-      *delta = (FTYPE) 0;
+}
+
+void RPROP::update(FTYPE* weights, FTYPE* delta, FTYPE* dEdw, FTYPE* variables, int n)
+{
+  const FTYPE params[6] = { ETAPLUS, ETAMINUS, DELTA_MIN, deltaMax, weightDecay, firstStep };
+  if (compact) {
+    kernels().rpropCompact(weights, (CompactState*) variables, dEdw, n, params);
+  }
+  else {
+    kernels().rprop(weights, (State*) variables, dEdw, n, params);
   }
-  *weight += variables[1] * *delta;  // as stated above, variables[1] just reduces the step length in the very first step of the training procedure
+  firstStep = 1.;  // just use the full step in all epochs after epoch 0
+}
 
-  variables[0] = update_value;
-  *dEdw = (FTYPE) 0;  /* important: clear dEdw !*/
-  variables[1] = 1.;  // just use delta in all epochs after epoch 0
+
+FTYPE ErrorFunction::errorAndDeriv(const FTYPE* output, const FTYPE* target, FTYPE* dedo, int n, FTYPE sum) const
+{
+  for (int i=0; i < n; i++) {
+    sum += error(output[i], target[i]);
+    dedo[i] = deriv(output[i], target[i]);
+  }
+  return sum;
 }
 
 
@@ -141,6 +154,16 @@ FTYPE SquaredError::deriv(FTYPE output, FTYPE target) const
 {
   return output - target;
 }
+// the sum is not vectorized, as that would change the order of the additions
+FTYPE SquaredError::errorAndDeriv(const FTYPE* output, const FTYPE* target, FTYPE* dedo, int n, FTYPE sum) const
+{
+  for (int i=0; i < n; i++) {
+    FTYPE e = output[i] - target[i];
+    sum += e * e;
+    dedo[i] = e;
+  }
+  return sum;
+}
 
 FTYPE UnimodalCrossEntropy::error(FTYPE output, FTYPE target) const
 {
@@ -100,12 +100,21 @@ namespace NPP2 {
      * attached to each weight for storing internal intermediate results and 
      * values (e.g. in order to realize a momentum term for each weight). */
     virtual void operator() (FTYPE* weight, FTYPE* delta, FTYPE* dEdw, FTYPE* variables)=0;
+    /** updates n consecutive weights at once. The variables of the weights
+     * are expected to be stored consecutively (getNumVariables() entries per 
+     * weight). The default implementation calls operator() for each weight; 
+     * implementations may override it with a vectorized version. */
+    virtual void update(FTYPE* weights, FTYPE* delta, FTYPE* dEdw, FTYPE* variables, int n);
     /** set the parameter vector (semantics depend on particular implementation. */
     virtual void setParameters(const FTYPE* params)=0;
     /** get the parameter vector */
     virtual void getParameters(FTYPE* params) const=0;
     /** get the number of variables this update function uses. */
     inline   int getNumVariables() const { return numVariables; }
+    /** returns false, if the update function keeps all its state in the 
+     * variables and does not use the delta vector. Layers do not need to 
+     * allocate the delta vector in this case and may pass 0 to update. */
+    virtual bool usesDelta() const { return true; }
     /** called at the start of the procedure to give the update function a chance
      * to fill the variables at a neuron with the desired starting values */
     virtual void initVariables(FTYPE* variables) const=0;
@@ -119,22 +128,53 @@ namespace NPP2 {
     int numVariables;  ///< how many "internal" variables does this update function use? These variables are stored at each weight.
   };
 
-  /** Implements Riedmiller's Resilient propagation (RProp). */
+  /** Implements Riedmiller's Resilient propagation (RProp). 
+   *
+   * The state of each weight is a single record in the variables holding
+   * its adapted step size and the sign of its last change; the delta vector
+   * is not used. A compact RPROP (Net::setUpdateFunc with NPP_RPROP_COMPACT)
+   * holds the step sizes in single precision, which halves the record. The
+   * step length of the very first
+   * update is reduced to 1/10th by a factor that is held once per layer 
+   * (each layer uses its own clone of the update function). */
   class RPROP : public UpdateFunction {
   public:
+    /** per-weight state in full precision (two variables per weight) */
+    struct State {
+      FTYPE step;   ///< individual step size of the weight
+      FTYPE sign;   ///< sign of the last weight change (-1, 0 or 1)
+    };
+    /** per-weight state with a single precision step size */
+    struct CompactState {
+      float step;
+      float sign;
+    };
+    
+    /** applies the rule to a single weight. Does not end the first step;
+     * layers should use update in order to update all of their weights. */
     virtual void operator() (FTYPE* weight, FTYPE* delta, FTYPE* dEdw, FTYPE* variables);
+    /** updates n weights; delta is not used and may be 0. */
+    virtual void update(FTYPE* weights, FTYPE* delta, FTYPE* dEdw, FTYPE* variables, int n);
+    /** params[0]: initial step size, params[1]: maximal step size, 
+     * params[2]: weight decay */
     virtual void setParameters(const FTYPE* params);
     virtual void getParameters(FTYPE* params) const;
     virtual void initVariables(FTYPE* variables) const;
+    virtual bool usesDelta() const { return false; }
     
     virtual UpdateFunction* clone() const;
 
     
-    RPROP(FTYPE* params);
+    /** constructs RPROP with the given parameters (see setParameters). If 
+     * compact is true, the step sizes are held in single precision. */
+    RPROP(FTYPE* params, bool compact=false);
+    bool isCompact() const { return compact; } ///< returns whether the step sizes are held in single precision
   protected:
     FTYPE delta0;
     FTYPE deltaMax;
     FTYPE weightDecay;
+    bool compact;      ///< step sizes are held in single precision
+    FTYPE firstStep;   ///< reduces the step length in the very first weight-update to 1/10th of the original length. this was thought to be useful when assembling individual (pre-trained) layers into a larger, deep network (last step of pre-training might be way to long for the first step in the deep net). Actually, reducing the length in such a way and only in the first step doesn't help much (if at all). It has nevertheless been left in here, in order to be able to reproduce the dissertation's results exactly.
   };
   
   
@@ -147,6 +187,11 @@ namespace NPP2 {
     virtual FTYPE error(FTYPE output, FTYPE target) const=0;
     /** given an output value and a target value, return dedo. */
     virtual FTYPE deriv(FTYPE output, FTYPE target) const=0;
+    /** given n outputs and targets, writes the derivatives to dedo and 
+     * returns sum plus the errors, which are added to sum one after the 
+     * other (pass the running sum to get the same rounding as calling 
+     * error for every output). dedo may be identical to output. */
+    virtual FTYPE errorAndDeriv(const FTYPE* output, const FTYPE* target, FTYPE* dedo, int n, FTYPE sum=0.) const;
     
     virtual ~ErrorFunction() {}
   };
@@ -156,6 +201,7 @@ namespace NPP2 {
   public:
     virtual FTYPE error(FTYPE output, FTYPE target) const;
     virtual FTYPE deriv(FTYPE output, FTYPE target) const;    
+    virtual FTYPE errorAndDeriv(const FTYPE* output, const FTYPE* target, FTYPE* dedo, int n, FTYPE sum=0.) const;
   };
   
   /** Error function that is better suited for classification (0 / 1). */
@@ -0,0 +1,211 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: kernels.cpp
+ *
+ *  The bodies of the kernels are written only once (as inline functions) and
+ *  are instantiated for every instruction set by wrapping them in functions
+ *  carrying the corresponding target attribute. The compiler vectorizes each
+ *  wrapper for its instruction set. This file should be compiled with 
+ *  optimization enabled and without floating-point contraction (no fused 
+ *  multiply-add), so all variants produce bitwise identical results.
+ */
+
+#include "kernels.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+using namespace NPP2;
+using namespace std;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define NPP2_KERNEL_DISPATCH    // compile several variants and select at runtime
+#endif
+
+#if defined(__GNUC__)
+#define NPP2_INLINE inline __attribute__((always_inline))
+#else
+#define NPP2_INLINE inline
+#endif
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Kernel bodies
+#endif
+
+// the bodies avoid branches inside the loops, so the compiler is able to 
+// vectorize them. the results match the scalar versions in functions.h/.cpp.
+
+static NPP2_INLINE void logisticBody(const FTYPE* netin, FTYPE* out, int n)
+{
+  for (int i=0; i < n; i++) {
+    FTYPE x = netin[i];
+    x = x >= 16.0 ? 16.0 : x;                 // avoid under/overflow
+    x = x <= -16.0 ? -16.0 : x;
+    out[i] = (FTYPE) (1.0 / (1.0 + exp(-x)));
+  }
+}
+
+static NPP2_INLINE void logisticDerivBody(FTYPE* dEdo, const FTYPE* out, FTYPE* dEdnet, int n)
+{
+  for (int i=0; i < n; i++) {
+    dEdnet[i] = dEdo[i] * ((1.0 - out[i]) * out[i]);
+    dEdo[i] = (FTYPE) 0;
+  }
+}
+
+static NPP2_INLINE void linearDerivBody(FTYPE* dEdo, FTYPE* dEdnet, int n)
+{
+  for (int i=0; i < n; i++) {
+    dEdnet[i] = dEdo[i];
+    dEdo[i] = (FTYPE) 0;
+  }
+}
+
+template <class STATE>
+static NPP2_INLINE void rpropBody(FTYPE* weights, STATE* state, FTYPE* dEdw, int n, const FTYPE* params)
+{
+  const FTYPE etaPlus = params[0], etaMinus = params[1], deltaMin = params[2], deltaMax = params[3], weightDecay = params[4], factor = params[5];
+  for (int i=0; i < n; i++) {
+    FTYPE updateValue = state[i].step;
+    FTYPE dEdwl = dEdw[i] + weightDecay * weights[i]; // this implementation of weight decay has been debatted for quite some time in the group.
+    FTYPE direction = (FTYPE) state[i].sign * dEdwl;
+    
+    FTYPE increased = updateValue * etaPlus;  // same sign as in previous step: accelerate
+    FTYPE decreased = updateValue * etaMinus; // sign changed: slow down
+    increased = increased < deltaMax ? increased : deltaMax;
+    decreased = decreased > deltaMin ? decreased : deltaMin;
+    updateValue = direction < 0.0 ? increased : (direction > 0.0 ? decreased : updateValue);
+    
+    FTYPE sign = dEdwl > 0.0 ? (FTYPE) -1 : (dEdwl < 0.0 ? (FTYPE) 1 : (FTYPE) 0);
+    sign = direction > 0.0 ? (FTYPE) 0 : sign;  // restart adaptation in next step after a sign change
+    
+    weights[i] += factor * (sign * updateValue);
+    state[i].sign = sign;
+    state[i].step = updateValue;
+    dEdw[i] = (FTYPE) 0;
+  }
+}
+
+static NPP2_INLINE void gemvInt8Body(const signed char* matrix, const signed char* x, int* y, int rows, int cols)
+{
+  for (int r=0; r < rows; r++) {
+    const signed char* row = &matrix[(size_t) r * cols];
+    int sum = 0;
+    for (int c=0; c < cols; c++) {
+      sum += row[c] * x[c];
+    }
+    y[r] = sum;
+  }
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Instantiation for the different instruction sets
+#endif
+
+#define NPP2_DEFINE_KERNELS(SUFFIX, TARGET)                                                   \
+  static TARGET void logistic_##SUFFIX(const FTYPE* netin, FTYPE* out, int n)                 \
+  { logisticBody(netin, out, n); }                                                           \
+  static TARGET void logisticDeriv_##SUFFIX(FTYPE* dEdo, const FTYPE* out, FTYPE* dEdnet, int n) \
+  { logisticDerivBody(dEdo, out, dEdnet, n); }                                               \
+  static TARGET void linearDeriv_##SUFFIX(FTYPE* dEdo, FTYPE* dEdnet, int n)                  \
+  { linearDerivBody(dEdo, dEdnet, n); }                                                      \
+  static TARGET void rprop_##SUFFIX(FTYPE* weights, RPROP::State* state, FTYPE* dEdw, int n, const FTYPE* params) \
+  { rpropBody(weights, state, dEdw, n, params); }                                            \
+  static TARGET void rpropCompact_##SUFFIX(FTYPE* weights, RPROP::CompactState* state, FTYPE* dEdw, int n, const FTYPE* params) \
+  { rpropBody(weights, state, dEdw, n, params); }                                            \
+  static TARGET void gemvInt8_##SUFFIX(const signed char* matrix, const signed char* x, int* y, int rows, int cols) \
+  { gemvInt8Body(matrix, x, y, rows, cols); }                                                \
+  static const KernelTable kernels_##SUFFIX = {                                              \
+    #SUFFIX, logistic_##SUFFIX, logisticDeriv_##SUFFIX, linearDeriv_##SUFFIX,                \
+    rprop_##SUFFIX, rpropCompact_##SUFFIX, gemvInt8_##SUFFIX                                 \
+  };
+
+#ifdef NPP2_KERNEL_DISPATCH
+NPP2_DEFINE_KERNELS(sse2, )   // baseline of every x86_64 cpu
+NPP2_DEFINE_KERNELS(avx2, __attribute__((target("avx2"))))
+NPP2_DEFINE_KERNELS(avx512f, __attribute__((target("avx512f"))))
+#else
+NPP2_DEFINE_KERNELS(generic, )
+#endif
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Selection of the variant
+#endif
+
+// selects the most capable variant that is supported by the cpu. the 
+// environment variable NPP2_KERNELS may be used to select a less capable one.
+static const KernelTable* selectKernels()
+{
+#ifdef NPP2_KERNEL_DISPATCH
+  __builtin_cpu_init();
+  const KernelTable* supported[3];
+  int numSupported = 0;
+  if (__builtin_cpu_supports("avx512f")) supported[numSupported++] = &kernels_avx512f;
+  if (__builtin_cpu_supports("avx2"))    supported[numSupported++] = &kernels_avx2;
+  supported[numSupported++] = &kernels_sse2;
+  
+  const char* requested = getenv("NPP2_KERNELS");
+  if (requested) {
+    for (int i=0; i < numSupported; i++) {
+      if (strcmp(requested, supported[i]->name) == 0) return supported[i];
+    }
+    cerr << "WARNING: Kernel variant " << requested << " requested by NPP2_KERNELS is not supported by this cpu. Using " 
+         << supported[0]->name << " instead." << endl;
+  }
+  return supported[0];
+#else
+  return &kernels_generic;
+#endif
+}
+
+static const KernelTable* selectedKernels = selectKernels(); // select once at program start
+
+const KernelTable& NPP2::kernels()
+{
+  if (!selectedKernels) {          // only during static initialization of other translation units
+    selectedKernels = selectKernels();
+  }
+  return *selectedKernels;
+}
+
+const char* NPP2::getKernelVariant()
+{
+  return kernels().name;
+}
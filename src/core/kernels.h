@@ -0,0 +1,82 @@
+#ifndef _NPP2_KERNELS_H_
+#define _NPP2_KERNELS_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: kernels.h
+ *
+ *  Hand-written loops (everything that is not done by BLAS) in several 
+ *  variants for different instruction sets. The best variant supported by 
+ *  the cpu is selected once at program start.
+ */
+
+#include "functions.h"
+
+namespace NPP2 {
+  
+  /** Table of pointers to all hand-written compute kernels of one instruction
+   * set variant. The kernels of all variants calculate exactly the same 
+   * results; only the instructions used for calculating them differ. */
+  struct KernelTable {
+    const char* name;  ///< name of the instruction set the kernels have been compiled for (e.g. "avx2")
+    
+    /** out[i] = logistic(netin[i]) for i=0..n-1 */
+    void (*logistic)(const FTYPE* netin, FTYPE* out, int n);
+    /** dEdnet[i] = dEdo[i] * logistic_deriv(out[i]); dEdo[i] = 0 */
+    void (*logisticDeriv)(FTYPE* dEdo, const FTYPE* out, FTYPE* dEdnet, int n);
+    /** dEdnet[i] = dEdo[i]; dEdo[i] = 0 */
+    void (*linearDeriv)(FTYPE* dEdo, FTYPE* dEdnet, int n);
+    /** applies RProp to n consecutive weights and clears their dEdw. params 
+     * holds etaPlus, etaMinus, deltaMin, deltaMax, weightDecay and the factor
+     * applied to the weight changes (first step). */
+    void (*rprop)(FTYPE* weights, RPROP::State* state, FTYPE* dEdw, int n, const FTYPE* params);
+    /** same as rprop with single precision step sizes */
+    void (*rpropCompact)(FTYPE* weights, RPROP::CompactState* state, FTYPE* dEdw, int n, const FTYPE* params);
+    /** y[r] = sum_c matrix[r*cols+c] * x[c] for r=0..rows-1, with 8 bit
+     * integer matrix and vector and 32 bit integer sums (see QuantizedNet) */
+    void (*gemvInt8)(const signed char* matrix, const signed char* x, int* y, int rows, int cols);
+  };
+  
+  /** returns the kernel table that has been selected for this cpu. The 
+   * selection can be overridden by setting the environment variable 
+   * NPP2_KERNELS to the name of a (supported) variant. */
+  const KernelTable& kernels();
+  
+  /** returns the name of the selected kernel variant (e.g. "sse2", "avx2", 
+   * "avx512f" or "generic" on non-x86 platforms). */
+  const char* getKernelVariant();
+  
+}
+
+#endif
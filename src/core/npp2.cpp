@@ -55,6 +55,7 @@
 
 #include <fstream>
 #include <vector>
+#include <algorithm>
 #include "Registry.h"
 #include "BasicLayerTypes.h"
 #include "FullyConnectedLayer.h"
@@ -80,7 +81,10 @@ void Net::forwardPass(const FTYPE *inVec, FTYPE *outVec, int copy)
          sizeof(FTYPE) * topoData.inCount);
   
   for (int i=1; i < topoData.layerCount; i++) {             // layer-wise propagation
+    if (updateSchedule) awaitUpdate(i, copy);               // the weights may still be updated after the previous mini-batch
+    NPP2_PROFILE_BEGIN_PHASE(start, profile, copy);
     layers[i]->forwardPass(&(layers[i-1]->out[copy*(layers[i-1]->numUnits+1)]), copy);
+    NPP2_PROFILE_END_PHASE(start, profile, copy, i, PROFILE_FORWARD);
   }
   
   memcpy(outVec,                                            // copy the calculated ouptut from the last layer to the right part of the output vector
@@ -88,8 +92,196 @@ void Net::forwardPass(const FTYPE *inVec, FTYPE *outVec, int copy)
          sizeof(FTYPE) * topoData.outCount);
 }
 
+// forward propagation of a sparse input given by its non-zero entries. the 
+// first hidden layer is propagated with the sparse representation, all other
+// layers as usual. the input layer nevertheless holds the complete input.
+void Net::forwardPass(const int *activeIndex, const FTYPE *activeValue, int numActive, FTYPE *outVec, int copy)
+{
+  assert (topoData.inCount == layers[0]->numUnits && topoData.layerCount > 1);
+  
+  FTYPE* input = &(layers[0]->out[copy*(layers[0]->numUnits+1)+1]);
+  memset(input, 0, sizeof(FTYPE) * topoData.inCount);       // scatter the active inputs into the output of the first layer
+  for (int k=0; k < numActive; k++) {
+    input[activeIndex[k]] = activeValue[k];
+  }
+  
+  if (updateSchedule) awaitUpdate(1, copy);
+  NPP2_PROFILE_BEGIN_PHASE(startSparse, profile, copy);
+  layers[1]->forwardPassSparse(&(layers[0]->out[copy*(layers[0]->numUnits+1)]), activeIndex, activeValue, numActive, copy);
+  NPP2_PROFILE_END_PHASE(startSparse, profile, copy, 1, PROFILE_FORWARD);
+  for (int i=2; i < topoData.layerCount; i++) {             // layer-wise propagation
+    if (updateSchedule) awaitUpdate(i, copy);
+    NPP2_PROFILE_BEGIN_PHASE(start, profile, copy);
+    layers[i]->forwardPass(&(layers[i-1]->out[copy*(layers[i-1]->numUnits+1)]), copy);
+    NPP2_PROFILE_END_PHASE(start, profile, copy, i, PROFILE_FORWARD);
+  }
+  
+  memcpy(outVec,
+         &(layers[topoData.layerCount-1]->out[copy*(topoData.outCount+1)+1]),
+         sizeof(FTYPE) * topoData.outCount);
+}
+
+// the threads of the latency mode and the pattern they are working on. 
+// between two patterns the threads sleep on a condition variable; only the
+// layers of a pattern are synchronized with the spin barrier.
+struct Net::LatencyPool {
+  struct Thread {
+    Net* net;
+    int part;
+    pthread_t threadId;
+  };
+  std::vector<Thread> threads;  ///< threads 1..numParts-1, the calling thread is part 0
+  SpinBarrier barrier;          ///< synchronizes all parts after each layer
+  int numParts;
+  pthread_mutex_t mutex;
+  pthread_cond_t started;       ///< signaled when a pattern has been started or the threads are stopped
+  unsigned int pattern;         ///< number of patterns started so far
+  int copy;                     ///< copy to propagate
+  bool stop;                    ///< set to terminate the threads
+  
+  LatencyPool(int numParts) : threads(numParts-1), barrier(numParts), numParts(numParts), pattern(0), copy(0), stop(false) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&started, 0);
+  }
+  ~LatencyPool() {
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&started);
+  }
+};
+
+void* Net::latencyWorker(void* arg)
+{
+  LatencyPool::Thread* thread = (LatencyPool::Thread*) arg;
+  LatencyPool* pool = thread->net->latencyPool;
+  unsigned int done = 0;
+  while (true) {
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->pattern == done && !pool->stop) {  // sleep until the next pattern
+      pthread_cond_wait(&pool->started, &pool->mutex);
+    }
+    bool stop = pool->stop;
+    int copy = pool->copy;
+    done = pool->pattern;
+    pthread_mutex_unlock(&pool->mutex);
+    if (stop) break;
+    thread->net->propagateParts(thread->part, pool->numParts, copy);
+  }
+  return 0;
+}
+
+void Net::propagateParts(int part, int numParts, int copy)
+{
+  for (int i=1; i < topoData.layerCount; i++) {
+    FTYPE* input = &(layers[i-1]->out[copy*(layers[i-1]->numUnits+1)]);
+    if (part == 0) {             // the calling thread measures the time of the complete layer
+      NPP2_PROFILE_BEGIN_PHASE(start, profile, copy);
+      layers[i]->forwardPassPart(input, part, numParts, copy);
+      latencyPool->barrier.wait();
+      NPP2_PROFILE_END_PHASE(start, profile, copy, i, PROFILE_FORWARD);
+    }
+    else {
+      layers[i]->forwardPassPart(input, part, numParts, copy);
+      latencyPool->barrier.wait(); // all parts of this layer are needed by the next one
+    }
+  }
+}
+
+void Net::forwardPassLatency(const FTYPE *inVec, FTYPE *outVec, int copy)
+{
+  if (!latencyPool) {
+    forwardPass(inVec, outVec, copy);
+    return;
+  }
+  memcpy(&(layers[0]->out[copy*(layers[0]->numUnits+1)+1]), inVec, sizeof(FTYPE) * topoData.inCount);
+  
+  pthread_mutex_lock(&latencyPool->mutex);   // start the other threads
+  latencyPool->copy = copy;
+  latencyPool->pattern++;
+  pthread_cond_broadcast(&latencyPool->started);
+  pthread_mutex_unlock(&latencyPool->mutex);
+  propagateParts(0, latencyPool->numParts, copy); // returns after the barrier of the last layer, so all parts are done
+  
+  memcpy(outVec, &(layers[topoData.layerCount-1]->out[copy*(topoData.outCount+1)+1]), sizeof(FTYPE) * topoData.outCount);
+}
+
+// the batch is propagated through three rows of buffers: the outputs of the 
+// previous layer, the outputs of the present layer and its net inputs.
+void Net::forwardPassBatch(const FTYPE *inVecs, FTYPE *outVecs, int numPatterns)
+{
+  assert (topoData.inCount == layers[0]->numUnits);
+  
+  size_t rowSize = 0;
+  for (int i=0; i < topoData.layerCount; i++) {
+    rowSize = (size_t) layers[i]->numUnits+1 > rowSize ? (size_t) layers[i]->numUnits+1 : rowSize;
+  }
+  size_t size = rowSize * numPatterns;
+  if (batchBuffer.size() < 3*size) {
+    batchBuffer.resize(3*size);
+  }
+  FTYPE* input = &batchBuffer[0];
+  FTYPE* output = &batchBuffer[size];
+  FTYPE* netin = &batchBuffer[2*size];
+  
+  for (int p=0; p < numPatterns; p++) {
+    input[p*(topoData.inCount+1)] = 1.;         // bias
+    memcpy(&input[p*(topoData.inCount+1)+1], &inVecs[p*topoData.inCount], sizeof(FTYPE) * topoData.inCount);
+  }
+  for (int i=1; i < topoData.layerCount; i++) {
+    NPP2_PROFILE_BEGIN_PHASE(start, profile, 0);
+    layers[i]->forwardPassBatch(input, netin, output, numPatterns);
+    NPP2_PROFILE_END_PHASE(start, profile, 0, i, PROFILE_FORWARD);
+    std::swap(input, output);                   // the outputs are the input of the next layer
+  }
+  for (int p=0; p < numPatterns; p++) {
+    memcpy(&outVecs[p*topoData.outCount], &input[p*(topoData.outCount+1)+1], sizeof(FTYPE) * topoData.outCount);
+  }
+}
+
+void Net::setLatencyThreads(int numThreads)
+{
+  if (latencyPool) {             // stop the present threads
+    pthread_mutex_lock(&latencyPool->mutex);
+    latencyPool->stop = true;
+    pthread_cond_broadcast(&latencyPool->started);
+    pthread_mutex_unlock(&latencyPool->mutex);
+    for (unsigned int i=0; i < latencyPool->threads.size(); i++) {
+      pthread_join(latencyPool->threads[i].threadId, 0);
+    }
+    delete latencyPool;
+    latencyPool = 0;
+  }
+  if (numThreads <= 1) return;
+  
+  for (unsigned int i=0; i < layers.size(); i++) {
+    layers[i]->preparePartition(numThreads);
+  }
+  latencyPool = new LatencyPool(numThreads);
+  for (int t=1; t < numThreads; t++) {
+    LatencyPool::Thread& thread = latencyPool->threads[t-1];
+    thread.net = this;
+    thread.part = t;
+    if (pthread_create(&thread.threadId, NULL, latencyWorker, (void*) &thread)) {
+      cerr << "Could not start thread " << t << " of the latency mode." << endl;
+      exit(1);
+    }
+  }
+}
+
+int Net::getLatencyThreads() const
+{
+  return latencyPool ? latencyPool->numParts : 1;
+}
+
 // backward propagation function for calculating partial derivatives. the parameter 'copy' specifies the copy of the network to work on.
 void Net::backwardPass(const FTYPE *dedout, FTYPE *dedin, int copy)
+{
+  backwardPass(dedout, dedin, 0, 0, 0, copy);
+}
+
+// same as above, but if activeIndex is given, the first hidden layer is 
+// back-propagated with the sparse representation of the input that has been
+// used in the forward pass.
+void Net::backwardPass(const FTYPE *dedout, FTYPE *dedin, const int *activeIndex, const FTYPE *activeValue, int numActive, int copy)
 {
   assert ( topoData.outCount == layers[topoData.layerCount-1]->numUnits);
   
@@ -97,20 +289,171 @@ void Net::backwardPass(const FTYPE *dedout, FTYPE *dedin, int copy)
          dedout, 
          sizeof(FTYPE) * topoData.outCount);
   
-  for (int i=topoData.layerCount-1; i > 0; i--) {          // back propagate error through the layers
-    layers[i]->backwardPass(&(layers[i-1]->dEdo[copy*(layers[i-1]->numUnits+1)+1]), copy);
+  int lowest = 1;                                           // without dedin, back-propagation can stop at the lowest trainable layer, as the frozen layers below need no derivatives
+  if (!dedin) {
+    while (lowest < topoData.layerCount-1 && !layers[lowest]->trainable) lowest++;
   }
   
-  layers[0]->backwardPass(dedin, copy);                     // in input layer write derivatives into given dedin argument. there is no copy of dedin at layer zero, like there is with in_vec for the input
+  for (int i=topoData.layerCount-1; i >= lowest; i--) {     // back propagate error through the layers
+    FTYPE* dedoutPrev = i > lowest || dedin ? &(layers[i-1]->dEdo[copy*(layers[i-1]->numUnits+1)+1]) : 0; // the lowest visited layer only needs to calculate derivatives for the layer below, if the caller asked for dedin
+    NPP2_PROFILE_BEGIN_PHASE(start, profile, copy);
+    if (i == 1 && activeIndex) {
+      layers[i]->backwardPassSparse(dedoutPrev, activeIndex, activeValue, numActive, copy);
+    }
+    else {
+      layers[i]->backwardPass(dedoutPrev, copy);
+    }
+    NPP2_PROFILE_END_PHASE(start, profile, copy, i, PROFILE_BACKWARD);
+  }
+  
+  if (dedin) {
+    layers[0]->backwardPass(dedin, copy);                   // in input layer write derivatives into given dedin argument. there is no copy of dedin at layer zero, like there is with in_vec for the input
+  }
 }
 
 void Net::updateWeights(int numThreads) 
 {
+  if (gradientReducer) { // the derivatives of all layers have to be complete before handing them to the reducer
+    std::vector<bool> reduced(topoData.layerCount, false);
+    for (int i=1; i < topoData.layerCount; i++) {
+      if (layers[i]->trainable) {
+        NPP2_PROFILE_BEGIN_PHASE(start, profile, 0);
+        reduced[i] = layers[i]->reduceGradients(numThreads);
+        NPP2_PROFILE_END_PHASE(start, profile, 0, i, PROFILE_REDUCE);
+      }
+    }
+    gradientReducer->reduce(*this);
+    for (int i=1; i < topoData.layerCount; i++) {
+      if (layers[i]->trainable) {
+        NPP2_PROFILE_BEGIN_PHASE(startUpdate, profile, 0);
+        layers[i]->updateWeights(reduced[i] ? 0 : numThreads);
+        NPP2_PROFILE_END_PHASE(startUpdate, profile, 0, i, PROFILE_UPDATE);
+      }
+      publishUpdate(i);
+    }
+    return;
+  }
+  
   for (int i=1; i < topoData.layerCount; i++) {// loop through all layers and
-    layers[i]->updateWeights(numThreads);      // tell them to update their weights
+    if (layers[i]->trainable) {                // tell the trainable ones to update their weights
+      NPP2_PROFILE_BEGIN_PHASE(start, profile, 0);
+      bool reduced = layers[i]->reduceGradients(numThreads); // sum up the derivatives of all copies first, if the layer supports it
+      NPP2_PROFILE_END_PHASE(start, profile, 0, i, PROFILE_REDUCE);
+      NPP2_PROFILE_BEGIN_PHASE(startUpdate, profile, 0);
+      layers[i]->updateWeights(reduced ? 0 : numThreads);      
+      NPP2_PROFILE_END_PHASE(startUpdate, profile, 0, i, PROFILE_UPDATE);
+    }
+    publishUpdate(i);                          // the workers of the next mini-batch may propagate through this layer now
+  }
+}
+
+// the number of updates applied to each layer during the present epoch and
+// the number of updates each worker has to wait for. a worker only waits 
+// for the first pattern of a mini-batch; afterwards all layers are up to 
+// date.
+struct Net::UpdateSchedule {
+  pthread_mutex_t mutex;
+  pthread_cond_t updated;       ///< signaled when a layer has been updated
+  std::vector<int> version;     ///< number of updates of each layer
+  std::vector<int> await;       ///< version of the weights needed by the worker of each copy, 0 if none
+  int target;                   ///< version of the present update
+  
+  UpdateSchedule() : target(0) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&updated, 0);
+  }
+  ~UpdateSchedule() {
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&updated);
+  }
+};
+
+void Net::setOverlapUpdates(bool overlap)
+{
+  if (overlap && !updateSchedule) {
+    updateSchedule = new UpdateSchedule();
+  }
+  else if (!overlap && updateSchedule) {
+    delete updateSchedule;
+    updateSchedule = 0;
+  }
+}
+
+void Net::awaitUpdate(int layer, int copy)
+{
+  if (copy >= (int) updateSchedule->await.size() || !updateSchedule->await[copy]) return; // set and read by the worker of the copy only
+  pthread_mutex_lock(&updateSchedule->mutex);
+  while (updateSchedule->version[layer] < updateSchedule->await[copy]) {
+    pthread_cond_wait(&updateSchedule->updated, &updateSchedule->mutex);
+  }
+  pthread_mutex_unlock(&updateSchedule->mutex);
+}
+
+void Net::publishUpdate(int layer)
+{
+  if (!updateSchedule || layer >= (int) updateSchedule->version.size()) return;
+  pthread_mutex_lock(&updateSchedule->mutex);
+  updateSchedule->version[layer] = updateSchedule->target;
+  pthread_cond_broadcast(&updateSchedule->updated);
+  pthread_mutex_unlock(&updateSchedule->mutex);
+}
+
+// the number of blocks of the present mini-batch that have been added to 
+// copy 0 and the sum of their errors. a worker that has finished a block 
+// waits for all blocks before it, so the sums do not depend on the threads.
+struct Net::BlockMerge {
+  pthread_mutex_t mutex;
+  pthread_cond_t ready;       ///< signaled when a block has been merged
+  int blockSize;
+  int merged;                   ///< number of merged blocks
+  double tss;                   ///< error of the merged blocks
+  
+  BlockMerge(int blockSize) : blockSize(blockSize), merged(0), tss(0.) {
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&ready, 0);
+  }
+  ~BlockMerge() {
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&ready);
+  }
+};
+
+void Net::setDeterministic(int blockSize)
+{
+  if (blockMerge) {
+    delete blockMerge;
+    blockMerge = 0;
+  }
+  if (blockSize > 0) {
+    blockMerge = new BlockMerge(blockSize);
   }
 }
 
+int Net::getDeterministic() const
+{
+  return blockMerge ? blockMerge->blockSize : 0;
+}
+
+void Net::mergeBlock(WorkerData* arg, int block)
+{
+  pthread_mutex_lock(&blockMerge->mutex);
+  while (blockMerge->merged < block) {
+    pthread_cond_wait(&blockMerge->ready, &blockMerge->mutex);
+  }
+  pthread_mutex_unlock(&blockMerge->mutex);
+  
+  for (int i=1; i < topoData.layerCount; i++) { // only this worker may change copy 0 now
+    layers[i]->mergeGradients(arg->thread+1);
+  }
+  blockMerge->tss += arg->tss;
+  arg->tss = 0.;
+  
+  pthread_mutex_lock(&blockMerge->mutex);
+  blockMerge->merged++;
+  pthread_cond_broadcast(&blockMerge->ready);
+  pthread_mutex_unlock(&blockMerge->mutex);
+}
+
 #ifdef __APPLE__
 #pragma mark -
 #pragma mark Network creation and initialization
@@ -163,6 +506,7 @@ void Net::addLayer(BasicLayerType* layer)
   outVec = new FTYPE [topoData.outCount * (numCopies+1)];
   
   topoData.layerCount+=1;
+  profile->resize(topoData.layerCount, numCopies);
 }
 
 
@@ -204,6 +548,19 @@ void Net::createLayers(int numLayers, int *layerUnits, int numCopies) throw (NPP
   topoData.inCount = layerUnits[0];
   topoData.outCount = layerUnits[numLayers-1];
   
+  // reserve a single chunk for the activations and weight structures of 
+  // all layers (plus the alignment of each buffer)
+  int numVariables = updateFunction ? updateFunction->getNumVariables() : 2;   // rprop
+  int numDelta = updateFunction && updateFunction->usesDelta() ? 1 : 0;
+  size_t values = 0;
+  for (int i=0; i < numLayers; i++) {
+    values += (size_t) 4 * (layerUnits[i]+1) * (numCopies+1);
+    if (i > 0) {
+      values += (size_t) (layerUnits[i-1]+1) * layerUnits[i] * (1 + numDelta + (numCopies+1) + numVariables);
+    }
+  }
+  arena->reserve(sizeof(FTYPE) * values + 8 * Arena::ALIGNMENT * numLayers);
+  
   int unitid = 1;
   
   layers.resize(numLayers, 0);
@@ -223,6 +580,7 @@ void Net::createLayers(int numLayers, int *layerUnits, int numCopies) throw (NPP
   outVec = new FTYPE [topoData.outCount * (numCopies+1)];
   
   if (numCopies > 0) workerData = new WorkerData[numCopies];
+  profile->resize(topoData.layerCount, numCopies);
   
 }
 
@@ -236,8 +594,36 @@ void Net::createLayers(const std::vector<LayerArguments*>& netSpecification, int
     cerr << "Can't create layers - network already defined" << endl;
     throw NPPException("Error creating layers: network already defined."); 
   }
+  // reserve a single chunk for the buffers of all layers (plus the alignment
+  // of each buffer). individually connected layers keep their weights in
+  // std::vectors outside the arena; reserving too much only costs address 
+  // space, as the pages of a chunk are not touched before being used.
+  MemoryReport estimate = estimateMemory(netSpecification, numCopies, updateFunction);
+  arena->reserve(estimate.getTotal() - estimate.netBytes - estimate.getTotal(MEMORY_CONNECTIONS) + 
+                 8 * Arena::ALIGNMENT * netSpecification.size());
+  
   this->numCopies = numCopies;
+  constructLayers(netSpecification);
   
+  topoData.inCount = layers[0]->numUnits;
+  topoData.outCount = layers[topoData.layerCount-1]->numUnits;
+  
+  inVec = new FTYPE [topoData.inCount * (numCopies+1)];
+  outVec = new FTYPE [topoData.outCount * (numCopies+1)];
+  
+  if (numCopies > 0) workerData = new WorkerData[numCopies];
+  profile->resize(topoData.layerCount, numCopies);
+  
+  if (cleanUpArgs) {
+    for (unsigned int i=0; i < netSpecification.size(); i++) {
+      delete netSpecification[i];
+    }
+  }
+}
+
+// constructs the layers of a net specification by means of the layer factory
+void Net::constructLayers(const std::vector<LayerArguments*>& netSpecification) throw (NPPException)
+{
   topoData.layerCount = netSpecification.size();
   layers.resize(topoData.layerCount, 0);
   
@@ -266,20 +652,6 @@ void Net::createLayers(const std::vector<LayerArguments*>& netSpecification, int
   layers[0]->act_f = linear;
   layers[0]->deriv_f = linear_deriv;
   layers[0]->actId = NPP_LINEAR;
-  
-  topoData.inCount = layers[0]->numUnits;
-  topoData.outCount = layers[topoData.layerCount-1]->numUnits;
-  
-  inVec = new FTYPE [topoData.inCount * (numCopies+1)];
-  outVec = new FTYPE [topoData.outCount * (numCopies+1)];
-  
-  if (numCopies > 0) workerData = new WorkerData[numCopies];
-  
-  if (cleanUpArgs) {
-    for (unsigned int i=0; i < netSpecification.size(); i++) {
-      delete netSpecification[i];
-    }
-  }
 }
 
 
@@ -296,6 +668,49 @@ void Net::setLayerActivationFunction(int layerNo, int actId)
 }
 
 
+void Net::setLayerTrainable(int layerNo, bool trainable)
+{
+  if (layerNo < 0 || layerNo >= topoData.layerCount) {
+    cerr << "Should freeze or unfreeze layer " << layerNo
+         << ". This net only has " << topoData.layerCount << " layers." << endl;
+    exit(1);
+  }
+  layers[layerNo]->setTrainable(trainable);
+}
+
+
+void Net::setNumCopies(int numCopies)
+{
+  if (numCopies < 0) {
+    cerr << "Can't set the number of copies to " << numCopies << "." << endl;
+    exit(1);
+  }
+  if (numCopies == this->numCopies) return;
+  
+  for (unsigned int i=0; i < layers.size(); i++) {
+    layers[i]->setNumCopies(numCopies);
+  }
+  if (inVec) {   // keep copy 0 of the input and output vectors
+    FTYPE* resized = new FTYPE [topoData.inCount * (numCopies+1)];
+    memcpy(resized, inVec, sizeof(FTYPE) * topoData.inCount);
+    delete [] inVec;
+    inVec = resized;
+    
+    resized = new FTYPE [topoData.outCount * (numCopies+1)];
+    memcpy(resized, outVec, sizeof(FTYPE) * topoData.outCount);
+    delete [] outVec;
+    outVec = resized;
+  }
+  if (workerData) {
+    delete [] workerData;
+  }
+  workerData = numCopies > 0 ? new WorkerData[numCopies] : 0;
+  
+  this->numCopies = numCopies;
+  profile->resize(topoData.layerCount, numCopies);
+}
+
+
 void Net::setUpdateFunc(int typ, FTYPE *params)
 {
   for (int j=0; j < MAX_PARAMS; j++) {
@@ -304,13 +719,14 @@ void Net::setUpdateFunc(int typ, FTYPE *params)
   if (updateFunction) {
     delete updateFunction;
   }
-  if (typ == 0)  { // RPROP
-    updateFunction = new RPROP(params);
+  if (typ == NPP_RPROP || typ == NPP_RPROP_COMPACT)  {
+    updateFunction = new RPROP(params, typ == NPP_RPROP_COMPACT);
   }
   else {
     cerr << "Update function " << typ << " unknown." << endl;
     exit(1);
   }
+  updateType = typ;
   if (layers.size()) {
     for (int i=1; i < topoData.layerCount; i++) {
       layers[i]->setUpdateFunction(updateFunction);
@@ -323,6 +739,9 @@ void Net::connectLayers()
 {
   for (int i=1; i < topoData.layerCount; i++) {
     layers[i]->connectLayer(layers[i-1]); // connects the layer to the PREVIOUS layer
+    if (latencyPool) {
+      layers[i]->preparePartition(latencyPool->numParts);
+    }
   }
 }
 
@@ -342,13 +761,17 @@ void Net::deleteStructure()
   if (inVec) {
     delete [] inVec; inVec = 0;
     delete [] outVec; outVec = 0;
-    
-    for (int i=0; i < topoData.layerCount; i++) {
-      if (layers[i]) delete layers[i];  // maybe only partially initialized in case of an error
-    }
-    layers.clear();
-
   }
+  arena->beginClear();                // the layers do not return their buffers one by one
+  for (unsigned int i=0; i < layers.size(); i++) {
+    if (layers[i]) delete layers[i];  // maybe only partially initialized in case of an error
+  }
+  layers.clear();
+  arena->clear();                     // releases the buffers of all layers at once
+  if (workerData) {
+    delete [] workerData; workerData = 0;
+  }
+  
   if (updateFunction) {
     delete updateFunction;
     updateFunction = 0;
@@ -357,10 +780,15 @@ void Net::deleteStructure()
 
 Net::~Net() 
 {
+  setLatencyThreads(1);
+  setOverlapUpdates(false);
+  setDeterministic(0);
   deleteStructure();
+  delete profile;
+  delete arena;
 }
 
-Net::Net(int numCopies) : inVec(0), outVec(0), layers(0), updateFunction(0), numCopies(numCopies), workerData(0)
+Net::Net(int numCopies) : inVec(0), outVec(0), layers(0), updateType(NPP_RPROP), updateFunction(0), numCopies(numCopies), profile(new Profile()), arena(new Arena()), structureOnly(false), workerData(0), latencyPool(0), gradientReducer(0), updateSchedule(0), dynamicBlockSize(0), nextPattern(0), blockMerge(0)
 {
   topoData.layerCount = 0;
   topoData.inCount = topoData.outCount = 0;
@@ -379,8 +807,10 @@ double Net::train(const PatternSet* pattern, const ErrorFunction* errorFunction,
 
 double Net::train(const PatternSet* pattern, int threads, bool id, const ErrorFunction* errorFunction, int numMiniBatches)
 {
+  NPP2_PROFILE_RESET(profile);
+  NPP2_PROFILE_ATTACH(profile, 0);              // hardware counters of this (main) thread, working on copy 0
   
-  if (threads <= 1) {  // simple version for single-threaded nets
+  if (threads <= 1 && !blockMerge) {  // simple version for single-threaded nets
     double tss=0.;
     int perBatch = pattern->pattern_count / numMiniBatches;
 
@@ -388,42 +818,86 @@ double Net::train(const PatternSet* pattern, int threads, bool id, const ErrorFu
     // times during one iteration over all patterns; once after propagating
     // a (smaller) fraction of the total pattern set.
     for (int batch = 0; batch < numMiniBatches; batch++) { 
+      NPP2_PROFILE_BEGIN(batchStart);
       for (int i=perBatch * batch; i < pattern->pattern_count && (i < perBatch*(batch+1) || batch == numMiniBatches-1); i++) {  // process remainder in last batch
-        forwardPass(pattern->input[i], outVec); // propagate activation through net
+        const int* activeIndex = pattern->sparse_index ? pattern->sparse_index[i] : 0; // use the sparse representation of the input, if available
+        if (activeIndex) {
+          forwardPass(activeIndex, pattern->sparse_value[i], pattern->sparse_count[i], outVec);
+        }
+        else {
+          forwardPass(pattern->input[i], outVec); // propagate activation through net
+        }
     
         FTYPE* target = id ? pattern->input[i] : pattern->target[i]; // the 'id' option can be used when training an auto-encoder; id -> target == input
       
-        for (int d=0; d < topoData.outCount; d++) {
-          tss += errorFunction->error(outVec[d], target[d]);
-          outVec[d] = errorFunction->deriv(outVec[d], target[d]);    // just calculate the partial derviative for the output: out_vec := dE/do = (o-t) 
-        }
-        backwardPass(outVec, inVec);            // back-propagate error-derivatives 
+        tss = errorFunction->errorAndDeriv(outVec, target, outVec, topoData.outCount, tss); // also replaces the output by the partial derviative: out_vec := dE/do = (o-t) 
+        backwardPass(outVec, 0, activeIndex, activeIndex ? pattern->sparse_value[i] : 0, activeIndex ? pattern->sparse_count[i] : 0); // back-propagate error-derivatives (derivatives w.r.t. the input are not needed) 
       }
       updateWeights();                          // finally update the weights
+      NPP2_PROFILE_SPAN(batchStart, profile, 0, TRACE_MINIBATCH);
     }
+    NPP2_PROFILE_DETACH(profile, 0);
     return tss;
   }
   else { // this is a threaded version that works on multiple copies of the net
+    threads = threads < 1 ? 1 : threads;  // the deterministic mode always uses the copies 1..threads
     if (threads > numCopies) {
       cerr << "Asked to start " << threads << " threads but only have " 
-           << numCopies << " copies of network. Not possible." << endl; 
+           << numCopies << " copies of network. Not possible (see Net::setNumCopies)." << endl; 
+      NPP2_PROFILE_DETACH(profile, 0);
       return -1.;
     }
+    for (int i=1; blockMerge && i < topoData.layerCount; i++) {
+      if (!layers[i]->mergeGradients(0)) {
+        cerr << "Layer " << i << " does not support the deterministic mode (see Net::setDeterministic)." << endl;
+        NPP2_PROFILE_DETACH(profile, 0);
+        return -1.;
+      }
+    }
 
     double tss = 0.;
+    bool overlap = updateSchedule && numMiniBatches > 1; // update the weights while the workers start with the next mini-batch
+    if (overlap) {
+      updateSchedule->version.assign(topoData.layerCount, 0);
+      updateSchedule->await.assign(numCopies+1, 0);
+    }
     for (int batch = 0; batch < numMiniBatches; batch++) {
+      NPP2_PROFILE_BEGIN(batchStart);
+      nextPattern = (pattern->pattern_count / numMiniBatches) * batch; // first pattern of this mini-batch, if the workers take blocks dynamically
+      if (blockMerge) {
+        blockMerge->merged = 0;
+        blockMerge->tss = 0.;
+      }
       for (int i=0; i < threads; i++) { // prepare the data for the workers that'll work in parallel, each on a fraction of the training patterns 
         workerData[i] = WorkerData(this, errorFunction, pattern, i, threads, id, batch, numMiniBatches);
-        if (i==threads-1) trainWorker(&workerData[i]); // last fraction will be done by this (main) thread
+        workerData[i].awaitUpdate = overlap && batch > 0 && i < threads-1;
+        if (i==threads-1) {
+          if (overlap && batch > 0) {     // the other workers are already running: update the weights of the previous mini-batch first
+            updateSchedule->target = batch;
+            updateWeights(blockMerge ? 0 : threads);
+          }
+          trainWorker(&workerData[i]);    // last fraction will be done by this (main) thread
+        }
         else pthread_create(&(workerData[i].threadId), 0, Net::trainWorker, (void*) &workerData[i]); // start thread for each worker
       }
       for (int i=0; i < threads-1; i++) { // now wait for all threads to finish
         pthread_join(workerData[i].threadId, 0);
         tss += workerData[i].tss;
       }
+      NPP2_PROFILE_JOINED(profile, 1, threads); // idle time of the workers that finished early
       tss+=workerData[threads-1].tss;     // don't forget the error accumulated in this (main) thread
-      updateWeights(threads);             // finally update the weights
+      if (blockMerge) {
+        tss += blockMerge->tss;           // the errors of the blocks, summed up in their order. the workers' errors are zero
+      }
+      if (!overlap || batch == numMiniBatches-1) {
+        updateWeights(blockMerge ? 0 : threads); // finally update the weights. in the deterministic mode, the derivatives are already in copy 0
+      }
+      NPP2_PROFILE_SPAN(batchStart, profile, 0, TRACE_MINIBATCH);
     }
+    if (overlap) {
+      updateSchedule->await.assign(numCopies+1, 0); // workers without patterns did not reset their entry
+    }
+    NPP2_PROFILE_DETACH(profile, 0);
     return tss;
   }
 }
@@ -435,25 +909,68 @@ double Net::train(const PatternSet* pattern, int threads, bool id, const ErrorFu
 // b) it only processes a fraction of the training pattern; therefore the more complicated loop over the pattern.
 void Net::trainWorker(WorkerData* arg)
 {
-  int pos = (arg->thread+1) * topoData.outCount;
+  NPP2_PROFILE_ATTACH(profile, arg->thread+1);
+  NPP2_PROFILE_BEGIN(workerStart);
   int perBatch = arg->pattern->pattern_count / arg->numMiniBatches;
+  if (arg->awaitUpdate) {       // wait for the update of the previous mini-batch at each layer of the first pattern
+    updateSchedule->await[arg->thread+1] = arg->batch;
+  }
 
-  for (int i=perBatch * arg->batch + arg->thread; 
-       i < arg->pattern->pattern_count && (i < perBatch*(arg->batch+1)+arg->thread || arg->batch == arg->numMiniBatches-1); 
-       i+= arg->numThreads) {
-    forwardPass(arg->pattern->input[i], &outVec[pos], arg->thread+1);
-    
-    FTYPE* target = arg->trainId ? arg->pattern->input[i] : arg->pattern->target[i];
-    
-    for (int d=0; d < topoData.outCount; d++) {
-      arg->tss += arg->errorFunction->error(outVec[pos+d], target[d]); 
-      outVec[pos+d] = arg->errorFunction->deriv(outVec[pos+d], target[d]); 
+  if (blockMerge) {             // take the fixed blocks from the shared counter and merge them in their order
+    int begin = perBatch * arg->batch;
+    int end = arg->batch == arg->numMiniBatches-1 ? arg->pattern->pattern_count : perBatch*(arg->batch+1);
+    int first;
+    while ((first = __sync_fetch_and_add(&nextPattern, blockMerge->blockSize)) < end) {
+      for (int i=first; i < end && i < first+blockMerge->blockSize; i++) {
+        trainPattern(arg, i);
+      }
+      mergeBlock(arg, (first-begin) / blockMerge->blockSize);
+    }
+  }
+  else if (dynamicBlockSize > 0) { // take blocks of patterns from the shared counter until the mini-batch is done
+    int end = arg->batch == arg->numMiniBatches-1 ? arg->pattern->pattern_count : perBatch*(arg->batch+1);
+    int first;
+    while ((first = __sync_fetch_and_add(&nextPattern, dynamicBlockSize)) < end) {
+      for (int i=first; i < end && i < first+dynamicBlockSize; i++) {
+        trainPattern(arg, i);
+      }
+    }
+  }
+  else {
+    for (int i=perBatch * arg->batch + arg->thread; 
+         i < arg->pattern->pattern_count && (i < perBatch*(arg->batch+1)+arg->thread || arg->batch == arg->numMiniBatches-1); 
+         i+= arg->numThreads) {
+      trainPattern(arg, i);
     }
-    backwardPass(&outVec[pos], &inVec[pos], arg->thread+1);
   }
+  NPP2_PROFILE_SPAN(workerStart, profile, arg->thread+1, TRACE_WORKER);
+  NPP2_PROFILE_FINISHED(profile, arg->thread+1);
+  NPP2_PROFILE_DETACH(profile, arg->thread+1);
 }
 
 
+// propagates and back-propagates the i-th pattern on the copy of the worker
+void Net::trainPattern(WorkerData* arg, int i)
+{
+  int pos = (arg->thread+1) * topoData.outCount;
+  const int* activeIndex = arg->pattern->sparse_index ? arg->pattern->sparse_index[i] : 0;
+  if (activeIndex) {
+    forwardPass(activeIndex, arg->pattern->sparse_value[i], arg->pattern->sparse_count[i], &outVec[pos], arg->thread+1);
+  }
+  else {
+    forwardPass(arg->pattern->input[i], &outVec[pos], arg->thread+1);
+  }
+  if (arg->awaitUpdate) {       // all layers are up to date now
+    updateSchedule->await[arg->thread+1] = 0;
+    arg->awaitUpdate = false;
+  }
+  
+  FTYPE* target = arg->trainId ? arg->pattern->input[i] : arg->pattern->target[i];
+  
+  arg->tss = arg->errorFunction->errorAndDeriv(&outVec[pos], target, &outVec[pos], topoData.outCount, arg->tss);
+  backwardPass(&outVec[pos], 0, activeIndex, activeIndex ? arg->pattern->sparse_value[i] : 0, activeIndex ? arg->pattern->sparse_count[i] : 0, arg->thread+1);
+}
+
 // static function to be called by pthread create. then send's 
 // the thread back to the object's train method
 void* Net::trainWorker(void* arg)
@@ -473,12 +990,20 @@ Error Net::test(const PatternSet* pattern, const ErrorFunction* errorFunction, b
 
 Error Net::test(const PatternSet* pattern, int threads, bool id, const ErrorFunction* errorFunction)
 {
+  NPP2_PROFILE_RESET(profile);
+  
   if (threads <= 1) { // single threaded test version. no backprop, no updates
+    NPP2_PROFILE_ATTACH(profile, 0);
     Error error;
     error.regrError = 0.;
     int countwrong=0;
     for (int i=0; i < pattern->pattern_count; i++) {
-      forwardPass(pattern->input[i], outVec);
+      if (pattern->sparse_index) {
+        forwardPass(pattern->sparse_index[i], pattern->sparse_value[i], pattern->sparse_count[i], outVec);
+      }
+      else {
+        forwardPass(pattern->input[i], outVec);
+      }
       
       FTYPE* target = id ? pattern->input[i] : pattern->target[i];
       
@@ -497,12 +1022,13 @@ Error Net::test(const PatternSet* pattern, int threads, bool id, const ErrorFunc
       if (targetI != outI) countwrong++;
     }
     error.classError = (countwrong / (double)pattern->pattern_count) * 100.;
+    NPP2_PROFILE_DETACH(profile, 0);
     return error;
   }
   else {  // multi threaded version. same logic as in train, but no updates, no backprop.
     if (threads > numCopies) {
       cerr << "Asked to start " << threads << " threads but only have " 
-      << numCopies << " copies of network. Not possible." << endl; 
+      << numCopies << " copies of network. Not possible (see Net::setNumCopies)." << endl; 
       return Error();
     }
     
@@ -519,6 +1045,7 @@ Error Net::test(const PatternSet* pattern, int threads, bool id, const ErrorFunc
       error.regrError += workerData[i].tss;
       countwrong += workerData[i].countwrong;
     }
+    NPP2_PROFILE_JOINED(profile, 1, threads);
     error.regrError+=workerData[threads-1].tss;
     countwrong+=workerData[threads-1].countwrong;
     error.classError = (countwrong / (double)pattern->pattern_count) * 100.;
@@ -529,9 +1056,16 @@ Error Net::test(const PatternSet* pattern, int threads, bool id, const ErrorFunc
 
 void Net::testWorker(WorkerData* arg)
 {
+  NPP2_PROFILE_ATTACH(profile, arg->thread+1);
+  NPP2_PROFILE_BEGIN(workerStart);
   int pos = (arg->thread+1) * topoData.outCount;
   for (int i=arg->thread; i < arg->pattern->pattern_count; i+= arg->numThreads) {
-    forwardPass(arg->pattern->input[i], &outVec[pos], arg->thread+1);
+    if (arg->pattern->sparse_index) {
+      forwardPass(arg->pattern->sparse_index[i], arg->pattern->sparse_value[i], arg->pattern->sparse_count[i], &outVec[pos], arg->thread+1);
+    }
+    else {
+      forwardPass(arg->pattern->input[i], &outVec[pos], arg->thread+1);
+    }
     
     FTYPE* target = arg->trainId ? arg->pattern->input[i] : arg->pattern->target[i];
     
@@ -549,6 +1083,9 @@ void Net::testWorker(WorkerData* arg)
     }
     if (targetI != outI) arg->countwrong++;
   }
+  NPP2_PROFILE_SPAN(workerStart, profile, arg->thread+1, TRACE_WORKER);
+  NPP2_PROFILE_FINISHED(profile, arg->thread+1);
+  NPP2_PROFILE_DETACH(profile, arg->thread+1);
 }
 
 
@@ -577,7 +1114,7 @@ void Net::saveNet(std::ostream& out) const throw (NPPException)
   out << "topology: ";
   for(int l= 0; l<topoData.layerCount; l++)
     out << layers[l]->numUnits << " ";
-  out << endl << "set_update_f " << 0 << " "; //update_id << " ";
+  out << endl << "set_update_f " << updateType << " ";
   for(int i= 0; i<MAX_PARAMS; i++)
     out << updateParams[i] << " ";
   out << endl << endl;
@@ -603,7 +1140,7 @@ void Net::loadNet(std::istream& in) throw (NPPException)
   int define_new;   /* type of network description */
   int mode,no;
   FTYPE range;
-  double p[MAX_PARAMS];
+  double p[MAX_PARAMS] = { 0. };  // parameters missing in the file are 0 (defaults)
   
   if (layers.size()) {
     cerr << "Net defined - OVERWRITING" << endl;
@@ -726,6 +1263,7 @@ void Net::loadNet(std::istream& in) throw (NPPException)
       outVec = new FTYPE [topoData.outCount * (numCopies+1)];
       
       if (numCopies > 0) workerData = new WorkerData[numCopies];
+      profile->resize(topoData.layerCount, numCopies);
         
     } /* if units already defined */
   } /* while read line from file */
@@ -747,6 +1285,81 @@ void Net::loadNet(const std::string& filename) throw (NPPException)
   in.close();
 }
 
+void Net::writeTrace(const std::string& filename) const throw (NPPException)
+{
+  ofstream out (filename.c_str());
+  if (!out) throw NPPException("Could not open trace file for writing.");
+  profile->writeTrace(out);
+  out.close();
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Memory usage
+#endif
+
+int Net::setNetInputInPlace(bool inPlace)
+{
+  int count = 0;
+  for (int l=0; l < topoData.layerCount; l++) {
+    if (layers[l]->setNetInputInPlace(inPlace)) count++;
+  }
+  return count;
+}
+
+int Net::setSharedGradients(int stageSize)
+{
+  int count = 0;
+  for (int l=1; l < topoData.layerCount; l++) {
+    if (layers[l]->setSharedGradients(stageSize) && stageSize > 0) count++;
+  }
+  return count;
+}
+
+MemoryReport Net::memoryReport() const
+{
+  MemoryReport report;
+  report.numCopies = numCopies;
+  report.layers.resize(topoData.layerCount);
+  for (int l=0; l < topoData.layerCount; l++) {
+    layers[l]->getMemoryUsage(report.layers[l]);
+  }
+  if (inVec) {
+    report.netBytes = sizeof(FTYPE) * (topoData.inCount + topoData.outCount) * (numCopies+1);
+  }
+  if (workerData) {
+    report.netBytes += sizeof(WorkerData) * numCopies;
+  }
+  return report;
+}
+
+MemoryReport Net::estimateMemory(const std::vector<LayerArguments*>& netSpecification, int numCopies, const UpdateFunction* updateFunction, bool netInputInPlace, int stageSize) throw (NPPException)
+{
+  Net net(0);
+  net.structureOnly = true;   // the layers only need their sizes
+  net.constructLayers(netSpecification);
+  net.topoData.inCount = net.layers[0]->numUnits;
+  net.topoData.outCount = net.layers[net.topoData.layerCount-1]->numUnits;
+  
+  MemoryReport report;
+  report.numCopies = numCopies;
+  report.estimated = true;
+  report.layers.resize(net.topoData.layerCount);
+  for (int l=0; l < net.topoData.layerCount; l++) {
+    if (l > 0 && stageSize > 0) {
+      net.layers[l]->setSharedGradients(stageSize);  // only records the stage size, as the layers are not connected
+    }
+    net.layers[l]->estimateMemoryUsage(l > 0 ? net.layers[l-1] : 0, numCopies, updateFunction, report.layers[l]);
+    if (netInputInPlace && net.layers[l]->numUnits > 0 && net.layers[l]->canComputeNetInputInPlace()) {
+      report.layers[l].bytes[MEMORY_ACTIVATIONS] -= sizeof(FTYPE) * (net.layers[l]->numUnits+1) * (numCopies+1);
+    }
+  }
+  report.netBytes = sizeof(FTYPE) * (net.topoData.inCount + net.topoData.outCount) * (numCopies+1) + 
+    (numCopies > 0 ? sizeof(WorkerData) * numCopies : 0);
+  return report;
+}
+
 
 
 
@@ -45,6 +45,10 @@
 #include "functions.h"
 #include "NPPException.h"
 #include "BasicLayerTypes.h"
+#include "Profiler.h"
+#include "MemoryReport.h"
+#include "Arena.h"
+#include "SpinBarrier.h"
 
 namespace NPP2 {
 
@@ -58,6 +62,21 @@ namespace NPP2 {
     
 
   enum ActivationType { NPP_LOGISTIC=0, NPP_LINEAR };
+  enum UpdateFunctionType { NPP_RPROP=0, NPP_RPROP_COMPACT };
+  
+  class Net;
+  
+  /** Hook for combining the derivatives of the weights of a net with those
+   * of other nets before the weights are updated, e.g. of the copies of a 
+   * net trained in several processes (DistributedTrainer). */
+  class GradientReducer {
+  public:
+    virtual ~GradientReducer() {}
+    /** called by Net::updateWeights after the derivatives of all copies 
+     * have been summed up in copy 0 of each layer (see 
+     * BasicLayerType::getGradients) and before the weights are changed. */
+    virtual void reduce(Net& net)=0;
+  };
   
   /** Parallel implementation of a multi-layer perceptron providing
    *  the core functionallity of N++2 
@@ -74,10 +93,10 @@ namespace NPP2 {
    *  class controls n copies of the network structure in order to allow
    *  for massive parallelization during batch training procedures. The
    *  number of parallel threads to use is specified during network
-   *  construction (parameter "numCopies") and must not be changed 
-   *  afterwards during the whole lifecycle of the net. Copies and
-   *  parallelization are completely transparent, as long as using
-   *  the built-in methods for testing and training.
+   *  construction (parameter "numCopies") and can only be changed 
+   *  afterwards by calling setNumCopies between training and testing. 
+   *  Copies and parallelization are completely transparent, as long as 
+   *  using the built-in methods for testing and training.
    */
   class Net {
   public:
@@ -109,6 +128,12 @@ namespace NPP2 {
   @{ */    
     
     int getNumCopies() const { return numCopies; } ///< returns the number of internal copies of the connection structure. This is an upper limit to the number of threads that can propagate / backpropagate in parallel.
+    /** changes the number of internal copies of the connection structure,
+     * e.g. in order to adapt a trained net to the cores available on another
+     * host. Re-allocates the per-copy buffers of all layers and of the net
+     * and keeps the weights and the state of the update function. Must not
+     * be called while training or testing. */
+    void setNumCopies(int numCopies);
     
     FTYPE* inVec;     ///< input vector of the neural net. May be filled with the input values before calling the forward propagation method.
     FTYPE* outVec;    ///< output vector of the neural net. This vector holds the output of the network after propagating the activations.
@@ -186,10 +211,24 @@ namespace NPP2 {
      */
     void setLayerActivationFunction(int layerNo, int actId);
     
+    /**
+     * freezes or unfreezes the weights of an individual layer. Frozen layers
+     * keep their weights during training: they neither accumulate the 
+     * derivatives of their weights nor are they updated. Back-propagation
+     * stops at the lowest trainable layer. This can be used to fine-tune only 
+     * the upper layers of a pre-trained network. All layers are trainable
+     * by default.
+     * \param layerNo number of layer that should be modified
+     * \param trainable false to freeze the layer, true to train it again
+     */
+    void setLayerTrainable(int layerNo, bool trainable);
+    
     /**
      * sets the update function that is used during weight update.
-     * \param typ id of the update function (default is NPP::RPOP)
-     * \param params array of parameters used by the update function (at max MAX_PARAMS)
+     * \param typ id of the update function: NPP_RPROP (0) or NPP_RPROP_COMPACT
+     *   (1), which holds the step sizes of RProp in single precision
+     * \param params array of parameters used by the update function (at max MAX_PARAMS).
+     *   For RProp: initial step size, maximal step size and weight decay.
      */
     void setUpdateFunc(int typ, FTYPE *params);
     
@@ -217,21 +256,156 @@ namespace NPP2 {
      */
     void forwardPass(const FTYPE *inVec, FTYPE *outVec, int copy=0);
     
+    /**
+     * propagates one sparse pattern from the input layer to the output layer.
+     * The pattern is given by the indices and values of its non-zero inputs,
+     * all other inputs are zero. The first hidden layer only touches the
+     * weights of the active inputs, if supported by its type 
+     * (see FullyConnectedLayer::forwardPassSparse).
+     * \param[in] activeIndex indices (starting with 0) of the non-zero inputs
+     * \param[in] activeValue values of the non-zero inputs
+     * \param numActive number of non-zero inputs
+     * \param[out] outVec array where the network's output will be copied to. Must match the size of the output layer.
+     * \param copy number of the internal copy of the network structure to be used for propagating.
+     */
+    void forwardPass(const int *activeIndex, const FTYPE *activeValue, int numActive, FTYPE *outVec, int copy=0);
+    
+    /**
+     * propagates one pattern with minimal latency by splitting each large
+     * layer into parts that are propagated in parallel by the threads 
+     * started with setLatencyThreads (latency mode). Fully connected layers 
+     * are split by blocks of rows of their weight matrix, individually 
+     * connected layers by ranges of their target units. The threads 
+     * synchronize with spin barriers after each layer. Without latency 
+     * threads, this is the same as forwardPass. Must not be called from
+     * more than one thread at a time.
+     * \param[in] inVec array of the input values applied to the input neurons.
+     * \param[out] outVec array where the network's output will be copied to.
+     * \param copy number of the internal copy of the network structure to be used.
+     */
+    void forwardPassLatency(const FTYPE *inVec, FTYPE *outVec, int copy=0);
+    /** starts numThreads-1 threads (the calling thread is the first) that
+     * help to propagate single patterns in forwardPassLatency. The threads
+     * sleep between two patterns and spin only while propagating one. 
+     * Passing 1 switches the latency mode off again. Must be called 
+     * after connecting the layers. */
+    void setLatencyThreads(int numThreads);
+    /** returns the number of threads used by forwardPassLatency */
+    int getLatencyThreads() const;
+    
+    /**
+     * propagates numPatterns patterns at once. Each layer propagates the 
+     * complete batch in one step, fully connected layers with a single 
+     * matrix-matrix product instead of one matrix-vector product per pattern.
+     * This is the propagation of the inference server (InferenceServer). The
+     * batch is held in a buffer of the net; layer types without a batched 
+     * propagation use copy 0. Must not be called from more than one thread
+     * at a time.
+     * \param[in] inVecs numPatterns input vectors, stored one after the other.
+     * \param[out] outVecs array where the numPatterns output vectors will be copied to, one after the other.
+     * \param numPatterns number of patterns in the batch
+     */
+    void forwardPassBatch(const FTYPE *inVecs, FTYPE *outVecs, int numPatterns);
+    
     /**
      * back-propagates the derivative of the error from the output layer to the input layer of the
      * neural network. Partial derivatives will be summed at each connection weight until Net::updateWeights is
      * called. 
      * \param[in] dedout array of the partial derivatives of the network error to be applied. Must match the size of the output layer.
-     * \param[out] dedin array where the partial derivatives in respect to the network input will be copied to. Must match the size of the input layer.
+     * \param[out] dedin array where the partial derivatives in respect to the network input will be copied to. Must match the size of the input layer. May be 0, if the caller does not need these derivatives (e.g. during training); in this case the first hidden layer skips calculating them.
      * \param copy number of the internal copy of the network structure to be used for propagating. Must not be larger than the number of copies Net::getNumCopies.
      */
     void backwardPass(const FTYPE *dedout, FTYPE *dedin, int copy=0);
     
+    /**
+     * back-propagates the derivative of the error after a sparse forward pass. 
+     * Pass the same sparse input that has been used in the forward pass; the
+     * first hidden layer then only accumulates the derivatives of the weights
+     * of the active inputs. If activeIndex is 0, this is the same as the dense
+     * backwardPass.
+     */
+    void backwardPass(const FTYPE *dedout, FTYPE *dedin, const int *activeIndex, const FTYPE *activeValue, int numActive, int copy=0);
+    
     /**
      * updates the weights according to the selected update function and the summed partial derivatives of the error.
      * \param numCopies number of copies that have been used during propagation. The accumulated errors will be summed over all these copies.
      */
     void updateWeights(int numCopies=0);
+    
+    /** installs a hook that is called by updateWeights between summing up
+     * the derivatives of the copies and changing the weights. Pass 0 to 
+     * remove the hook. The reducer is not deleted by the net. */
+    void setGradientReducer(GradientReducer* reducer) { gradientReducer = reducer; }
+    /** returns the hook installed with setGradientReducer, or 0 */
+    GradientReducer* getGradientReducer() const { return gradientReducer; }
+
+/*@}*/ 
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Profiling
+#endif
+/** \name Profiling
+  @{ */    
+    
+    /** returns the per-layer, per-phase breakdown of the time spent in the 
+     * last call of train or test. The profile is only filled, if the library
+     * has been compiled with NPP2_PROFILING (cmake option PROFILING), see 
+     * Profile::isEnabled. */
+    const Profile& getProfile() const { return *profile; }
+    /** returns the profile of the net for controlling the recording of a 
+     * timeline (see Profile::startTracing). */
+    Profile& getProfile() { return *profile; }
+    /** writes the timeline recorded since Profile::startTracing to a file 
+     * in the Chrome trace event format. */
+    void writeTrace(const std::string& filename) const throw (NPPException);
+
+/*@}*/ 
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Memory usage
+#endif
+/** \name Memory usage
+  @{ */    
+    
+    /** returns the number of bytes presently allocated by the buffers of
+     * the net, broken down per layer and per kind of buffer. */
+    MemoryReport memoryReport() const;
+    /** predicts the memory a net with the given layers and number of copies
+     * will use after connecting its layers, before anything large has been
+     * allocated. Can be used to choose a number of threads that fits into
+     * the available memory. The layers are constructed in a temporary net
+     * that is never connected; they do not allocate any of their buffers, 
+     * only the layer objects themselves.
+     * \param netSpecification layer arguments as passed to createLayers
+     * \param numCopies number of copies (threads) to predict the memory for
+     * \param updateFunction update function the net will use (0 for RProp 
+     *        with default parameters) 
+     * \param netInputInPlace predict the memory after setNetInputInPlace(true)
+     * \param stageSize predict the memory after setSharedGradients(stageSize) */
+    static MemoryReport estimateMemory(const std::vector<LayerArguments*>& netSpecification, int numCopies=0, const UpdateFunction* updateFunction=0, bool netInputInPlace=false, int stageSize=0) throw (NPPException);
+    /** selects whether the arena holding the buffers of the layers is backed 
+     * by huge pages. Must be called before creating the layers. */
+    void setPageMode(Arena::PageMode mode) { arena->setPageMode(mode); }
+    /** lets all layers, whose activation functions have derivatives that 
+     * only depend on the outputs (logistic, linear and the softmax output 
+     * layer), compute their outputs in place of their net inputs. This 
+     * saves a quarter of the memory of the activations of all copies 
+     * without any recomputation. Must be called after creating (or loading)
+     * the layers; returns the number of layers computing in place. */
+    int setNetInputInPlace(bool inPlace);
+    /** lets the threads accumulate the derivatives of the weights of the 
+     * fully connected layers in a single buffer per layer instead of one 
+     * buffer per copy, which makes the memory of the derivatives almost 
+     * independent of the number of threads. Each copy collects stageSize
+     * patterns and then adds them to the shared buffer, locking one block 
+     * of rows at a time (see FullyConnectedLayer::setSharedGradients). As 
+     * the order of these additions depends on the timing of the threads, 
+     * the results may differ in the last bits from run to run. Pass 0 to 
+     * return to one buffer per copy. Must be called after connecting the 
+     * layers; returns the number of layers using shared derivatives. */
+    int setSharedGradients(int stageSize=32);
+    /** returns the arena holding the buffers of all layers. */
+    const Arena& getArena() const { return *arena; }
 
 /*@}*/ 
 #ifdef __APPLE__
@@ -257,6 +431,40 @@ namespace NPP2 {
      * \param numMiniBatches specifies the number of mini-batches (partition of the training patterns with multiple weight updates per epoch) to be used during training. 
      */
     double train(const PatternSet* pattern, int threads=1, bool id=false, const ErrorFunction* erorrFunction = new SquaredError(), int numMiniBatches=1); ///< training function with an explicit number of threads
+    
+    /** lets the threaded train overlap the weight update after each 
+     * mini-batch with the forward pass of the next one. The workers of the
+     * next mini-batch start right away and wait at each layer until its 
+     * weights have been updated; the layers are updated from the input 
+     * towards the output. Thus, the upper layers are updated while the 
+     * workers already propagate through the lower ones. The results are 
+     * the same as without overlapping. */
+    void setOverlapUpdates(bool overlap);
+    bool getOverlapUpdates() const { return updateSchedule != 0; } ///< returns whether train overlaps the weight updates with the next mini-batch
+    
+    /** lets the threads of train take blocks of blockSize patterns from a 
+     * shared counter, instead of processing every n-th pattern of each 
+     * mini-batch. Threads that are slowed down (patterns of different cost,
+     * e.g. sparse inputs, or other jobs on the machine) then process fewer
+     * patterns, and the others do not have to wait for them. As the 
+     * patterns a copy sums up its derivatives for depend on the timing, 
+     * the results may differ in the last bits from run to run. Pass 0 to 
+     * return to the static, reproducible partition (default). */
+    void setDynamicScheduling(int blockSize) { dynamicBlockSize = blockSize > 0 ? blockSize : 0; }
+    int getDynamicScheduling() const { return dynamicBlockSize; } ///< returns the block size of the dynamic scheduling, 0 if the patterns are partitioned statically
+    
+    /** makes train reproducible independently of the number of threads. 
+     * Each mini-batch is split into fixed blocks of blockSize patterns, the
+     * threads take the blocks dynamically, sum up the derivatives of a 
+     * block on their copy and then add them to copy 0 in the order of the 
+     * blocks, as well as the errors. Thus, the derivatives and the weights
+     * are the same bit for bit, whatever the number of threads and their 
+     * timing. Needs at least one copy (see setNumCopies), also for a single
+     * thread, and does not support shared derivatives 
+     * (setSharedGradients). Takes precedence over setDynamicScheduling. 
+     * Pass 0 to switch the mode off. */
+    void setDeterministic(int blockSize);
+    int getDeterministic() const;        ///< returns the block size of the deterministic mode, 0 if it is off
 
     /** tests the neural network on a pattern set using all available internal copies of the connection structure.
      * \param pattern testing pattern
@@ -299,6 +507,7 @@ namespace NPP2 {
   protected:
     TopologyData topoData;           ///< read-only information about the network's structure
     double updateParams[MAX_PARAMS]; ///< parameters of the weight update function
+    int updateType;                  ///< id of the weight update function (see setUpdateFunc)
     UpdateFunction* updateFunction;  ///< pointer to the weight update function
 
 #ifdef __APPLE__    
@@ -307,6 +516,9 @@ namespace NPP2 {
 #endif
     
     int numCopies;               ///< number of copies of the connection structure
+    Profile* profile;            ///< timing of the phases of the last training / testing. stays empty, if profiling has not been compiled in.
+    Arena* arena;                ///< memory of all buffers of the layers
+    bool structureOnly;          ///< set in the temporary net of estimateMemory: the layers do not allocate any buffers
     
     
     /** class for passing all the necessary information to and from a single
@@ -323,25 +535,50 @@ namespace NPP2 {
       bool trainId;
       int numMiniBatches;        ///< total number of mini batches to use during training
       int batch;                 ///< number of the present batch. Necessary, since parallel threads need to be synchronized during weight updates between the mini batches.
+      bool awaitUpdate;          ///< the weights are still being updated after the previous batch (see Net::setOverlapUpdates)
       
       double tss;                ///< total sum of squares on this thread's part of the data
       int countwrong;            ///< number of miss-classifications on this thread's part of the data
       
       WorkerData() {}            ///< default constructor
       WorkerData(Net* net, const ErrorFunction* errorFunction, const PatternSet* pattern, int thread, int numThreads, bool trainId, int batch=0, int numMiniBatches=1) ///< constructs and initializes the structure with all the necessary information
-      : net(net), errorFunction(errorFunction), threadId(0), pattern(pattern), thread(thread), numThreads(numThreads), trainId(trainId), numMiniBatches(numMiniBatches), batch(batch), tss(0.), countwrong(0)
+      : net(net), errorFunction(errorFunction), threadId(0), pattern(pattern), thread(thread), numThreads(numThreads), trainId(trainId), numMiniBatches(numMiniBatches), batch(batch), awaitUpdate(false), tss(0.), countwrong(0)
       {}
     };
     
+    /** constructs the layers of the given specification (createLayers) */
+    void constructLayers(const std::vector<LayerArguments*>& netSpecification) throw (NPPException);
+    
     WorkerData* workerData;              ///< array of the data structures for each active worker
     static void* trainWorker(void* arg); ///< static hook to call the worker's training method during thread creation
     void trainWorker(WorkerData* arg);   ///< parallel training method executed by each worker
+    void trainPattern(WorkerData* arg, int i); ///< trains the worker's copy on the i-th pattern
 
     static void* testWorker(void* arg);  ///< static hook to call the worker's testing method during thread creation
     void testWorker(WorkerData* arg);    ///< parallel testing method executed by each worker
     
     void deleteStructure();
     
+    struct LatencyPool;                  ///< threads and barrier of the latency mode (defined in npp2.cpp)
+    LatencyPool* latencyPool;            ///< 0, if the latency mode is off
+    static void* latencyWorker(void* arg); ///< static hook of the threads of the latency mode
+    void propagateParts(int part, int numParts, int copy); ///< propagates the part-th part of all layers, synchronizing after each layer
+    
+    std::vector<FTYPE> batchBuffer;      ///< outputs and net inputs of the layers during forwardPassBatch
+    GradientReducer* gradientReducer;    ///< combines the derivatives before each update, if set
+    
+    struct UpdateSchedule;               ///< versions of the weights of the layers during overlapped updates (defined in npp2.cpp)
+    UpdateSchedule* updateSchedule;      ///< 0, if the updates are not overlapped with the next mini-batch
+    void awaitUpdate(int layer, int copy); ///< waits until the weights of the layer are up to date for the worker using the copy
+    void publishUpdate(int layer);       ///< tells the waiting workers that the weights of the layer have been updated
+    
+    int dynamicBlockSize;                ///< number of patterns the workers take at once, 0 for the static partition
+    volatile int nextPattern;            ///< first pattern not yet taken by a worker (dynamic scheduling)
+    
+    struct BlockMerge;                   ///< order of merging the blocks in the deterministic mode (defined in npp2.cpp)
+    BlockMerge* blockMerge;              ///< 0, if the deterministic mode is off
+    void mergeBlock(WorkerData* arg, int block); ///< adds the derivatives and errors of a block to copy 0 after all preceding blocks
+    
 /*  FUNCTIONALITY OF ORIGINAL N++ THAT HAS NOT BEEN PORTED, YET 
     FTYPE* scaled_in_vec;
     struct ScaleType {
@@ -38,6 +38,7 @@
 
 #include "BasicLayerTypes.h"
 #include "DeepAutoEncoder.h"
+#include "PipelineTrainer.h"
 #include "npp2.h"
 #include "PatternSet.h"
 #include <exception>
@@ -49,7 +50,7 @@ using namespace std;
 using namespace NPP2;
 
 
-DeepAutoEncoder::DeepAutoEncoder(Net* net, bool own) : own(own)
+DeepAutoEncoder::DeepAutoEncoder(Net* net, bool own) : own(own), pipelineStages(1)
 {
   fullNet = net;
 }
@@ -167,6 +168,8 @@ double DeepAutoEncoder::train(const PatternSet& pattern, int numEpochs, ostream&
     numEpochs = 1; ///< \todo : in this case train until error is "very small"
   }
   //fullNet->clear_derivatives();
+  PipelineTrainer* pipeline = pipelineStages > 1 ? new PipelineTrainer(fullNet, pipelineStages) : 0;
+  SquaredError squaredError;
     
   for (int epoch=0; epoch < numEpochs; epoch++) {
     
@@ -175,9 +178,15 @@ double DeepAutoEncoder::train(const PatternSet& pattern, int numEpochs, ostream&
       out << "MSE_TEST in epoch " << epoch + offset << ": " << testerr.regrError / (testPattern->pattern_count * fullNet->topoData.outCount) << endl;
     }
     
-    tss = fullNet->train(&pattern, fullNet->numCopies, true,  new SquaredError(), numBatches);
+    if (pipeline) {
+      tss = pipeline->train(&pattern, &squaredError, true, numBatches);
+    }
+    else {
+      tss = fullNet->train(&pattern, fullNet->numCopies, true,  new SquaredError(), numBatches);
+    }
     out << "MSE in epoch " << epoch + offset << ": " << tss / (pattern.pattern_count * fullNet->topoData.outCount) << endl; 
   }
+  delete pipeline;
   return tss;
 }
 
@@ -198,7 +207,7 @@ Net* DeepAutoEncoder::deriveEncoderNet() const
     net->layers[i]->copyWeights(fullNet->layers[i]);  
   }
 
-  net->setUpdateFunc(0, fullNet->updateParams);  // TODO
+  net->setUpdateFunc(fullNet->updateType, fullNet->updateParams);  // TODO
   
   return net;
 }
@@ -117,6 +117,14 @@ namespace NPP2 {
                  const PatternSet* testpattern=0, int offset=0, 
                  int numBatches = 1); 
     
+    /** lets train propagate the patterns through a pipeline of numStages
+     * threads, each working on a group of consecutive layers (see 
+     * PipelineTrainer), instead of splitting the patterns between the copies
+     * of the net. The net needs 2*numStages copies. Pass 1 to return to 
+     * Net::train. */
+    void setPipelineStages(int numStages) { pipelineStages = numStages; }
+    int getPipelineStages() const { return pipelineStages; } ///< returns the number of pipeline stages used by train
+    
     /** applies layer-wise pre-training to the whole autoencoder. Starts with
      * the two outermost layers, puts them in a shallow autoencoder network and
      * trains them on the input pattern in the PatternSet. Afterwards, continues
@@ -156,6 +164,7 @@ namespace NPP2 {
   protected:
     Net* fullNet;    ///< the autoencoder net passed to the constructor
     bool own;        ///< flag indicating whether the instance owns the net and thus should delete it, when being deconstructed.
+    int pipelineStages; ///< number of threads of the pipeline used by train; 1 for Net::train
   };
   
 }
@@ -0,0 +1,237 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  NetEnsembleTrainer.cpp
+ */
+
+#include "NetEnsembleTrainer.h"
+#include "BasicLayerTypes.h"
+#include "PatternSet.h"
+#include "functions.h"
+#include <algorithm>
+
+using namespace std;
+using namespace NPP2;
+
+#define BLOCK_BYTES (32 << 10)   // the inputs and targets of a block of patterns should fit into the L1 cache
+
+
+NetEnsembleTrainer::NetEnsembleTrainer(int numThreads)
+: numThreads(numThreads < 1 ? 1 : numThreads)
+{}
+
+NetEnsembleTrainer::~NetEnsembleTrainer()
+{}
+
+int NetEnsembleTrainer::addNet(Net* net, const ErrorFunction* errorFunction, bool id)
+{
+  Member member;
+  member.net = net;
+  member.errorFunction = errorFunction;
+  member.id = id;
+  member.work = 0.;
+  for (unsigned int i=1; i < net->layers.size(); i++) {  // multiply-adds of the connections and activations of the units
+    member.work += net->layers[i]->numWeights + net->layers[i]->numUnits;
+  }
+  member.thread = 0;
+  member.tss = 0.;
+  member.error.regrError = member.error.classError = 0.;
+  members.push_back(member);
+  schedule();
+  return (int) members.size()-1;
+}
+
+void NetEnsembleTrainer::setNumThreads(int numThreads)
+{
+  this->numThreads = numThreads < 1 ? 1 : numThreads;
+  schedule();
+}
+
+// longest processing time first: assigns the nets in the order of 
+// decreasing work to the thread with the least work so far.
+void NetEnsembleTrainer::schedule()
+{
+  vector<pair<double, int> > order(members.size());
+  for (unsigned int i=0; i < members.size(); i++) {
+    order[i] = make_pair(-members[i].work, (int) i);  // stable for nets of equal size
+  }
+  sort(order.begin(), order.end());
+  
+  int used = (int) members.size() < numThreads ? (int) members.size() : numThreads;
+  workers.assign(used, Worker());
+  vector<double> load(used, 0.);
+  for (unsigned int k=0; k < order.size(); k++) {
+    int m = order[k].second;
+    int thread = (int) (min_element(load.begin(), load.end()) - load.begin());
+    load[thread] += members[m].work;
+    members[m].thread = thread;
+    workers[thread].members.push_back(m);
+  }
+}
+
+int NetEnsembleTrainer::getBlockSize(const PatternSet* pattern) const
+{
+  int bytes = (pattern->input_count + pattern->target_count) * sizeof(FTYPE);
+  return bytes < BLOCK_BYTES ? BLOCK_BYTES / bytes : 1;
+}
+
+double NetEnsembleTrainer::train(const PatternSet* pattern, int numMiniBatches)
+{
+  run(pattern, numMiniBatches, true);
+  double tss = 0.;
+  for (unsigned int i=0; i < members.size(); i++) {
+    tss += members[i].tss;
+  }
+  return tss;
+}
+
+void NetEnsembleTrainer::test(const PatternSet* pattern)
+{
+  run(pattern, 1, false);
+}
+
+void NetEnsembleTrainer::run(const PatternSet* pattern, int numMiniBatches, bool training)
+{
+  for (unsigned int t=0; t < workers.size(); t++) {
+    workers[t].trainer = this;
+    workers[t].pattern = pattern;
+    workers[t].numMiniBatches = numMiniBatches;
+    workers[t].training = training;
+  }
+  for (unsigned int t=1; t < workers.size(); t++) {  // the nets of the first worker are trained by this thread
+    pthread_create(&workers[t].threadId, 0, workerThread, (void*) &workers[t]);
+  }
+  if (workers.size()) {
+    workerThread(&workers[0]);
+  }
+  for (unsigned int t=1; t < workers.size(); t++) {
+    pthread_join(workers[t].threadId, 0);
+  }
+}
+
+void* NetEnsembleTrainer::workerThread(void* arg)
+{
+  Worker* worker = (Worker*) arg;
+  if (worker->training) {
+    worker->trainer->trainWorker(worker);
+  }
+  else {
+    worker->trainer->testWorker(worker);
+  }
+  return 0;
+}
+
+// same steps as the single-threaded version of Net::train, but the patterns 
+// of each mini batch are processed block-wise by all nets of this worker.
+void NetEnsembleTrainer::trainWorker(Worker* worker)
+{
+  const PatternSet* pattern = worker->pattern;
+  int blockSize = getBlockSize(pattern);
+  int perBatch = pattern->pattern_count / worker->numMiniBatches;
+  
+  for (unsigned int k=0; k < worker->members.size(); k++) {
+    members[worker->members[k]].tss = 0.;
+  }
+  for (int batch = 0; batch < worker->numMiniBatches; batch++) {
+    int first = perBatch * batch;
+    int last = batch == worker->numMiniBatches-1 ? pattern->pattern_count : perBatch * (batch+1); // remainder in last batch
+    for (int block = first; block < last; block += blockSize) {
+      int end = block + blockSize < last ? block + blockSize : last;
+      for (unsigned int k=0; k < worker->members.size(); k++) {
+        Member& member = members[worker->members[k]];
+        Net* net = member.net;
+        for (int i=block; i < end; i++) {
+          const int* activeIndex = pattern->sparse_index ? pattern->sparse_index[i] : 0;
+          if (activeIndex) {
+            net->forwardPass(activeIndex, pattern->sparse_value[i], pattern->sparse_count[i], net->outVec);
+          }
+          else {
+            net->forwardPass(pattern->input[i], net->outVec);
+          }
+          FTYPE* target = member.id ? pattern->input[i] : pattern->target[i];
+          member.tss = member.errorFunction->errorAndDeriv(net->outVec, target, net->outVec, net->getTopologyData().outCount, member.tss);
+          net->backwardPass(net->outVec, 0, activeIndex, activeIndex ? pattern->sparse_value[i] : 0, activeIndex ? pattern->sparse_count[i] : 0);
+        }
+      }
+    }
+    for (unsigned int k=0; k < worker->members.size(); k++) {
+      members[worker->members[k]].net->updateWeights();
+    }
+  }
+}
+
+// same steps as the single-threaded version of Net::test
+void NetEnsembleTrainer::testWorker(Worker* worker)
+{
+  const PatternSet* pattern = worker->pattern;
+  int blockSize = getBlockSize(pattern);
+  vector<int> countwrong(worker->members.size(), 0);
+  
+  for (unsigned int k=0; k < worker->members.size(); k++) {
+    members[worker->members[k]].error.regrError = 0.;
+  }
+  for (int block = 0; block < pattern->pattern_count; block += blockSize) {
+    int end = block + blockSize < pattern->pattern_count ? block + blockSize : pattern->pattern_count;
+    for (unsigned int k=0; k < worker->members.size(); k++) {
+      Member& member = members[worker->members[k]];
+      Net* net = member.net;
+      int outCount = net->getTopologyData().outCount;
+      for (int i=block; i < end; i++) {
+        if (pattern->sparse_index) {
+          net->forwardPass(pattern->sparse_index[i], pattern->sparse_value[i], pattern->sparse_count[i], net->outVec);
+        }
+        else {
+          net->forwardPass(pattern->input[i], net->outVec);
+        }
+        FTYPE* target = member.id ? pattern->input[i] : pattern->target[i];
+        
+        int outI=-1, targetI=-1; double targetMax=0., outMax=0.;
+        for (int d=0; d < outCount; d++) {
+          member.error.regrError += member.errorFunction->error(net->outVec[d], target[d]);
+          if (net->outVec[d] >= outMax) {
+            outMax = net->outVec[d];
+            outI = d;
+          }
+          if (target[d] >= targetMax) {
+            targetMax = target[d];
+            targetI = d;
+          }
+        }
+        if (targetI != outI) countwrong[k]++;
+      }
+    }
+  }
+  for (unsigned int k=0; k < worker->members.size(); k++) {
+    members[worker->members[k]].error.classError = (countwrong[k] / (double) pattern->pattern_count) * 100.;
+  }
+}
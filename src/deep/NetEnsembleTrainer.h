@@ -0,0 +1,135 @@
+#ifndef _NPP2_NETENSEMBLETRAINER_H_
+#define _NPP2_NETENSEMBLETRAINER_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  NetEnsembleTrainer.h
+ *
+ *  Trains many small, independent nets (e.g. of a sweep over the parameters
+ *  of the update function or over topologies) on the same pattern set in 
+ *  parallel. Nets that are too small for splitting the patterns between 
+ *  threads (Net::train) are distributed between the threads instead.
+ */
+
+#include <vector>
+#include <pthread.h>
+#include "npp2.h"
+
+namespace NPP2 {
+
+  class PatternSet;
+  class ErrorFunction;
+
+  /** Trains a set of independent nets on the same patterns in one pass over
+   * the data. The nets are distributed between the threads by their 
+   * estimated work per pattern, largest first, always to the thread with 
+   * the least work so far (longest processing time scheduling). Each thread
+   * walks through the patterns in blocks that fit into the cache and trains
+   * all of its nets on a block, before moving on to the next block. Thus, 
+   * the inputs of a block are read from memory only once for all nets of a
+   * thread. Each net is trained on copy 0 exactly as by Net::train with a 
+   * single thread, so the results do not depend on the number of threads. */
+  class NetEnsembleTrainer {
+  public:
+    /** constructs an empty ensemble, that will be trained by numThreads 
+     * threads */
+    NetEnsembleTrainer(int numThreads=1);
+    /** destructs the trainer, but not the nets */
+    ~NetEnsembleTrainer();
+    
+    /** adds a connected net to the ensemble. The net and the error function
+     * are not deleted by the trainer. The nets may have different topologies,
+     * but have to match the pattern set. Returns the index of the net.
+     * \param id train the net on the identity (auto-encoder) */
+    int addNet(Net* net, const ErrorFunction* errorFunction, bool id=false);
+    int getNumNets() const { return (int) members.size(); } ///< returns the number of nets in the ensemble
+    Net* getNet(int i) const { return members[i].net; }      ///< returns the i-th net
+    
+    void setNumThreads(int numThreads);                      ///< changes the number of threads
+    int getNumThreads() const { return numThreads; }         ///< returns the number of threads
+    
+    /** trains all nets for one epoch, updating the weights of each net after
+     * each of the numMiniBatches parts of the pattern set. Returns the sum
+     * of the training errors of all nets; the error of an individual net 
+     * can be retrieved with getTrainError. */
+    double train(const PatternSet* pattern, int numMiniBatches=1);
+    /** tests all nets on the given pattern set (see Net::test). The errors 
+     * can be retrieved with getTestError. */
+    void test(const PatternSet* pattern);
+    
+    double getTrainError(int i) const { return members[i].tss; }  ///< returns the training error (tss) of the i-th net during the last epoch
+    Error getTestError(int i) const { return members[i].error; }  ///< returns the error of the i-th net during the last test
+    /** returns the thread that trains the i-th net (see train). The schedule
+     * is computed anew each time a net is added or the number of threads
+     * is changed. */
+    int getThreadOfNet(int i) const { return members[i].thread; }
+    
+  protected:
+    /** a net of the ensemble and its results */
+    struct Member {
+      Net* net;
+      const ErrorFunction* errorFunction;
+      bool id;
+      double work;            ///< estimated work per pattern (number of weights and units)
+      int thread;             ///< thread training this net
+      double tss;             ///< training error of the last epoch
+      Error error;            ///< result of the last test
+    };
+    
+    /** the nets of one thread and the work to do */
+    struct Worker {
+      NetEnsembleTrainer* trainer;
+      pthread_t threadId;
+      std::vector<int> members;  ///< indices of the nets of this thread
+      const PatternSet* pattern;
+      int numMiniBatches;
+      bool training;             ///< false while testing
+    };
+    
+    int numThreads;
+    std::vector<Member> members;
+    std::vector<Worker> workers;
+    
+    void schedule();                     ///< distributes the nets between the workers
+    void run(const PatternSet* pattern, int numMiniBatches, bool training); ///< starts the workers and waits for them
+    int getBlockSize(const PatternSet* pattern) const; ///< number of patterns processed by each net before switching to the next net
+    
+    static void* workerThread(void* arg); ///< static hook of the threads
+    void trainWorker(Worker* worker);     ///< trains the nets of one worker for one epoch
+    void testWorker(Worker* worker);      ///< tests the nets of one worker
+  };
+
+}
+
+#endif
@@ -0,0 +1,310 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  PipelineTrainer.cpp
+ */
+
+#include "PipelineTrainer.h"
+#include "BasicLayerTypes.h"
+#include "PatternSet.h"
+#include "functions.h"
+#include <sstream>
+#include <cstring>
+
+using namespace std;
+using namespace NPP2;
+
+
+PipelineTrainer::PipelineTrainer(Net* net, int numStages, int numSlots) throw (NPPException)
+: net(net), numSlots(numSlots > 0 ? numSlots : 2 * (numStages > 1 ? numStages : 1)),
+  pattern(0), errorFunction(0), id(false), lowest(1), tss(0.)
+{
+  int layerCount = net->getTopologyData().layerCount;
+  if (layerCount < 2) {
+    throw NPPException("The pipeline needs a net with at least one layer of weights.");
+  }
+  if (this->numSlots > 1 && net->getNumCopies() < this->numSlots) {
+    ostringstream message;
+    message << "The pipeline needs " << this->numSlots << " copies of the net, but the net has only " 
+            << net->getNumCopies() << " (see Net::setNumCopies).";
+    throw NPPException(message.str());
+  }
+  partition(numStages < 1 ? 1 : (numStages < layerCount-1 ? numStages : layerCount-1));
+}
+
+PipelineTrainer::~PipelineTrainer()
+{}
+
+// splits the layers 1..n into k groups of consecutive layers minimizing the 
+// work of the largest group. best[k][i] is the smallest maximum of the 
+// first i layers split into k groups.
+void PipelineTrainer::partition(int numStages)
+{
+  int n = net->getTopologyData().layerCount-1;
+  vector<double> sum(n+1, 0.);      // work of the layers 1..i
+  for (int i=1; i <= n; i++) {
+    sum[i] = sum[i-1] + net->layers[i]->numWeights + net->layers[i]->numUnits;
+  }
+  vector<vector<double> > best(numStages+1, vector<double>(n+1, -1.));
+  vector<vector<int> > split(numStages+1, vector<int>(n+1, 0));
+  for (int i=1; i <= n; i++) {
+    best[1][i] = sum[i];
+  }
+  for (int k=2; k <= numStages; k++) {
+    for (int i=k; i <= n; i++) {
+      for (int j=k-1; j < i; j++) {  // the last group holds the layers j+1..i
+        double work = max(best[k-1][j], sum[i]-sum[j]);
+        if (best[k][i] < 0. || work < best[k][i]) {
+          best[k][i] = work;
+          split[k][i] = j;
+        }
+      }
+    }
+  }
+  
+  stages.resize(numStages);
+  int last = n;
+  for (int k=numStages; k >= 1; k--) {
+    Stage& stage = stages[k-1];
+    stage.trainer = this;
+    stage.index = k-1;
+    stage.first = k > 1 ? split[k][last]+1 : 1;
+    stage.last = last;
+    stage.stop = false;
+    last = stage.first-1;
+  }
+}
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Propagation
+#endif
+
+void PipelineTrainer::forwardStage(const Stage& stage, const Item& item)
+{
+  const vector<BasicLayerType*>& layers = net->layers;
+  int c = item.copy;
+  const int* activeIndex = pattern->sparse_index ? pattern->sparse_index[item.pattern] : 0;
+  
+  for (int i=stage.first; i <= stage.last; i++) {
+    FTYPE* input = &(layers[i-1]->out[c*(layers[i-1]->numUnits+1)]);
+    if (i == 1) {                // copy the pattern to the input layer first (see Net::forwardPass)
+      int inCount = layers[0]->numUnits;
+      if (activeIndex) {
+        memset(input+1, 0, sizeof(FTYPE) * inCount);
+        for (int k=0; k < pattern->sparse_count[item.pattern]; k++) {
+          input[activeIndex[k]+1] = pattern->sparse_value[item.pattern][k];
+        }
+        layers[1]->forwardPassSparse(input, activeIndex, pattern->sparse_value[item.pattern], pattern->sparse_count[item.pattern], c);
+        continue;
+      }
+      memcpy(input+1, pattern->input[item.pattern], sizeof(FTYPE) * inCount);
+    }
+    layers[i]->forwardPass(input, c);
+  }
+}
+
+void PipelineTrainer::backwardStage(const Stage& stage, const Item& item)
+{
+  const vector<BasicLayerType*>& layers = net->layers;
+  int c = item.copy;
+  const int* activeIndex = pattern->sparse_index ? pattern->sparse_index[item.pattern] : 0;
+  
+  for (int i=stage.last; i >= stage.first && i >= lowest; i--) {
+    FTYPE* dedoutPrev = i > lowest ? &(layers[i-1]->dEdo[c*(layers[i-1]->numUnits+1)+1]) : 0;
+    if (i == 1 && activeIndex) {
+      layers[i]->backwardPassSparse(dedoutPrev, activeIndex, pattern->sparse_value[item.pattern], pattern->sparse_count[item.pattern], c);
+    }
+    else {
+      layers[i]->backwardPass(dedoutPrev, c);
+    }
+  }
+}
+
+// a pattern that reaches the output layer is turned around: the error and its
+// derivative are calculated and the pattern is back-propagated right away.
+bool PipelineTrainer::process(Stage& stage, const Item& item, bool backward)
+{
+  if (!backward) {
+    forwardStage(stage, item);
+    if (stage.index < (int) stages.size()-1) {
+      push(stages[stage.index+1], item, false);
+      return false;
+    }
+    const Net::TopologyData& topoData = net->getTopologyData();
+    BasicLayerType* output = net->layers[topoData.layerCount-1];
+    FTYPE* target = id ? pattern->input[item.pattern] : pattern->target[item.pattern];
+    FTYPE* ded = &dedout[item.copy*topoData.outCount];
+    tss = errorFunction->errorAndDeriv(&(output->out[item.copy*(topoData.outCount+1)+1]), target, ded, topoData.outCount, tss);
+    memcpy(&(output->dEdo[item.copy*(topoData.outCount+1)+1]), ded, sizeof(FTYPE) * topoData.outCount);
+  }
+  backwardStage(stage, item);
+  if (stage.index > 0) {
+    push(stages[stage.index-1], item, true);
+    return false;
+  }
+  return true;                   // the pattern is done
+}
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Threads
+#endif
+
+void PipelineTrainer::push(Stage& stage, const Item& item, bool backward)
+{
+  pthread_mutex_lock(&stage.mutex);
+  if (backward) {
+    stage.backward.push_back(item);
+  }
+  else {
+    stage.forward.push_back(item);
+  }
+  pthread_cond_signal(&stage.ready);
+  pthread_mutex_unlock(&stage.mutex);
+}
+
+// back-propagation is preferred, as it frees the copies for new patterns.
+// returns false, if there is no pattern and wait is false, or if the stage 
+// has been stopped.
+bool PipelineTrainer::pop(Stage& stage, Item* item, bool* backward, bool wait)
+{
+  pthread_mutex_lock(&stage.mutex);
+  while (wait && !stage.stop && stage.backward.empty() && stage.forward.empty()) {
+    pthread_cond_wait(&stage.ready, &stage.mutex);
+  }
+  bool found = true;
+  if (!stage.backward.empty()) {
+    *item = stage.backward.front();
+    stage.backward.pop_front();
+    *backward = true;
+  }
+  else if (!stage.forward.empty()) {
+    *item = stage.forward.front();
+    stage.forward.pop_front();
+    *backward = false;
+  }
+  else {
+    found = false;
+  }
+  pthread_mutex_unlock(&stage.mutex);
+  return found;
+}
+
+void* PipelineTrainer::stageThread(void* arg)
+{
+  Stage* stage = (Stage*) arg;
+  stage->trainer->runStage(*stage);
+  return 0;
+}
+
+void PipelineTrainer::runStage(Stage& stage)
+{
+  Item item;
+  bool backward;
+  while (pop(stage, &item, &backward, true)) {
+    process(stage, item, backward);
+  }
+}
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Training
+#endif
+
+// the first stage is run by the calling thread. it feeds the patterns of a 
+// mini-batch into the pipeline as long as there are free copies and waits 
+// for all patterns to return before updating the weights. the patterns 
+// return in the order they have been fed in, as every stage processes its
+// queues in order. thus, the i-th pattern of a mini-batch can reuse the 
+// copy of the (i-numSlots)-th pattern, which is the copy Net::train would 
+// use for it.
+double PipelineTrainer::train(const PatternSet* pattern, const ErrorFunction* errorFunction, bool id, int numMiniBatches)
+{
+  const Net::TopologyData& topoData = net->getTopologyData();
+  this->pattern = pattern;
+  this->errorFunction = errorFunction;
+  this->id = id;
+  tss = 0.;
+  lowest = 1;                    // see Net::backwardPass
+  while (lowest < topoData.layerCount-1 && !net->layers[lowest]->trainable) lowest++;
+  if (dedout.size() < (size_t) (net->getNumCopies()+1) * topoData.outCount) {
+    dedout.resize((net->getNumCopies()+1) * topoData.outCount);
+  }
+  
+  for (unsigned int s=0; s < stages.size(); s++) {
+    Stage& stage = stages[s];
+    pthread_mutex_init(&stage.mutex, 0);
+    pthread_cond_init(&stage.ready, 0);
+    stage.stop = false;
+    if (s > 0 && pthread_create(&stage.threadId, 0, stageThread, (void*) &stage)) {
+      cerr << "Could not start the thread of stage " << s << " of the pipeline." << endl;
+      exit(1);
+    }
+  }
+  
+  int perBatch = pattern->pattern_count / numMiniBatches;
+  for (int batch=0; batch < numMiniBatches; batch++) {
+    int begin = perBatch * batch;
+    int end = batch == numMiniBatches-1 ? pattern->pattern_count : perBatch * (batch+1); // process remainder in last batch
+    int next = begin;
+    int done = 0;
+    while (done < end-begin) {
+      Item item;
+      bool backward;
+      bool feed = next < end && next-begin-done < numSlots;   // is the copy of the next pattern free?
+      if (pop(stages[0], &item, &backward, !feed)) {
+        done += process(stages[0], item, backward) ? 1 : 0;
+        continue;
+      }
+      item = Item(next, numSlots > 1 ? 1 + (next-begin) % numSlots : 0);
+      next++;
+      done += process(stages[0], item, false) ? 1 : 0;
+    }
+    net->updateWeights(numSlots > 1 ? numSlots : 0); // the pipeline is empty, all derivatives are complete
+  }
+  
+  for (unsigned int s=0; s < stages.size(); s++) {
+    Stage& stage = stages[s];
+    if (s > 0) {
+      pthread_mutex_lock(&stage.mutex);
+      stage.stop = true;
+      pthread_cond_signal(&stage.ready);
+      pthread_mutex_unlock(&stage.mutex);
+      pthread_join(stage.threadId, 0);
+    }
+    pthread_mutex_destroy(&stage.mutex);
+    pthread_cond_destroy(&stage.ready);
+  }
+  return tss;
+}
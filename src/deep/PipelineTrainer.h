@@ -0,0 +1,136 @@
+#ifndef _NPP2_PIPELINETRAINER_H_
+#define _NPP2_PIPELINETRAINER_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  PipelineTrainer.h
+ *
+ *  Model-parallel training of deep nets: groups of consecutive layers are
+ *  assigned to different threads (stages), and the patterns stream through
+ *  these stages forward and backward like through a pipeline.
+ */
+
+#include <vector>
+#include <deque>
+#include <pthread.h>
+#include "npp2.h"
+
+namespace NPP2 {
+
+  class PatternSet;
+  class ErrorFunction;
+
+  /** Trains a net by splitting its layers into stages of consecutive layers,
+   * each stage propagated by its own thread. A pattern enters the first 
+   * stage, is handed from stage to stage until the output layer has been
+   * reached, and then handed back down the stages for back-propagation. 
+   * While the last stages work on one pattern, the first stages already
+   * propagate the next ones. The stages are chosen to balance the work 
+   * (weights and units) of their layers.
+   *
+   * The patterns in flight are held in numSlots copies of the net; the 
+   * pattern i of a mini-batch uses the same copy as in Net::train with 
+   * numSlots threads, so the weights after each update are the same as 
+   * after Net::train(pattern, numSlots, ...), as long as the size of the 
+   * mini-batches is a multiple of numSlots. Each layer is only touched
+   * by the thread of its stage, so with Net::setSharedGradients all slots 
+   * accumulate their derivatives in one buffer per layer without waiting
+   * for each other, and the results stay reproducible. The pipeline is 
+   * drained before each weight update. */
+  class PipelineTrainer {
+  public:
+    /** prepares training the net with numStages threads. The net has to be
+     * connected and needs at least numSlots copies (Net::setNumCopies); 
+     * numSlots defaults to twice the number of stages, which keeps all 
+     * stages busy in both directions. The number of stages is limited to 
+     * the number of layers with weights. The net is not deleted by the 
+     * trainer. */
+    PipelineTrainer(Net* net, int numStages, int numSlots=0) throw (NPPException);
+    ~PipelineTrainer();
+
+    /** trains the net for one epoch (see Net::train). Returns the training
+     * error (tss). Test the net with Net::test as usual. */
+    double train(const PatternSet* pattern, const ErrorFunction* errorFunction, bool id=false, int numMiniBatches=1);
+
+    int getNumStages() const { return (int) stages.size(); }   ///< returns the number of stages (threads)
+    int getNumSlots() const { return numSlots; }                ///< returns the number of patterns in flight
+    int getFirstLayer(int stage) const { return stages[stage].first; } ///< returns the lowest layer of the given stage
+    int getLastLayer(int stage) const { return stages[stage].last; }   ///< returns the highest layer of the given stage
+
+  protected:
+    /** a pattern in flight */
+    struct Item {
+      int pattern;                ///< index of the pattern in the pattern set
+      int copy;                   ///< copy of the net holding its activations
+      Item(int pattern=0, int copy=0) : pattern(pattern), copy(copy) {}
+    };
+
+    /** a group of consecutive layers and the patterns waiting for it */
+    struct Stage {
+      PipelineTrainer* trainer;
+      int index;
+      int first, last;            ///< layers of this stage
+      pthread_t threadId;
+      pthread_mutex_t mutex;
+      pthread_cond_t ready;       ///< signaled when a pattern has been queued
+      std::deque<Item> forward;   ///< patterns to propagate, handed over from the stage below
+      std::deque<Item> backward;  ///< patterns to back-propagate, handed over from the stage above
+      bool stop;
+    };
+
+    Net* net;
+    int numSlots;
+    std::vector<Stage> stages;
+
+    const PatternSet* pattern;  ///< pattern set and parameters of the present epoch
+    const ErrorFunction* errorFunction;
+    bool id;
+    int lowest;                 ///< lowest layer that needs to be back-propagated (see Net::backwardPass)
+    double tss;                 ///< error of the present epoch, summed up by the last stage
+    std::vector<FTYPE> dedout;  ///< derivatives of the error of each copy
+
+    void partition(int numStages);                  ///< assigns the layers to the stages
+    void push(Stage& stage, const Item& item, bool backward); ///< hands a pattern to a stage
+    bool pop(Stage& stage, Item* item, bool* backward, bool wait); ///< takes the next pattern of a stage, preferring back-propagation
+    void forwardStage(const Stage& stage, const Item& item);  ///< propagates the layers of a stage
+    void backwardStage(const Stage& stage, const Item& item); ///< back-propagates the layers of a stage
+    bool process(Stage& stage, const Item& item, bool backward); ///< processes a pattern and hands it on; returns true, when it has passed the first stage backwards
+    
+    static void* stageThread(void* arg);            ///< static hook of the threads
+    void runStage(Stage& stage);                    ///< loop of the threads of the stages above the first
+  };
+
+}
+
+#endif
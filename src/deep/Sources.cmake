@@ -1,10 +1,14 @@
 include_directories(${NPP2_SOURCE_DIR}/deep)
 LIST(APPEND deep_srcs 
 	${NPP2_SOURCE_DIR}/deep/DeepAutoEncoder.cpp
+	${NPP2_SOURCE_DIR}/deep/NetEnsembleTrainer.cpp
 	${NPP2_SOURCE_DIR}/deep/NetGenerator.cpp
+	${NPP2_SOURCE_DIR}/deep/PipelineTrainer.cpp
 ) 
 
 LIST(APPEND deep_headers
 	${NPP2_SOURCE_DIR}/deep/DeepAutoEncoder.h
+	${NPP2_SOURCE_DIR}/deep/NetEnsembleTrainer.h
 	${NPP2_SOURCE_DIR}/deep/NetGenerator.h
+	${NPP2_SOURCE_DIR}/deep/PipelineTrainer.h
 )
\ No newline at end of file
@@ -0,0 +1,107 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  Communicator.cpp
+ *
+ *  Ring allreduce, broadcast and barrier on top of Communicator::exchange.
+ */
+
+#include "Communicator.h"
+
+using namespace NPP2;
+
+// first element of the chunk-th of numChunks chunks of n values
+static int chunkBegin(int chunk, int numChunks, int n)
+{
+  return (int) ((long) n * chunk / numChunks);
+}
+
+void Communicator::allreduce(FTYPE* data, int n) throw (NPPException)
+{
+  int size = getSize();
+  int rank = getRank();
+  if (size <= 1 || n <= 0) return;
+  
+  receiveBuffer.resize(n / size + 1);
+  
+  // reduce-scatter: in step s, each process passes its partial sum of chunk
+  // rank-s on to the next process and adds the partial sum of chunk 
+  // rank-s-1 of the previous process to its own. Afterwards, the process
+  // holds the complete sum of chunk rank+1.
+  for (int s=0; s < size-1; s++) {
+    int sendChunk = (rank - s + size) % size;
+    int recvChunk = (rank - s - 1 + size) % size;
+    int sendBegin = chunkBegin(sendChunk, size, n);
+    int recvBegin = chunkBegin(recvChunk, size, n);
+    int recvCount = chunkBegin(recvChunk+1, size, n) - recvBegin;
+    exchange(&data[sendBegin], (chunkBegin(sendChunk+1, size, n) - sendBegin) * sizeof(FTYPE),
+             &receiveBuffer[0], recvCount * sizeof(FTYPE));
+    for (int i=0; i < recvCount; i++) {
+      data[recvBegin+i] += receiveBuffer[i];
+    }
+  }
+  // allgather: the complete chunks are passed around the ring and copied
+  for (int s=0; s < size-1; s++) {
+    int sendChunk = (rank + 1 - s + size) % size;
+    int recvChunk = (rank - s + size) % size;
+    int sendBegin = chunkBegin(sendChunk, size, n);
+    int recvBegin = chunkBegin(recvChunk, size, n);
+    exchange(&data[sendBegin], (chunkBegin(sendChunk+1, size, n) - sendBegin) * sizeof(FTYPE),
+             &data[recvBegin], (chunkBegin(recvChunk+1, size, n) - recvBegin) * sizeof(FTYPE));
+  }
+}
+
+void Communicator::broadcast(FTYPE* data, int n, int root) throw (NPPException)
+{
+  int size = getSize();
+  if (size <= 1 || n <= 0) return;
+  
+  int distance = (getRank() - root + size) % size; // position in the ring, counting from the root
+  if (distance > 0) {
+    exchange(0, 0, data, n * sizeof(FTYPE));      // receive from the previous process
+  }
+  if (distance < size-1) {
+    exchange(data, n * sizeof(FTYPE), 0, 0);      // pass on to the next process
+  }
+}
+
+void Communicator::barrier() throw (NPPException)
+{
+  // after size-1 exchanges with the neighbours, each process has waited
+  // (indirectly) for all other processes to enter the barrier
+  char token = 0;
+  char received;
+  for (int s=0; s < getSize()-1; s++) {
+    exchange(&token, 1, &received, 1);
+  }
+}
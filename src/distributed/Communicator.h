@@ -0,0 +1,87 @@
+#ifndef _NPP2_COMMUNICATOR_H_
+#define _NPP2_COMMUNICATOR_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  Communicator.h
+ *
+ *  Collective operations between the processes of a distributed training 
+ *  run. The processes form a ring; a transport only has to implement the 
+ *  exchange of a message with both neighbours in the ring, everything else
+ *  (allreduce, broadcast, barrier) is built on top of it.
+ */
+
+#include <cstddef>
+#include <vector>
+#include "functions.h"
+#include "NPPException.h"
+
+namespace NPP2 {
+  
+  /** Abstract transport between size processes with the ranks 0 to size-1,
+   * connected in a ring. Derived classes implement exchange for a concrete
+   * transport (e.g. UnixSocketCommunicator). All processes have to call the
+   * collective operations in the same order with the same sizes. */
+  class Communicator {
+  public:
+    virtual ~Communicator() {}
+    
+    virtual int getRank() const=0;  ///< returns the rank of this process
+    virtual int getSize() const=0;  ///< returns the number of processes
+    
+    /** sends nextBytes bytes to the next process in the ring (rank+1) while
+     * receiving previousBytes bytes from the previous process (rank-1). 
+     * Either size may be 0. Returns after both transfers have been 
+     * completed. Sending and receiving at the same time is necessary, as 
+     * all processes of the ring send before they receive. */
+    virtual void exchange(const void* toNext, size_t nextBytes, void* fromPrevious, size_t previousBytes) throw (NPPException)=0;
+    
+    /** sums up the n values of data element-wise over all processes and 
+     * returns the sum in data in each process (ring allreduce: each process
+     * sends and receives 2*(size-1)/size*n values). All processes receive 
+     * bit-identical results. */
+    void allreduce(FTYPE* data, int n) throw (NPPException);
+    /** copies the n values of data of the process root to all other 
+     * processes */
+    void broadcast(FTYPE* data, int n, int root=0) throw (NPPException);
+    /** returns after all processes have entered the barrier */
+    void barrier() throw (NPPException);
+    
+  protected:
+    std::vector<FTYPE> receiveBuffer;  ///< chunk received during allreduce
+  };
+  
+}
+
+#endif
@@ -0,0 +1,173 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  DistributedTrainer.cpp
+ */
+
+#include "DistributedTrainer.h"
+#include "BasicLayerTypes.h"
+#include "PatternSet.h"
+#include <sstream>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+using namespace NPP2;
+using namespace std;
+
+DistributedTrainer::DistributedTrainer(Net* net, Communicator* communicator) throw (NPPException)
+: net(net), communicator(communicator)
+{
+  for (int i=1; i < net->getTopologyData().layerCount; i++) {
+    int count;
+    if (net->layers[i]->trainable && !net->layers[i]->getGradients(&count)) {
+      ostringstream message;
+      message << "Layer " << i << " does not support exchanging the derivatives of its weights.";
+      throw NPPException(message.str());
+    }
+  }
+}
+
+void DistributedTrainer::broadcastWeights(int root) throw (NPPException)
+{
+  for (int i=1; i < net->getTopologyData().layerCount; i++) {
+    int count;
+    FTYPE* weights = net->layers[i]->getWeights(&count);
+    communicator->broadcast(weights, count, root);
+  }
+}
+
+double DistributedTrainer::train(const PatternSet* shard, const ErrorFunction* errorFunction, bool id, int numMiniBatches, int threads) throw (NPPException)
+{
+  if (threads > 1 && threads > net->getNumCopies()) { // Net::train would return without updating, leaving the other processes waiting
+    throw NPPException("The net does not have enough copies for the given number of threads.");
+  }
+  net->setGradientReducer(this);
+  double tss;
+  try {
+    tss = net->train(shard, threads, id, errorFunction, numMiniBatches);
+  }
+  catch (...) {
+    net->setGradientReducer(0);
+    throw;
+  }
+  net->setGradientReducer(0);
+  
+  communicator->allreduce(&tss, 1);
+  return tss;
+}
+
+Error DistributedTrainer::test(const PatternSet* shard, const ErrorFunction* errorFunction, bool id, int threads) throw (NPPException)
+{
+  Error error = net->test(shard, threads, id, errorFunction);
+  
+  FTYPE sums[3];
+  sums[0] = error.regrError;
+  sums[1] = floor(error.classError * shard->pattern_count / 100. + .5); // number of misclassified patterns
+  sums[2] = shard->pattern_count;
+  communicator->allreduce(sums, 3);
+  
+  error.regrError = sums[0];
+  error.classError = sums[2] > 0 ? sums[1] / sums[2] * 100. : 0.;
+  return error;
+}
+
+void DistributedTrainer::reduce(Net& net)
+{
+  // copy the derivatives of all layers into one buffer, in order to 
+  // exchange them in a single allreduce
+  int total = 0;
+  for (int i=1; i < net.getTopologyData().layerCount; i++) {
+    int count;
+    if (net.layers[i]->trainable) {
+      net.layers[i]->getGradients(&count);
+      total += count;
+    }
+  }
+  if (total == 0) return;
+  buffer.resize(total);
+  int pos = 0;
+  for (int i=1; i < net.getTopologyData().layerCount; i++) {
+    int count;
+    if (net.layers[i]->trainable) {
+      FTYPE* gradients = net.layers[i]->getGradients(&count);
+      memcpy(&buffer[pos], gradients, count * sizeof(FTYPE));
+      pos += count;
+    }
+  }
+  
+  communicator->allreduce(&buffer[0], total);
+  
+  pos = 0;
+  for (int i=1; i < net.getTopologyData().layerCount; i++) {
+    int count;
+    if (net.layers[i]->trainable) {
+      FTYPE* gradients = net.layers[i]->getGradients(&count);
+      memcpy(gradients, &buffer[pos], count * sizeof(FTYPE));
+      pos += count;
+    }
+  }
+}
+
+PatternSet* DistributedTrainer::createShard(const PatternSet& pattern, int rank, int size)
+{
+  PatternSet* shard = new PatternSet();
+  shard->input_count = pattern.input_count;
+  shard->target_count = pattern.target_count;
+  shard->pattern_count = rank < pattern.pattern_count ? (pattern.pattern_count - rank + size - 1) / size : 0;
+  shard->input = new double*[shard->pattern_count];
+  shard->target = new double*[shard->pattern_count];
+  
+  for (long i=0; i < shard->pattern_count; i++) {
+    long p = rank + i * size;
+    shard->input[i] = new double[pattern.input_count];
+    memcpy(shard->input[i], pattern.input[p], pattern.input_count * sizeof(double));
+    shard->target[i] = new double[pattern.target_count];
+    memcpy(shard->target[i], pattern.target[p], pattern.target_count * sizeof(double));
+  }
+  if (pattern.sparse_index) {  // copy the sparse representation as it is (its threshold is not known)
+    shard->sparse_index = new int*[shard->pattern_count];
+    shard->sparse_value = new double*[shard->pattern_count];
+    shard->sparse_count = new int[shard->pattern_count];
+    for (long i=0; i < shard->pattern_count; i++) {
+      long p = rank + i * size;
+      int count = pattern.sparse_count[p];
+      shard->sparse_count[i] = count;
+      shard->sparse_index[i] = new int[count];
+      std::copy(pattern.sparse_index[p], pattern.sparse_index[p] + count, shard->sparse_index[i]);
+      shard->sparse_value[i] = new double[count];
+      std::copy(pattern.sparse_value[p], pattern.sparse_value[p] + count, shard->sparse_value[i]);
+    }
+  }
+  return shard;
+}
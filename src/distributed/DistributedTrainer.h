@@ -0,0 +1,104 @@
+#ifndef _NPP2_DISTRIBUTEDTRAINER_H_
+#define _NPP2_DISTRIBUTEDTRAINER_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  DistributedTrainer.h
+ *
+ *  Data-parallel training of one net by several processes. Each process 
+ *  holds its own copy of the net and a shard of the training patterns; the
+ *  derivatives of the weights are summed over all processes before each
+ *  weight update.
+ */
+
+#include <vector>
+#include "npp2.h"
+#include "Communicator.h"
+
+namespace NPP2 {
+  
+  class PatternSet;
+  class ErrorFunction;
+  
+  /** Trains the copies of a net in several processes as one net. Before 
+   * each weight update, the derivatives accumulated by the processes on 
+   * their shards of the patterns are summed up with an allreduce of the
+   * communicator. As all processes start from the same weights (see 
+   * broadcastWeights) and apply the same update function to the same sums,
+   * the weights of all copies stay identical, and the update (e.g. RPROP)
+   * sees the derivatives of the complete mini-batch. Within a process, the
+   * shard may be processed by several threads (Net::train). 
+   *
+   * All processes have to call the methods in the same order, and train 
+   * with the same number of mini-batches. Supports nets of fully and 
+   * individually connected layers (BasicLayerType::getGradients). */
+  class DistributedTrainer : public GradientReducer {
+  public:
+    /** prepares training the net with the other processes reachable by the
+     * communicator. Neither the net nor the communicator are deleted by the
+     * trainer. Throws an exception, if a trainable layer does not support
+     * exchanging its derivatives. */
+    DistributedTrainer(Net* net, Communicator* communicator) throw (NPPException);
+    
+    /** copies the weights of the net of the process root to the nets of all
+     * other processes. Call once before training, unless the weights have 
+     * been initialized identically in all processes. */
+    void broadcastWeights(int root=0) throw (NPPException);
+    
+    /** trains the net for one epoch on this process's shard of the 
+     * patterns (see Net::train). Returns the sum of the errors of all 
+     * processes. */
+    double train(const PatternSet* shard, const ErrorFunction* errorFunction, bool id=false, int numMiniBatches=1, int threads=1) throw (NPPException);
+    /** tests the net on the shards of all processes and returns the error
+     * on the union of the shards (see Net::test) */
+    Error test(const PatternSet* shard, const ErrorFunction* errorFunction, bool id=false, int threads=1) throw (NPPException);
+    
+    /** sums up the derivatives of the net over all processes. Called by
+     * Net::updateWeights during train. */
+    void reduce(Net& net);
+    
+    /** creates the shard of the rank-th of size processes from a complete
+     * pattern set: every size-th pattern, starting with the rank-th. The
+     * patterns are copied; the caller has to delete the shard. */
+    static PatternSet* createShard(const PatternSet& pattern, int rank, int size);
+    
+  protected:
+    Net* net;
+    Communicator* communicator;
+    std::vector<FTYPE> buffer;  ///< derivatives of all layers, exchanged in one allreduce
+  };
+  
+}
+
+#endif
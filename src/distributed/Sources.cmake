@@ -0,0 +1,12 @@
+include_directories(${NPP2_SOURCE_DIR}/distributed)
+LIST(APPEND distributed_srcs 
+	${NPP2_SOURCE_DIR}/distributed/Communicator.cpp
+	${NPP2_SOURCE_DIR}/distributed/DistributedTrainer.cpp
+	${NPP2_SOURCE_DIR}/distributed/UnixSocketCommunicator.cpp
+) 
+
+LIST(APPEND distributed_headers
+	${NPP2_SOURCE_DIR}/distributed/Communicator.h
+	${NPP2_SOURCE_DIR}/distributed/DistributedTrainer.h
+	${NPP2_SOURCE_DIR}/distributed/UnixSocketCommunicator.h
+)
@@ -0,0 +1,232 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  UnixSocketCommunicator.cpp
+ */
+
+#include "UnixSocketCommunicator.h"
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
+
+using namespace NPP2;
+using namespace std;
+
+#define CONNECT_RETRY_US 10000   // waiting time between two attempts to reach the next process
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0           // the sockets have SO_NOSIGPIPE set instead
+#endif
+
+enum { RING_MAGIC = 0x4e505052 }; ///< "NPPR", sent with the rank when connecting to the next process
+
+static double currentTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static string errorText(const string& message)
+{
+  return message + ": " + strerror(errno);
+}
+
+static string socketName(const string& basePath, int rank)
+{
+  ostringstream name;
+  name << basePath << "." << rank;
+  return name.str();
+}
+
+static void makeAddress(const string& path, struct sockaddr_un* address) throw (NPPException)
+{
+  memset(address, 0, sizeof(*address));
+  if (path.size() >= sizeof(address->sun_path)) {
+    throw NPPException("The path of the socket is too long: " + path);
+  }
+  address->sun_family = AF_UNIX;
+  strcpy(address->sun_path, path.c_str());
+}
+
+
+UnixSocketCommunicator::UnixSocketCommunicator(const std::string& basePath, int rank, int size, double timeout) throw (NPPException)
+: rank(rank), size(size), nextFd(-1), previousFd(-1)
+{
+  if (size < 1 || rank < 0 || rank >= size) {
+    throw NPPException("Invalid rank or number of processes.");
+  }
+  if (size > 1) {
+    connectRing(basePath, timeout);
+  }
+}
+
+UnixSocketCommunicator::~UnixSocketCommunicator()
+{
+  if (nextFd >= 0) close(nextFd);
+  if (previousFd >= 0) close(previousFd);
+}
+
+void UnixSocketCommunicator::connectRing(const std::string& basePath, double timeout) throw (NPPException)
+{
+  string ownPath = socketName(basePath, rank);
+  string nextPath = socketName(basePath, (rank+1) % size);
+  struct sockaddr_un ownAddress, nextAddress;
+  makeAddress(ownPath, &ownAddress);
+  makeAddress(nextPath, &nextAddress);
+  
+  // listen first, so that the previous process can connect while this one
+  // is still waiting for the next process
+  int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    throw NPPException(errorText("Could not create the socket"));
+  }
+  unlink(ownPath.c_str());   // left over by an earlier run
+  if (bind(listenFd, (struct sockaddr*) &ownAddress, sizeof(ownAddress)) < 0 ||
+      listen(listenFd, 1) < 0) {
+    string message = errorText("Could not listen on " + ownPath);
+    close(listenFd);
+    throw NPPException(message);
+  }
+  
+  double deadline = currentTime() + timeout;
+  string message;
+  
+  nextFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (nextFd < 0) {
+    message = errorText("Could not create the socket");
+  }
+  else {
+    while (connect(nextFd, (struct sockaddr*) &nextAddress, sizeof(nextAddress)) < 0) {
+      if ((errno != ENOENT && errno != ECONNREFUSED && errno != EINTR) || currentTime() > deadline) {
+        message = errorText("Could not connect to " + nextPath);
+        break;
+      }
+      usleep(CONNECT_RETRY_US);  // the next process has not started listening yet
+    }
+  }
+  if (message.empty()) {
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(nextFd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    int hello[2] = { RING_MAGIC, rank };
+    exchange(hello, sizeof(hello), 0, 0);
+    
+    struct pollfd pfd;
+    pfd.fd = listenFd;
+    pfd.events = POLLIN;
+    int remaining = (int) ((deadline - currentTime()) * 1000.);
+    int r;
+    while ((r = poll(&pfd, 1, remaining > 0 ? remaining : 0)) < 0 && errno == EINTR);
+    if (r <= 0) {
+      message = "The previous process did not connect to " + ownPath + " in time.";
+    }
+    else if ((previousFd = accept(listenFd, 0, 0)) < 0) {
+      message = errorText("Could not accept the previous process");
+    }
+    else {
+      int received[2];
+      exchange(0, 0, received, sizeof(received));
+      if (received[0] != RING_MAGIC || received[1] != (rank-1+size) % size) {
+        message = "Unexpected connection on " + ownPath;
+      }
+    }
+  }
+  
+  close(listenFd);
+  unlink(ownPath.c_str());
+  if (!message.empty()) {
+    if (nextFd >= 0) close(nextFd);
+    if (previousFd >= 0) close(previousFd);
+    nextFd = previousFd = -1;
+    throw NPPException(message);
+  }
+}
+
+void UnixSocketCommunicator::exchange(const void* toNext, size_t nextBytes, void* fromPrevious, size_t previousBytes) throw (NPPException)
+{
+  const char* sendPos = (const char*) toNext;
+  char* recvPos = (char*) fromPrevious;
+  
+  // the sockets are used without blocking, as a process blocked in send 
+  // would never empty the receive buffer its previous process is blocked on
+  while (nextBytes > 0 || previousBytes > 0) {
+    struct pollfd pfd[2];
+    int n = 0;
+    if (nextBytes > 0) {
+      pfd[n].fd = nextFd;
+      pfd[n].events = POLLOUT;
+      n++;
+    }
+    if (previousBytes > 0) {
+      pfd[n].fd = previousFd;
+      pfd[n].events = POLLIN;
+      n++;
+    }
+    if (poll(pfd, n, -1) < 0) {
+      if (errno == EINTR) continue;
+      throw NPPException(errorText("Waiting for the neighbouring processes failed"));
+    }
+    for (int i=0; i < n; i++) {
+      if (!pfd[i].revents) continue;
+      if (pfd[i].fd == nextFd) {
+        ssize_t r = send(nextFd, sendPos, nextBytes, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (r < 0) {
+          if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+          throw NPPException(errorText("Sending to the next process failed"));
+        }
+        sendPos += r;
+        nextBytes -= r;
+      }
+      else {
+        ssize_t r = recv(previousFd, recvPos, previousBytes, MSG_DONTWAIT);
+        if (r < 0) {
+          if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+          throw NPPException(errorText("Receiving from the previous process failed"));
+        }
+        if (r == 0) {
+          throw NPPException("The previous process closed the connection.");
+        }
+        recvPos += r;
+        previousBytes -= r;
+      }
+    }
+  }
+}
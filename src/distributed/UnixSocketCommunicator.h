@@ -0,0 +1,79 @@
+#ifndef _NPP2_UNIXSOCKETCOMMUNICATOR_H_
+#define _NPP2_UNIXSOCKETCOMMUNICATOR_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  UnixSocketCommunicator.h
+ *
+ *  Communicator connecting the processes of a distributed training run on
+ *  the same host with Unix domain sockets.
+ */
+
+#include <string>
+#include "Communicator.h"
+
+namespace NPP2 {
+  
+  /** Connects the processes of the ring with Unix domain (stream) sockets.
+   * Each process listens on basePath.rank, connects to the socket of the 
+   * next process and accepts the connection of the previous process. The
+   * processes may be started in any order; the constructor waits for the
+   * neighbours up to the given timeout. The socket files are removed as 
+   * soon as the ring has been established. */
+  class UnixSocketCommunicator : public Communicator {
+  public:
+    /** establishes the connections to the neighbours of the process rank
+     * in a ring of size processes. Throws an exception, if the neighbours 
+     * could not be reached within timeout seconds. */
+    UnixSocketCommunicator(const std::string& basePath, int rank, int size, double timeout=30.) throw (NPPException);
+    /** closes the connections */
+    ~UnixSocketCommunicator();
+    
+    int getRank() const { return rank; }
+    int getSize() const { return size; }
+    
+    void exchange(const void* toNext, size_t nextBytes, void* fromPrevious, size_t previousBytes) throw (NPPException);
+    
+  protected:
+    int rank;
+    int size;
+    int nextFd;       ///< connection to the next process (sending)
+    int previousFd;   ///< connection from the previous process (receiving)
+    
+    void connectRing(const std::string& basePath, double timeout) throw (NPPException);
+  };
+  
+}
+
+#endif
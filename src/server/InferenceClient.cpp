@@ -0,0 +1,115 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: InferenceClient.cpp
+ */
+
+#include "InferenceClient.h"
+#include "InferenceProtocol.h"
+#include <cstring>
+#include <sys/un.h>
+
+using namespace NPP2;
+using namespace std;
+
+InferenceClient::InferenceClient()
+: fd(-1), inCount(0), outCount(0)
+{}
+
+InferenceClient::~InferenceClient()
+{
+  close();
+}
+
+void InferenceClient::connect(const std::string& socketPath) throw (NPPException)
+{
+  close();
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    throw NPPException("The path of the socket is too long: " + socketPath);
+  }
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socketPath.c_str());
+  
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    throw NPPException(string("Could not create the socket: ") + strerror(errno));
+  }
+  if (::connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+    string message = string("Could not connect to ") + socketPath + ": " + strerror(errno);
+    close();
+    throw NPPException(message);
+  }
+  setNoSigPipe(fd);
+  
+  InferenceHandshake handshake;
+  if (!readFully(fd, &handshake, sizeof(handshake)) || handshake.magic != INFERENCE_MAGIC) {
+    close();
+    throw NPPException("No inference server is listening on " + socketPath);
+  }
+  inCount = handshake.inCount;
+  outCount = handshake.outCount;
+}
+
+void InferenceClient::close()
+{
+  if (fd >= 0) {
+    ::close(fd);
+    fd = -1;
+  }
+}
+
+void InferenceClient::forwardPass(const FTYPE* inVec, FTYPE* outVec) throw (NPPException)
+{
+  if (fd < 0) {
+    throw NPPException("The inference client is not connected.");
+  }
+  InferenceMessageHeader header;
+  header.magic = INFERENCE_MAGIC;
+  header.count = inCount;
+  if (!writeFully(fd, &header, sizeof(header)) ||
+      !writeFully(fd, inVec, sizeof(FTYPE) * inCount) ||
+      !readFully(fd, &header, sizeof(header))) {
+    close();
+    throw NPPException("Lost the connection to the inference server.");
+  }
+  if (header.magic != INFERENCE_MAGIC || header.count != outCount) {
+    close();
+    throw NPPException("The inference server could not answer the request.");
+  }
+  if (!readFully(fd, outVec, sizeof(FTYPE) * outCount)) {
+    close();
+    throw NPPException("Lost the connection to the inference server.");
+  }
+}
@@ -0,0 +1,86 @@
+#ifndef _NPP2_INFERENCECLIENT_H_
+#define _NPP2_INFERENCECLIENT_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: InferenceClient.h
+ *
+ *  Client of the inference server (InferenceServer) on the same host.
+ */
+
+#include <string>
+#include "functions.h"
+#include "NPPException.h"
+
+namespace NPP2 {
+  
+  /** Sends patterns to an inference server over its Unix domain socket and
+   * receives the outputs of the served net. Each client holds one 
+   * connection and sends one request at a time; concurrent requests need 
+   * several clients (e.g. one per thread), which the server batches. */
+  class InferenceClient {
+  public:
+    InferenceClient();
+    ~InferenceClient();  ///< closes the connection
+    
+    /** connects to the server listening on the given socket and receives
+     * the sizes of the net's input and output. */
+    void connect(const std::string& socketPath) throw (NPPException);
+    /** closes the connection */
+    void close();
+    bool isConnected() const { return fd >= 0; } ///< true, while connected to a server
+    
+    int getInCount() const { return inCount; }   ///< number of inputs of the served net
+    int getOutCount() const { return outCount; } ///< number of outputs of the served net
+    
+    /** propagates one pattern through the served net. Blocks until the 
+     * server has answered. Closes the connection and throws an exception, 
+     * if the server does not answer.
+     * \param[in] inVec getInCount() input values
+     * \param[out] outVec receives getOutCount() output values */
+    void forwardPass(const FTYPE* inVec, FTYPE* outVec) throw (NPPException);
+    
+  protected:
+    int fd;
+    int inCount;
+    int outCount;
+    
+  private:
+    InferenceClient(const InferenceClient&);            ///< not copyable
+    InferenceClient& operator=(const InferenceClient&); ///< not copyable
+  };
+  
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef _NPP2_INFERENCEPROTOCOL_H_
+#define _NPP2_INFERENCEPROTOCOL_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: InferenceProtocol.h
+ *
+ *  Messages exchanged between the inference server and its clients over a
+ *  Unix domain (stream) socket. After accepting a connection, the server 
+ *  sends a Handshake with the sizes of the net's input and output layers.
+ *  Then, the client sends requests, each consisting of a MessageHeader 
+ *  followed by count input values, and the server answers each request 
+ *  with a MessageHeader followed by count output values. A negative count
+ *  in an answer signals an error; the server closes the connection then.
+ *  All values are sent in the host's native representation, as client and
+ *  server always run on the same host.
+ */
+
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace NPP2 {
+  
+  enum { INFERENCE_MAGIC = 0x4e505032 }; ///< "NPP2", starts each message
+  
+  /** first message of the server on each connection */
+  struct InferenceHandshake {
+    int magic;              ///< INFERENCE_MAGIC
+    int inCount;            ///< number of inputs expected in each request
+    int outCount;           ///< number of outputs sent in each answer
+  };
+  
+  /** header of each request and answer */
+  struct InferenceMessageHeader {
+    int magic;              ///< INFERENCE_MAGIC
+    int count;              ///< number of values following the header, negative for errors
+  };
+  
+  /** reads exactly n bytes from the socket. Returns false on errors and if
+   * the connection has been closed before. */
+  inline bool readFully(int fd, void* buffer, size_t n)
+  {
+    char* pos = (char*) buffer;
+    while (n > 0) {
+      ssize_t r = ::recv(fd, pos, n, 0);
+      if (r < 0 && errno == EINTR) continue;
+      if (r <= 0) return false;
+      pos += r;
+      n -= r;
+    }
+    return true;
+  }
+  
+  /** writes exactly n bytes to the socket. Returns false on errors. Does
+   * not raise SIGPIPE, if the other side has closed the connection. */
+  inline bool writeFully(int fd, const void* buffer, size_t n)
+  {
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;    // the sockets have SO_NOSIGPIPE set instead
+#endif
+    const char* pos = (const char*) buffer;
+    while (n > 0) {
+      ssize_t w = ::send(fd, pos, n, flags);
+      if (w < 0 && errno == EINTR) continue;
+      if (w <= 0) return false;
+      pos += w;
+      n -= w;
+    }
+    return true;
+  }
+  
+  /** prevents SIGPIPE on sockets, where send does not know MSG_NOSIGNAL */
+  inline void setNoSigPipe(int fd)
+  {
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+  }
+  
+}
+
+#endif
@@ -0,0 +1,399 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: InferenceServer.cpp
+ */
+
+#include "InferenceServer.h"
+#include "InferenceProtocol.h"
+#include <cstring>
+#include <iostream>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <poll.h>
+
+using namespace NPP2;
+using namespace std;
+
+#define ACCEPT_POLL_MS 100   // the accepting thread checks for stop requests and finished connections this often
+
+static double currentTime()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+static string errorText(const string& message)
+{
+  return message + ": " + strerror(errno);
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Construction and configuration
+#endif
+
+InferenceServer::InferenceServer(const std::string& netFile) throw (NPPException)
+: net(new Net()), ownsNet(true)
+{
+  try {
+    net->loadNet(netFile);
+  }
+  catch (NPPException&) {
+    delete net;
+    throw;
+  }
+  init();
+}
+
+InferenceServer::InferenceServer(Net* net)
+: net(net), ownsNet(false)
+{
+  init();
+}
+
+void InferenceServer::init()
+{
+  maxBatch = 32;
+  latencyBudget = 1000;
+  listenFd = -1;
+  running = stopping = false;
+  numRequests = numBatches = 0;
+  pthread_mutex_init(&mutex, 0);
+  pthread_cond_init(&arrived, 0);
+  pthread_cond_init(&answered, 0);
+}
+
+InferenceServer::~InferenceServer()
+{
+  stop();
+  pthread_cond_destroy(&answered);
+  pthread_cond_destroy(&arrived);
+  pthread_mutex_destroy(&mutex);
+  if (ownsNet) {
+    delete net;
+  }
+}
+
+void InferenceServer::setMaxBatch(int maxBatch)
+{
+  pthread_mutex_lock(&mutex);
+  this->maxBatch = maxBatch < 1 ? 1 : maxBatch;
+  pthread_mutex_unlock(&mutex);
+}
+
+void InferenceServer::setLatencyBudget(int microseconds)
+{
+  pthread_mutex_lock(&mutex);
+  latencyBudget = microseconds < 0 ? 0 : microseconds;
+  pthread_mutex_unlock(&mutex);
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Starting and stopping
+#endif
+
+void InferenceServer::start(const std::string& socketPath) throw (NPPException)
+{
+  if (running) {
+    throw NPPException("The inference server is already running.");
+  }
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  if (socketPath.size() >= sizeof(address.sun_path)) {
+    throw NPPException("The path of the socket is too long: " + socketPath);
+  }
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, socketPath.c_str());
+  
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    throw NPPException(errorText("Could not create the socket"));
+  }
+  unlink(socketPath.c_str());   // a socket left over by an earlier server
+  if (bind(listenFd, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+      listen(listenFd, SOMAXCONN) < 0) {
+    string message = errorText("Could not listen on " + socketPath);
+    close(listenFd); listenFd = -1;
+    throw NPPException(message);
+  }
+  this->socketPath = socketPath;
+  
+  stopping = false;
+  numRequests = numBatches = 0;
+  if (pthread_create(&batchThreadId, 0, batchThread, this) != 0) {
+    close(listenFd); listenFd = -1;
+    unlink(socketPath.c_str());
+    throw NPPException("Could not start the thread propagating the batches.");
+  }
+  if (pthread_create(&acceptThreadId, 0, acceptThread, this) != 0) {
+    pthread_mutex_lock(&mutex);
+    stopping = true;
+    pthread_cond_broadcast(&arrived);
+    pthread_mutex_unlock(&mutex);
+    pthread_join(batchThreadId, 0);
+    close(listenFd); listenFd = -1;
+    unlink(socketPath.c_str());
+    throw NPPException("Could not start the thread accepting connections.");
+  }
+  running = true;
+}
+
+void InferenceServer::stop()
+{
+  if (!running) return;
+  
+  pthread_mutex_lock(&mutex);
+  stopping = true;                     // fails all pending and further requests
+  pthread_cond_broadcast(&arrived);
+  pthread_mutex_unlock(&mutex);
+  
+  pthread_join(acceptThreadId, 0);     // no new connections from now on
+  pthread_join(batchThreadId, 0);
+  
+  for (list<Connection*>::iterator i=connections.begin(); i != connections.end(); ++i) {
+    shutdown((*i)->fd, SHUT_RDWR);     // wakes up threads waiting for requests
+  }
+  for (list<Connection*>::iterator i=connections.begin(); i != connections.end(); ++i) {
+    pthread_join((*i)->threadId, 0);
+    close((*i)->fd);
+    delete *i;
+  }
+  connections.clear();
+  
+  close(listenFd); listenFd = -1;
+  unlink(socketPath.c_str());
+  running = false;
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Connections
+#endif
+
+void* InferenceServer::acceptThread(void* arg)
+{
+  ((InferenceServer*) arg)->acceptConnections();
+  return 0;
+}
+
+// the list of connections is only changed by this thread, as long as the
+// server is running. the connection threads just mark themselves finished.
+void InferenceServer::acceptConnections()
+{
+  while (true) {
+    pthread_mutex_lock(&mutex);
+    bool done = stopping;
+    list<Connection*> finished;
+    for (list<Connection*>::iterator i=connections.begin(); !done && i != connections.end(); ) {
+      if ((*i)->finished) {
+        finished.push_back(*i);
+        i = connections.erase(i);
+      }
+      else {
+        ++i;
+      }
+    }
+    pthread_mutex_unlock(&mutex);
+    if (done) break;
+    
+    for (list<Connection*>::iterator i=finished.begin(); i != finished.end(); ++i) {
+      pthread_join((*i)->threadId, 0);
+      close((*i)->fd);
+      delete *i;
+    }
+    
+    struct pollfd request;
+    request.fd = listenFd;
+    request.events = POLLIN;
+    request.revents = 0;
+    if (poll(&request, 1, ACCEPT_POLL_MS) <= 0) continue;
+    
+    int fd = accept(listenFd, 0, 0);
+    if (fd < 0) continue;
+    setNoSigPipe(fd);
+    
+    Connection* connection = new Connection;
+    connection->server = this;
+    connection->fd = fd;
+    connection->finished = false;
+    if (pthread_create(&connection->threadId, 0, connectionThread, connection) != 0) {
+      cerr << "InferenceServer: could not start a thread for a new connection." << endl;
+      close(fd);
+      delete connection;
+      continue;
+    }
+    connections.push_back(connection);
+  }
+}
+
+void* InferenceServer::connectionThread(void* arg)
+{
+  Connection* connection = (Connection*) arg;
+  connection->server->serveConnection(connection);
+  return 0;
+}
+
+void InferenceServer::serveConnection(Connection* connection)
+{
+  const Net::TopologyData& topo = net->getTopologyData();
+  int fd = connection->fd;
+  
+  InferenceHandshake handshake;
+  handshake.magic = INFERENCE_MAGIC;
+  handshake.inCount = topo.inCount;
+  handshake.outCount = topo.outCount;
+  
+  InferenceMessageHeader error;
+  error.magic = INFERENCE_MAGIC;
+  error.count = -1;
+  
+  vector<FTYPE> in(topo.inCount);
+  vector<FTYPE> out(topo.outCount);
+  
+  InferenceMessageHeader header;
+  if (writeFully(fd, &handshake, sizeof(handshake))) {
+    while (readFully(fd, &header, sizeof(header))) {
+      if (header.magic != INFERENCE_MAGIC || header.count != topo.inCount) {
+        if (header.magic == INFERENCE_MAGIC) {   // the client expects another net: skip its input, so that it receives the error
+          for (int skipped=0; skipped < header.count && readFully(fd, &in[0], sizeof(FTYPE)); skipped++) ;
+        }
+        writeFully(fd, &error, sizeof(error));
+        break;
+      }
+      if (!readFully(fd, &in[0], sizeof(FTYPE) * topo.inCount)) break;
+      
+      Request request;
+      request.in = &in[0];
+      request.out = &out[0];
+      request.arrival = currentTime();
+      request.done = request.failed = false;
+      
+      pthread_mutex_lock(&mutex);
+      if (stopping) {
+        request.done = request.failed = true;
+      }
+      else {
+        queue.push_back(&request);
+        pthread_cond_signal(&arrived);
+      }
+      while (!request.done) {
+        pthread_cond_wait(&answered, &mutex);
+      }
+      pthread_mutex_unlock(&mutex);
+      
+      if (request.failed) {
+        writeFully(fd, &error, sizeof(error));
+        break;
+      }
+      header.count = topo.outCount;
+      if (!writeFully(fd, &header, sizeof(header)) ||
+          !writeFully(fd, &out[0], sizeof(FTYPE) * topo.outCount)) break;
+    }
+  }
+  pthread_mutex_lock(&mutex);
+  connection->finished = true;   // the socket is closed by the accepting thread
+  pthread_mutex_unlock(&mutex);
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Batching
+#endif
+
+void* InferenceServer::batchThread(void* arg)
+{
+  ((InferenceServer*) arg)->propagateBatches();
+  return 0;
+}
+
+void InferenceServer::propagateBatches()
+{
+  const Net::TopologyData& topo = net->getTopologyData();
+  vector<Request*> batch;
+  
+  pthread_mutex_lock(&mutex);
+  while (true) {
+    while (queue.empty() && !stopping) {
+      pthread_cond_wait(&arrived, &mutex);
+    }
+    // waits for further requests until the batch is full or the oldest 
+    // request has used up its latency budget
+    double deadline = stopping ? 0. : queue.front()->arrival + latencyBudget * 1e-6;
+    while (!stopping && (int) queue.size() < maxBatch) {
+      double now = currentTime();
+      if (now >= deadline) break;
+      struct timespec timeout;
+      timeout.tv_sec = (time_t) deadline;
+      timeout.tv_nsec = (long) ((deadline - timeout.tv_sec) * 1e9);
+      pthread_cond_timedwait(&arrived, &mutex, &timeout);
+    }
+    if (stopping) break;
+    
+    int n = (int) queue.size() < maxBatch ? (int) queue.size() : maxBatch;
+    batch.assign(queue.begin(), queue.begin()+n);
+    queue.erase(queue.begin(), queue.begin()+n);
+    pthread_mutex_unlock(&mutex);
+    
+    batchIn.resize((size_t) n * topo.inCount);
+    batchOut.resize((size_t) n * topo.outCount);
+    for (int i=0; i < n; i++) {
+      memcpy(&batchIn[i*topo.inCount], batch[i]->in, sizeof(FTYPE) * topo.inCount);
+    }
+    net->forwardPassBatch(&batchIn[0], &batchOut[0], n);
+    for (int i=0; i < n; i++) {
+      memcpy(batch[i]->out, &batchOut[i*topo.outCount], sizeof(FTYPE) * topo.outCount);
+    }
+    
+    pthread_mutex_lock(&mutex);
+    for (int i=0; i < n; i++) {
+      batch[i]->done = true;
+    }
+    numRequests += n;
+    numBatches++;
+    pthread_cond_broadcast(&answered);
+  }
+  
+  for (unsigned int i=0; i < queue.size(); i++) {  // stopping: the pending requests will not be answered
+    queue[i]->done = queue[i]->failed = true;
+  }
+  queue.clear();
+  pthread_cond_broadcast(&answered);
+  pthread_mutex_unlock(&mutex);
+}
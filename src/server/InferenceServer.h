@@ -0,0 +1,152 @@
+#ifndef _NPP2_INFERENCESERVER_H_
+#define _NPP2_INFERENCESERVER_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: InferenceServer.h
+ *
+ *  Local inference server answering the requests of several clients with 
+ *  one net. Concurrent requests are coalesced into micro batches that are 
+ *  propagated at once (Net::forwardPassBatch). A batch is propagated as 
+ *  soon as it is full or the oldest request has waited for the latency 
+ *  budget. The server listens on a Unix domain socket; see 
+ *  InferenceProtocol.h for the messages and InferenceClient for a client.
+ */
+
+#include <string>
+#include <deque>
+#include <list>
+#include <vector>
+#include <pthread.h>
+#include "npp2.h"
+#include "NPPException.h"
+
+namespace NPP2 {
+  
+  /** Serves a net over a Unix domain socket. Each connection is handled by
+   * a thread of its own that reads the requests of its client and waits 
+   * for their answers, while a single thread propagates the batches. */
+  class InferenceServer {
+  public:
+    /** constructs a server for the net loaded from the given file. */
+    InferenceServer(const std::string& netFile) throw (NPPException);
+    /** constructs a server for the given net, that has to be connected. The
+     * net is not deleted by the server and must not be used otherwise, while
+     * the server is running. */
+    InferenceServer(Net* net);
+    /** stops the server and deletes the net, if it has been loaded */
+    ~InferenceServer();
+    
+    /** sets the maximal number of requests propagated in one batch */
+    void setMaxBatch(int maxBatch);
+    int getMaxBatch() const { return maxBatch; }  ///< returns the maximal size of a batch
+    /** sets the time (in microseconds) the oldest request waits for further
+     * requests, before an incomplete batch is propagated. 0 propagates the
+     * requests that are pending, without waiting. */
+    void setLatencyBudget(int microseconds);
+    int getLatencyBudget() const { return latencyBudget; } ///< returns the latency budget in microseconds
+    
+    /** creates the socket at the given path (an existing socket file is 
+     * replaced) and starts the threads answering the requests. Returns 
+     * immediately. */
+    void start(const std::string& socketPath) throw (NPPException);
+    /** closes all connections and the socket and stops all threads. Pending
+     * requests are answered with an error. */
+    void stop();
+    bool isRunning() const { return running; }  ///< true between start and stop
+    
+    long getNumRequests() const { return numRequests; } ///< number of requests answered since start
+    long getNumBatches() const { return numBatches; }   ///< number of batches propagated since start
+    
+    const Net* getNet() const { return net; }    ///< returns the served net
+    
+  protected:
+    /** a request of a client, waiting for its answer */
+    struct Request {
+      const FTYPE* in;        ///< input of the net
+      FTYPE* out;             ///< receives the output of the net
+      double arrival;         ///< time of arrival in seconds
+      bool done;              ///< true, as soon as out holds the answer
+      bool failed;            ///< true, if the request could not be answered
+    };
+    
+    /** a connection to a client and the thread reading its requests */
+    struct Connection {
+      InferenceServer* server;
+      int fd;
+      pthread_t threadId;
+      bool finished;          ///< set by the thread, before it terminates
+    };
+    
+    Net* net;
+    bool ownsNet;             ///< true, if the net has been loaded by the server
+    int maxBatch;
+    int latencyBudget;
+    
+    std::string socketPath;
+    int listenFd;
+    bool running;
+    bool stopping;            ///< set to terminate all threads
+    pthread_t acceptThreadId;
+    pthread_t batchThreadId;
+    
+    pthread_mutex_t mutex;    ///< protects the queue, the requests, the statistics and the flags of the threads
+    pthread_cond_t arrived;   ///< signalled for each new request
+    pthread_cond_t answered;  ///< broadcasted after each batch
+    std::deque<Request*> queue;
+    std::list<Connection*> connections; ///< open connections, owned by the thread accepting connections
+    
+    long numRequests;
+    long numBatches;
+    
+    std::vector<FTYPE> batchIn;  ///< inputs of the present batch
+    std::vector<FTYPE> batchOut; ///< outputs of the present batch
+    
+    void init();
+    
+    static void* acceptThread(void* arg);      ///< static hook of the thread accepting connections
+    void acceptConnections();                  ///< accepts connections and reaps finished connection threads
+    static void* connectionThread(void* arg);  ///< static hook of the threads of the connections
+    void serveConnection(Connection* connection); ///< reads the requests of one client and sends the answers
+    static void* batchThread(void* arg);       ///< static hook of the thread propagating the batches
+    void propagateBatches();                   ///< collects and propagates batches, until the server stops
+    
+  private:
+    InferenceServer(const InferenceServer&);            ///< not copyable
+    InferenceServer& operator=(const InferenceServer&); ///< not copyable
+  };
+  
+}
+
+#endif
@@ -0,0 +1,11 @@
+include_directories(${NPP2_SOURCE_DIR}/server)
+LIST(APPEND server_srcs 
+	${NPP2_SOURCE_DIR}/server/InferenceClient.cpp
+	${NPP2_SOURCE_DIR}/server/InferenceServer.cpp
+) 
+
+LIST(APPEND server_headers
+	${NPP2_SOURCE_DIR}/server/InferenceClient.h
+	${NPP2_SOURCE_DIR}/server/InferenceProtocol.h
+	${NPP2_SOURCE_DIR}/server/InferenceServer.h
+)
@@ -0,0 +1,194 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: Arena.cpp
+ */
+
+#include "Arena.h"
+#include <cstdlib>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define NPP2_MMAP    // chunks are mapped anonymously
+#endif
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+using namespace NPP2;
+using namespace std;
+
+#define MIN_CHUNK  (4 << 20)   // size of chunks created on demand
+#define HUGE_PAGE  (2 << 20)   // chunks backed by huge pages are multiples of this size
+
+const size_t Arena::ALIGNMENT;
+
+
+static inline size_t alignUp(size_t bytes, size_t alignment)
+{
+  return (bytes + alignment - 1) / alignment * alignment;
+}
+
+
+Arena::Arena() : allocated(0), pageMode(PAGES_DEFAULT), clearing(false)
+{}
+
+Arena::~Arena()
+{
+  clear();
+}
+
+void Arena::addChunk(size_t bytes)
+{
+  Chunk chunk;
+  chunk.top = 0;
+  chunk.size = alignUp(bytes, pageMode == PAGES_DEFAULT ? 4096 : HUGE_PAGE);
+  chunk.base = 0;
+  chunk.mapped = false;
+  
+#ifdef NPP2_MMAP
+  void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  if (pageMode == PAGES_EXPLICIT_HUGE) {
+    p = mmap(0, chunk.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  }
+#endif
+  if (p == MAP_FAILED) {
+    p = mmap(0, chunk.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+    if (p != MAP_FAILED && pageMode != PAGES_DEFAULT) {
+      madvise(p, chunk.size, MADV_HUGEPAGE);   // only a hint, ignore failures
+    }
+#endif
+  }
+  if (p != MAP_FAILED) {
+    chunk.base = (char*) p;
+    chunk.mapped = true;
+  }
+#endif
+  
+  if (!chunk.base) {
+    void* p = 0;
+    if (posix_memalign(&p, ALIGNMENT, chunk.size) != 0) {
+      cerr << "ERROR: Could not allocate " << chunk.size << " bytes for the buffers of the net." << endl;
+      exit(1);
+    }
+    chunk.base = (char*) p;
+  }
+  chunks.push_back(chunk);
+}
+
+void Arena::reserve(size_t bytes)
+{
+  bytes = alignUp(bytes, ALIGNMENT);
+  if (chunks.size() && chunks.back().size - chunks.back().top >= bytes) {
+    return;
+  }
+  addChunk(bytes);
+}
+
+void* Arena::allocate(size_t bytes)
+{
+  bytes = alignUp(bytes > 0 ? bytes : 1, ALIGNMENT);
+  
+  char* p = 0;
+  multimap<size_t, char*>::iterator it = freeList.lower_bound(bytes);
+  if (it != freeList.end() && it->first <= 2 * bytes) {  // reuse a freed buffer that is not much larger
+    p = it->second;
+    bytes = it->first;
+    freeList.erase(it);
+  }
+  else {
+    if (!chunks.size() || chunks.back().size - chunks.back().top < bytes) {
+      addChunk(bytes > MIN_CHUNK ? bytes : MIN_CHUNK);
+    }
+    Chunk& chunk = chunks.back();
+    p = chunk.base + chunk.top;
+    chunk.top += bytes;
+  }
+  used[p] = bytes;
+  allocated += bytes;
+  return p;
+}
+
+void Arena::free(void* buffer)
+{
+  if (!buffer || clearing) return;  // clear will release the buffer with its chunk
+  map<char*, size_t>::iterator it = used.find((char*) buffer);
+  if (it == used.end()) {
+    cerr << "ERROR: Buffer has not been allocated by this arena." << endl;
+    exit(1);
+  }
+  
+#if defined(NPP2_MMAP) && defined(MADV_DONTNEED)
+  // give the complete pages inside a large buffer back to the system. they
+  // are mapped again (zero-filled) when the buffer is reused.
+  size_t begin = alignUp((size_t) it->first, 4096);
+  size_t end = ((size_t) it->first + it->second) / 4096 * 4096;
+  if (end > begin) {
+    madvise((void*) begin, end - begin, MADV_DONTNEED);
+  }
+#endif
+  freeList.insert(make_pair(it->second, it->first));
+  allocated -= it->second;
+  used.erase(it);
+}
+
+void Arena::clear()
+{
+  for (unsigned int i=0; i < chunks.size(); i++) {
+#ifdef NPP2_MMAP
+    if (chunks[i].mapped) {
+      munmap(chunks[i].base, chunks[i].size);
+      continue;
+    }
+#endif
+    std::free(chunks[i].base);
+  }
+  chunks.clear();
+  freeList.clear();
+  used.clear();
+  allocated = 0;
+  clearing = false;
+}
+
+size_t Arena::getCapacity() const
+{
+  size_t capacity = 0;
+  for (unsigned int i=0; i < chunks.size(); i++) {
+    capacity += chunks[i].size;
+  }
+  return capacity;
+}
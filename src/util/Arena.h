@@ -0,0 +1,128 @@
+#ifndef _NPP2_ARENA_H_
+#define _NPP2_ARENA_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: Arena.h
+ *
+ *  Memory arena of a net. All buffers of the layers (activations of all
+ *  copies, weights, deltas, derivatives and variables of the update 
+ *  function) are carved from a few large chunks instead of being allocated
+ *  individually. Each buffer starts at a 64-byte boundary (cache line, 
+ *  AVX-512 vector). The chunks may be backed by (transparent or explicit) 
+ *  huge pages. Freed buffers are kept in a free list and reused by later
+ *  allocations; the chunks themselves are only released all at once.
+ */
+
+#include <cstddef>
+#include <map>
+#include <vector>
+
+namespace NPP2 {
+  
+  /** Chunked bump allocator with 64-byte aligned buffers. Not thread-safe;
+   * buffers are only allocated and freed while (re-)building the structure
+   * of a net. */
+  class Arena {
+  public:
+    /** how the pages of the chunks are backed */
+    enum PageMode {
+      PAGES_DEFAULT=0,        ///< normal pages
+      PAGES_TRANSPARENT_HUGE, ///< normal mapping advised to use transparent huge pages (madvise(MADV_HUGEPAGE), Linux)
+      PAGES_EXPLICIT_HUGE     ///< explicit huge pages (MAP_HUGETLB, Linux). Falls back to transparent huge pages, if no huge pages are configured.
+    };
+    
+    static const size_t ALIGNMENT = 64;     ///< alignment of each buffer
+    
+    /** makes sure that at least the given number of bytes can be allocated
+     * without creating another chunk. Call this with the expected size of
+     * all buffers before allocating them, in order to get a single chunk. */
+    void reserve(size_t bytes);
+    /** returns a 64-byte aligned buffer of the given size. The contents of
+     * the buffer are undefined. */
+    void* allocate(size_t bytes);
+    /** returns a buffer to the free list of the arena. The buffer must have 
+     * been allocated by this arena. The memory of the complete pages of 
+     * large buffers is returned to the system immediately. */
+    void free(void* buffer);
+    /** returns true, if the given buffer has been allocated by this arena 
+     * and not yet freed. */
+    bool owns(const void* buffer) const { return used.find((char*) buffer) != used.end(); }
+    /** releases all chunks at once. All buffers allocated by this arena
+     * become invalid. */
+    void clear();
+    /** lets free ignore all buffers until the next call of clear. Call this
+     * before destroying everything that holds buffers of the arena, so that
+     * clear releases them at once instead of one by one. */
+    void beginClear() { clearing = true; }
+    bool isClearing() const { return clearing; } ///< returns true between beginClear and clear
+    
+    /** sets how the pages of the following chunks are backed. Has to be set
+     * before allocating any buffers to affect all of them. */
+    void setPageMode(PageMode mode) { pageMode = mode; }
+    PageMode getPageMode() const { return pageMode; }
+    
+    size_t getCapacity() const;                       ///< returns the bytes of all chunks
+    size_t getAllocated() const { return allocated; } ///< returns the bytes of all buffers in use (including the alignment)
+    int getNumChunks() const { return (int) chunks.size(); } ///< returns the number of chunks
+    
+    Arena();
+    ~Arena();
+    
+  protected:
+    /** a large, page-aligned region from which buffers are carved */
+    struct Chunk {
+      char* base;    ///< begin of the region
+      size_t size;   ///< size of the region in bytes
+      size_t top;    ///< offset of the first free byte
+      bool mapped;   ///< true, if the region has been created with mmap (and not by malloc)
+    };
+    
+    std::vector<Chunk> chunks;              ///< all chunks, the last one is used for new buffers
+    std::multimap<size_t, char*> freeList;  ///< freed buffers by their size
+    std::map<char*, size_t> used;           ///< size of all buffers in use
+    size_t allocated;                       ///< bytes of all buffers in use
+    PageMode pageMode;
+    bool clearing;                          ///< set by beginClear: free does nothing
+    
+    void addChunk(size_t bytes);            ///< creates a new chunk of at least the given size
+    
+  private:
+    Arena(const Arena&);                    ///< arenas can not be copied
+    Arena& operator=(const Arena&);
+  };
+  
+}
+
+#endif
@@ -0,0 +1,127 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: MemoryReport.cpp
+ */
+
+#include "MemoryReport.h"
+#include <iomanip>
+
+using namespace NPP2;
+using namespace std;
+
+static const char* kindNames[MEMORY_NUM_KINDS] = { "weights", "delta", "dEdw", "variables", "activations", "connections" };
+
+
+MemoryUsage::MemoryUsage() : identifier(""), complete(true)
+{
+  for (int k=0; k < MEMORY_NUM_KINDS; k++) {
+    bytes[k] = 0;
+  }
+}
+
+size_t MemoryUsage::getTotal() const
+{
+  size_t total = 0;
+  for (int k=0; k < MEMORY_NUM_KINDS; k++) {
+    total += bytes[k];
+  }
+  return total;
+}
+
+
+MemoryReport::MemoryReport() : netBytes(0), numCopies(0), estimated(false)
+{}
+
+size_t MemoryReport::getTotal() const
+{
+  size_t total = netBytes;
+  for (unsigned int l=0; l < layers.size(); l++) {
+    total += layers[l].getTotal();
+  }
+  return total;
+}
+
+size_t MemoryReport::getTotal(MemoryKind kind) const
+{
+  size_t total = 0;
+  for (unsigned int l=0; l < layers.size(); l++) {
+    total += layers[l].bytes[kind];
+  }
+  return total;
+}
+
+bool MemoryReport::isComplete() const
+{
+  for (unsigned int l=0; l < layers.size(); l++) {
+    if (!layers[l].complete) return false;
+  }
+  return true;
+}
+
+const char* MemoryReport::getKindName(MemoryKind kind)
+{
+  return kind >= 0 && kind < MEMORY_NUM_KINDS ? kindNames[kind] : "unknown";
+}
+
+void MemoryReport::writeToStream(ostream& out) const
+{
+  out << (estimated ? "Estimated" : "Allocated") << " memory for " << numCopies 
+      << " copies (KiB):" << endl;
+  out << setw(6) << "layer" << setw(36) << "type";
+  for (int k=0; k < MEMORY_NUM_KINDS; k++) {
+    out << setw(13) << kindNames[k];
+  }
+  out << setw(13) << "total" << endl;
+  
+  out << fixed << setprecision(1);
+  for (unsigned int l=0; l < layers.size(); l++) {
+    out << setw(6) << l << setw(36) << layers[l].identifier;
+    for (int k=0; k < MEMORY_NUM_KINDS; k++) {
+      out << setw(13) << layers[l].bytes[k] / 1024.;
+    }
+    out << setw(13) << layers[l].getTotal() / 1024. << (layers[l].complete ? "" : "  (incomplete)") << endl;
+  }
+  out << setw(6) << "net" << setw(36) << "input / output vectors, workers";
+  for (int k=0; k < MEMORY_NUM_KINDS; k++) {
+    out << setw(13) << "";
+  }
+  out << setw(13) << netBytes / 1024. << endl;
+  out << setw(6) << "total" << setw(36) << "";
+  for (int k=0; k < MEMORY_NUM_KINDS; k++) {
+    out << setw(13) << getTotal((MemoryKind) k) / 1024.;
+  }
+  out << setw(13) << getTotal() / 1024. << endl;
+  out.unsetf(ios::floatfield);
+  out << setprecision(6);
+}
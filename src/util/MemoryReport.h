@@ -0,0 +1,108 @@
+#ifndef _NPP2_MEMORYREPORT_H_
+#define _NPP2_MEMORYREPORT_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: MemoryReport.h
+ *
+ *  Accounting of the memory used by the buffers of a net. The report breaks
+ *  down the bytes per layer and per kind of buffer (weights, their deltas,
+ *  the derivatives of all copies, the variables of the update function,
+ *  the per-copy activation vectors and the connection lists). It is either 
+ *  filled from the buffers of an existing net (Net::memoryReport) or 
+ *  predicted from a net specification before anything has been allocated
+ *  (Net::estimateMemory).
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace NPP2 {
+  
+  /** kinds of buffers that are accounted separately. */
+  enum MemoryKind {
+    MEMORY_WEIGHTS=0,    ///< the weights of the connections
+    MEMORY_DELTA,        ///< the last weight change of each weight
+    MEMORY_DEDW,         ///< derivatives of the weights, one copy per thread plus one
+    MEMORY_VARIABLES,    ///< variables of the update function (e.g. RProp's step sizes)
+    MEMORY_ACTIVATIONS,  ///< dEdo, dEdnet, out and netin of all units in all copies
+    MEMORY_CONNECTIONS,  ///< connection lists of individually connected layers
+    MEMORY_NUM_KINDS
+  };
+  
+  /** bytes used by a single layer, broken down by the kind of buffer. */
+  struct MemoryUsage {
+    std::string identifier;            ///< type of the layer
+    size_t bytes[MEMORY_NUM_KINDS];    ///< bytes per kind of buffer
+    bool complete;                     ///< false, if the size of some buffers could not be determined (e.g. estimating an individually connected layer before its connections have been added)
+    
+    /** adds the given number of values of the given size to a kind */
+    void add(MemoryKind kind, size_t count, size_t size) { bytes[kind] += count * size; }
+    /** returns the sum over all kinds */
+    size_t getTotal() const;
+    
+    MemoryUsage();
+  };
+  
+  /** per-layer, per-kind breakdown of the memory used by a net. */
+  class MemoryReport {
+  public:
+    std::vector<MemoryUsage> layers; ///< usage of each layer
+    size_t netBytes;                 ///< buffers of the net itself (input and output vectors of all copies, worker data)
+    int numCopies;                   ///< number of copies the report has been made for
+    bool estimated;                  ///< true, if the report has been predicted from a net specification
+    
+    /** returns the total number of bytes of all layers and the net */
+    size_t getTotal() const;
+    /** returns the bytes of the given kind summed over all layers */
+    size_t getTotal(MemoryKind kind) const;
+    /** returns the bytes of all kinds of the given layer */
+    size_t getLayerTotal(int layer) const { return layers[layer].getTotal(); }
+    /** returns false, if the size of the buffers of some layer is not known */
+    bool isComplete() const;
+    
+    /** writes the breakdown as a table (in KiB) to the given stream */
+    void writeToStream(std::ostream& out) const;
+    
+    /** returns a short name of the given kind of buffer */
+    static const char* getKindName(MemoryKind kind);
+    
+    MemoryReport();
+  };
+  
+}
+
+#endif
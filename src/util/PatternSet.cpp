@@ -9,6 +9,7 @@
 #include "PatternSet.h"
 #include <fstream>
 #include <iostream>
+#include <cmath>
 
 using namespace NPP2;
 using namespace std;
@@ -20,6 +21,9 @@ PatternSet::PatternSet(void)
   name = NULL;
   input = NULL;
   target = NULL;
+  sparse_index = NULL;
+  sparse_value = NULL;
+  sparse_count = NULL;
 }
 
 int PatternSet::load_pattern(const string& filename)
@@ -136,6 +140,7 @@ int PatternSet::load_pattern(const string& filename)
 PatternSet::~PatternSet()
 {
   long i;
+  delete_sparse_input();
   if (name){
     for(i=0;i < pattern_count;i++)
       if (name[i]) delete name[i];
@@ -209,3 +214,51 @@ void PatternSet::save_pattern(const string& filename)
   
   out.close();
 }
+
+
+void PatternSet::create_sparse_input(double threshold)
+{
+  int i;
+  long p;
+  
+  delete_sparse_input();
+  
+  sparse_index = new int* [pattern_count];
+  sparse_value = new double* [pattern_count];
+  sparse_count = new int [pattern_count];
+  
+  for(p=0;p<pattern_count;p++){
+    int count = 0;                      /* first pass: count non-zero inputs */
+    for(i=0;i<input_count;i++)
+      if (fabs(input[p][i]) > threshold) count++;
+    
+    sparse_count[p] = count;
+    sparse_index[p] = new int [count];
+    sparse_value[p] = new double [count];
+    
+    count = 0;                          /* second pass: store index / value pairs */
+    for(i=0;i<input_count;i++)
+      if (fabs(input[p][i]) > threshold) {
+        sparse_index[p][count] = i;
+        sparse_value[p][count] = input[p][i];
+        count++;
+      }
+  }
+}
+
+void PatternSet::delete_sparse_input()
+{
+  long p;
+  if (sparse_index){
+    for(p=0;p< pattern_count;p++){
+      delete[] sparse_index[p];
+      delete[] sparse_value[p];
+    }
+    delete[] sparse_index;
+    delete[] sparse_value;
+    delete[] sparse_count;
+  }
+  sparse_index = NULL;
+  sparse_value = NULL;
+  sparse_count = NULL;
+}
@@ -39,6 +39,10 @@ namespace NPP2 {
     char **name;            ///< list of names (each pattern can have a name)
     double **input;         ///< list of input patterns. Each entry is a vector. 
     double **target;        ///< list of taget patterns.
+    
+    int **sparse_index;     ///< optional sparse representation of the input patterns: for each pattern the indices of its non-zero inputs. NULL, if not created.
+    double **sparse_value;  ///< optional sparse representation of the input patterns: for each pattern the values of its non-zero inputs, in the order of sparse_index.
+    int *sparse_count;      ///< optional sparse representation of the input patterns: for each pattern the number of non-zero inputs.
   
     /** Default constructor for constructing an empty pattern set. */
     PatternSet(void);
@@ -54,6 +58,16 @@ namespace NPP2 {
     /** saves the pattern set to the given file. Expects a format compatible 
      to SNNS. */
     virtual void save_pattern(const std::string& filename);
+    
+    /** creates the sparse representation (index / value pairs) of all input
+     patterns from the dense input vectors. Inputs with an absolute value not
+     larger than threshold are considered to be zero. When present, the net
+     uses the sparse representation in its first layer during training and
+     testing, which saves a lot of work for mostly-zero inputs (binarized 
+     images, one-hot encodings). Call again after changing the input patterns. */
+    virtual void create_sparse_input(double threshold=0.);
+    /** deletes the sparse representation of the input patterns. */
+    virtual void delete_sparse_input();
   };
   
 }
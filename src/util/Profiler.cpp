@@ -0,0 +1,421 @@
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: Profiler.cpp
+ */
+
+#include "Profiler.h"
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define NPP2_PERF_EVENTS    // hardware counters via perf_event_open
+#endif
+
+using namespace NPP2;
+using namespace std;
+
+#define CACHE_LINE 64
+
+static const char* eventNames[PROFILE_NUM_EVENTS] = { "cycles", "instructions", "cache-misses", "llc-read-misses" };
+static const char* phaseNames[TRACE_NUM_SPANS] = { "forward", "backward", "reduce", "update", "join", "worker", "mini-batch" };
+
+Profile::Profile() : counters(0), stride(0), numLayers(0), numCopies(0), traces(0), traceCapacity(0), traceOrigin(0.), hw(0), hwEnabled(false)
+{
+  for (int e=0; e < PROFILE_NUM_EVENTS; e++) {
+    hwAvailable[e] = false;
+  }
+}
+
+Profile::~Profile()
+{
+  stopTracing();
+  for (int c=0; c <= numCopies && hw; c++) {
+    detachThread(c);
+  }
+  delete [] hw;
+  free(counters);
+}
+
+bool Profile::isEnabled()
+{
+#ifdef NPP2_PROFILING
+  return true;
+#else
+  return false;
+#endif
+}
+
+const char* Profile::getPhaseName(ProfilePhase phase)
+{
+  return phaseNames[phase];
+}
+
+void Profile::resize(int numLayers, int numCopies)
+{
+  if (numLayers == this->numLayers && numCopies == this->numCopies && counters) {
+    reset();
+    return;
+  }
+  int tracing = traces ? traceCapacity : 0;   // the buffers depend on the number of copies
+  stopTracing();
+  for (int c=0; c <= this->numCopies && hw; c++) {
+    detachThread(c);
+  }
+  delete [] hw;
+  free(counters);
+  counters = 0;
+  this->numLayers = numLayers;
+  this->numCopies = numCopies;
+  
+  stride = numLayers * PROFILE_NUM_PHASES + 1;               // one more for the finishing time
+  while ((stride * sizeof(Counter)) % CACHE_LINE) stride++;  // copies never share a cache line
+  
+  void* mem = 0;
+  if (posix_memalign(&mem, CACHE_LINE, sizeof(Counter) * stride * (numCopies+1)) != 0) {
+    cerr << "Could not allocate the counters for profiling." << endl;
+    exit(1);
+  }
+  counters = (Counter*) mem;
+  reset();
+  
+  hw = new HardwareGroup[numCopies+1];
+  for (int c=0; c <= numCopies; c++) {
+    hw[c].numOpen = 0;
+    for (int e=0; e < PROFILE_NUM_EVENTS; e++) {
+      hw[c].fd[e] = -1;
+      hw[c].slot[e] = -1;
+    }
+  }
+  
+  if (tracing) {
+    startTracing(tracing);
+  }
+}
+
+void Profile::reset()
+{
+  if (counters) {
+    memset(counters, 0, sizeof(Counter) * stride * (numCopies+1));
+  }
+}
+
+double Profile::getSeconds(int layer, ProfilePhase phase, int copy) const
+{
+  return counters ? counters[copy*stride + layer*PROFILE_NUM_PHASES + phase].seconds : 0.;
+}
+
+double Profile::getSeconds(int layer, ProfilePhase phase) const
+{
+  double sum = 0.;
+  for (int c=0; c <= numCopies && counters; c++) {
+    sum += getSeconds(layer, phase, c);
+  }
+  return sum;
+}
+
+long Profile::getCalls(int layer, ProfilePhase phase, int copy) const
+{
+  return counters ? counters[copy*stride + layer*PROFILE_NUM_PHASES + phase].calls : 0;
+}
+
+long Profile::getCalls(int layer, ProfilePhase phase) const
+{
+  long sum = 0;
+  for (int c=0; c <= numCopies && counters; c++) {
+    sum += getCalls(layer, phase, c);
+  }
+  return sum;
+}
+
+unsigned long long Profile::getEventCount(int layer, ProfilePhase phase, ProfileEvent event, int copy) const
+{
+  return counters ? counters[copy*stride + layer*PROFILE_NUM_PHASES + phase].events[event] : 0;
+}
+
+unsigned long long Profile::getEventCount(int layer, ProfilePhase phase, ProfileEvent event) const
+{
+  unsigned long long sum = 0;
+  for (int c=0; c <= numCopies && counters; c++) {
+    sum += getEventCount(layer, phase, event, c);
+  }
+  return sum;
+}
+
+double Profile::getInstructionsPerCycle(int layer, ProfilePhase phase) const
+{
+  unsigned long long cycles = getEventCount(layer, phase, PROFILE_CYCLES);
+  return cycles ? (double) getEventCount(layer, phase, PROFILE_INSTRUCTIONS) / cycles : 0.;
+}
+
+double Profile::getBandwidth(int layer, ProfilePhase phase) const
+{
+  double seconds = getSeconds(layer, phase);
+  return seconds > 0. ? getEventCount(layer, phase, PROFILE_LLC_READ_MISSES) * (double) CACHE_LINE / seconds : 0.;
+}
+
+double Profile::getTotalSeconds(ProfilePhase phase) const
+{
+  double sum = 0.;
+  for (int l=0; l < numLayers; l++) {
+    sum += getSeconds(l, phase);
+  }
+  return sum;
+}
+
+void Profile::writeToStream(ostream& out) const
+{
+  if (!isEnabled()) {
+    out << "Profiling is not available (library has been compiled without NPP2_PROFILING)." << endl;
+    return;
+  }
+  out << setw(6) << "layer";
+  for (int p=0; p < PROFILE_NUM_PHASES; p++) {
+    out << setw(14) << phaseNames[p];
+  }
+  out << "   (seconds, summed over all threads)" << endl;
+  for (int l=0; l < numLayers; l++) {
+    out << setw(6) << l;
+    for (int p=0; p < PROFILE_NUM_PHASES; p++) {
+      out << setw(14) << getSeconds(l, (ProfilePhase) p);
+    }
+    out << endl;
+  }
+  out << setw(6) << "total";
+  for (int p=0; p < PROFILE_NUM_PHASES; p++) {
+    out << setw(14) << getTotalSeconds((ProfilePhase) p);
+  }
+  out << endl;
+  
+  if (!hwEnabled) return;
+  out << endl << setw(6) << "layer" << setw(10) << "phase" << setw(8) << "ipc" 
+      << setw(16) << "cache-misses" << setw(16) << "llc-read-miss" << setw(12) << "GB/s" << endl;
+  for (int l=1; l < numLayers; l++) {
+    for (int p=PROFILE_FORWARD; p <= PROFILE_UPDATE; p++) {
+      if (!getCalls(l, (ProfilePhase) p)) continue;
+      out << setw(6) << l << setw(10) << phaseNames[p] 
+          << setw(8) << setprecision(3) << getInstructionsPerCycle(l, (ProfilePhase) p) << setprecision(6)
+          << setw(16) << getEventCount(l, (ProfilePhase) p, PROFILE_CACHE_MISSES)
+          << setw(16) << getEventCount(l, (ProfilePhase) p, PROFILE_LLC_READ_MISSES)
+          << setw(12) << getBandwidth(l, (ProfilePhase) p) * 1e-9 << endl;
+    }
+  }
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Tracing
+#endif
+
+bool Profile::startTracing(int eventsPerCopy)
+{
+  if (!isEnabled()) {
+    return false;
+  }
+  stopTracing();
+  traceCapacity = eventsPerCopy > 0 ? eventsPerCopy : 1;
+  traceOrigin = profileClock();
+  traces = new TraceBuffer[numCopies+1];
+  for (int c=0; c <= numCopies; c++) {
+    traces[c].events = new TraceEvent[traceCapacity];
+    traces[c].count = 0;
+    traces[c].capacity = traceCapacity;
+  }
+  return true;
+}
+
+void Profile::stopTracing()
+{
+  if (traces) {
+    for (int c=0; c <= numCopies; c++) {
+      delete [] traces[c].events;
+    }
+    delete [] traces;
+    traces = 0;
+  }
+}
+
+// writes complete events ("ph": "X") with time stamps in microseconds 
+// relative to the start of the tracing. copies are written as threads.
+void Profile::writeTrace(ostream& out) const
+{
+  streamsize precision = out.precision();
+  out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [" << endl;
+  out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"npp2\"}}";
+  for (int c=0; c <= numCopies && traces; c++) {
+    out << "," << endl << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << c 
+        << ", \"args\": {\"name\": \"copy " << c << (c == 0 ? " (main, updates)" : "") << "\"}}";
+    
+    const TraceBuffer& buffer = traces[c];
+    long first = buffer.count > buffer.capacity ? buffer.count - buffer.capacity : 0; // oldest span still in the ring
+    for (long i=first; i < buffer.count; i++) {
+      const TraceEvent& e = buffer.events[i % buffer.capacity];
+      out << "," << endl << "{\"name\": \"" << phaseNames[e.kind];
+      if (e.layer >= 0) out << " " << e.layer;
+      out << "\", \"cat\": \"" << (e.kind < PROFILE_NUM_PHASES ? "layer" : "net") << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << c
+          << fixed << setprecision(3)
+          << ", \"ts\": " << (e.begin - traceOrigin) * 1e6 << ", \"dur\": " << (e.end - e.begin) * 1e6;
+      out.unsetf(ios::floatfield);
+      if (e.layer >= 0) out << ", \"args\": {\"layer\": " << e.layer << "}";
+      out << "}";
+    }
+  }
+  out << endl << "]}" << endl;
+  out.precision(precision);
+}
+
+
+#ifdef __APPLE__
+#pragma mark -
+#pragma mark Hardware counters
+#endif
+
+const char* Profile::getEventName(ProfileEvent event)
+{
+  return eventNames[event];
+}
+
+#ifdef NPP2_PERF_EVENTS
+// opens a counter for the event in the calling thread. counts only user-space
+// events, which is allowed with the default perf_event_paranoid setting.
+static int openEvent(int event, int groupFd)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  switch (event) {
+    case PROFILE_CYCLES:
+      attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case PROFILE_INSTRUCTIONS:
+      attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case PROFILE_CACHE_MISSES:
+      attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    default: // PROFILE_LLC_READ_MISSES
+      attr.type = PERF_TYPE_HW_CACHE; 
+      attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+  }
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0); // this thread, any cpu
+}
+#endif
+
+bool Profile::enableHardwareCounters(bool enable)
+{
+  for (int c=0; c <= numCopies && hw; c++) {
+    detachThread(c);
+  }
+  hwEnabled = false;
+  for (int e=0; e < PROFILE_NUM_EVENTS; e++) {
+    hwAvailable[e] = false;
+  }
+  if (!enable || !isEnabled()) {
+    return false;
+  }
+#ifdef NPP2_PERF_EVENTS
+  int fd[PROFILE_NUM_EVENTS];       // probe, which events can be opened
+  fd[0] = openEvent(PROFILE_CYCLES, -1);
+  if (fd[0] < 0) {
+    return false;
+  }
+  hwAvailable[0] = true;
+  for (int e=1; e < PROFILE_NUM_EVENTS; e++) {
+    fd[e] = openEvent(e, fd[0]);
+    hwAvailable[e] = fd[e] >= 0;
+  }
+  for (int e=0; e < PROFILE_NUM_EVENTS; e++) {
+    if (fd[e] >= 0) close(fd[e]);
+  }
+  hwEnabled = true;
+  return true;
+#else
+  return false;
+#endif
+}
+
+void Profile::attachThread(int copy)
+{
+  if (!hwEnabled || !hw) return;
+  detachThread(copy);
+#ifdef NPP2_PERF_EVENTS
+  HardwareGroup& group = hw[copy];
+  for (int e=0; e < PROFILE_NUM_EVENTS; e++) {
+    if (!hwAvailable[e]) continue;
+    int fd = openEvent(e, e == 0 ? -1 : group.fd[0]);
+    if (fd < 0) {
+      if (e == 0) return;             // without the leader there is no group
+      continue;
+    }
+    group.fd[e] = fd;
+    group.slot[e] = group.numOpen++;
+  }
+#endif
+}
+
+void Profile::detachThread(int copy)
+{
+  if (!hw) return;
+  HardwareGroup& group = hw[copy];
+  for (int e=PROFILE_NUM_EVENTS-1; e >= 0; e--) {
+#ifdef NPP2_PERF_EVENTS
+    if (group.fd[e] >= 0) close(group.fd[e]);
+#endif
+    group.fd[e] = -1;
+    group.slot[e] = -1;
+  }
+  group.numOpen = 0;
+}
+
+// reads all counters of the copy's group with a single system call. events
+// that are not available are reported as zero.
+void Profile::readEvents(int copy, unsigned long long* events) const
+{
+  const HardwareGroup& group = hw[copy];
+  unsigned long long values[PROFILE_NUM_EVENTS+1];  // number of values, followed by the values
+  values[0] = 0;
+#ifdef NPP2_PERF_EVENTS
+  if (read(group.fd[0], values, sizeof(values)) <= 0) {
+    values[0] = 0;
+  }
+#endif
+  for (int e=0; e < PROFILE_NUM_EVENTS; e++) {
+    events[e] = group.slot[e] >= 0 && (unsigned long long) group.slot[e] < values[0] ? values[group.slot[e]+1] : 0;
+  }
+}
@@ -0,0 +1,327 @@
+#ifndef _NPP2_PROFILER_H_
+#define _NPP2_PROFILER_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: Profiler.h
+ *
+ *  Optional timing of the phases (forward, backward, reduction, update and
+ *  thread join) of each layer. The time measurements are only compiled into
+ *  the library, if it is built with NPP2_PROFILING defined (cmake option 
+ *  PROFILING). Otherwise the NPP2_PROFILE_* macros are empty and the profile
+ *  of a net stays empty. The Profile class itself exists in both builds, so
+ *  the layout of the Net class does not depend on this option.
+ *
+ *  Instrumented builds can additionally record a timeline of all measured 
+ *  phases, of the workers and of the mini-batches (tracing). The spans are
+ *  kept in a ring buffer for each copy and can be written in the Chrome 
+ *  trace event format (open with chrome://tracing or ui.perfetto.dev).
+ *
+ *  On Linux, instrumented builds may also read the hardware performance
+ *  counters (perf_event_open) of each worker thread and attribute the counted
+ *  events (cycles, instructions, cache misses) to the phases.
+ */
+
+#include <iostream>
+#include <sys/time.h>
+#include <time.h>
+
+namespace NPP2 {
+  
+  /** phases of the training and testing procedure that are timed 
+   * individually for each layer. */
+  enum ProfilePhase { 
+    PROFILE_FORWARD=0,   ///< Net::forwardPass, per layer
+    PROFILE_BACKWARD,    ///< Net::backwardPass, per layer
+    PROFILE_REDUCE,      ///< summing up the derivatives of all copies before the update, per layer
+    PROFILE_UPDATE,      ///< applying the update function, per layer
+    PROFILE_JOIN,        ///< time a worker waited for the other workers to finish (layer 0)
+    PROFILE_NUM_PHASES 
+  };
+  
+  /** hardware events that are counted per phase, if hardware counters have
+   * been enabled (see Profile::enableHardwareCounters). */
+  enum ProfileEvent {
+    PROFILE_CYCLES=0,       ///< cpu cycles
+    PROFILE_INSTRUCTIONS,   ///< retired instructions
+    PROFILE_CACHE_MISSES,   ///< cache misses (usually of the last level cache)
+    PROFILE_LLC_READ_MISSES,///< read misses of the last level cache, used for estimating the memory bandwidth
+    PROFILE_NUM_EVENTS
+  };
+  
+  /** time stamp and hardware counter values at the start of a phase. */
+  struct ProfileMark {
+    double time;
+    unsigned long long events[PROFILE_NUM_EVENTS];
+  };
+  
+  /** additional spans that are only recorded in the timeline (trace). */
+  enum TraceSpan {
+    TRACE_WORKER=PROFILE_NUM_PHASES, ///< complete work of a worker in one mini-batch
+    TRACE_MINIBATCH,                 ///< a complete mini-batch, including the update (copy 0)
+    TRACE_NUM_SPANS
+  };
+  
+  /** returns a monotonic time stamp in seconds. */
+  inline double profileClock()
+  {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+  }
+  
+  /** Per-layer, per-phase breakdown of the time spent in the last call of
+   * Net::train or Net::test. Each copy of the net (and thus each worker 
+   * thread) has its own block of counters, aligned to cache lines, so the 
+   * workers never write to shared memory while measuring. The accessors sum
+   * up the counters of all copies. */
+  class Profile {
+  public:
+    Profile();
+    ~Profile();
+    
+    /** returns true, if the library has been compiled with NPP2_PROFILING. 
+     * Otherwise all profiles stay empty. */
+    static bool isEnabled();
+    /** returns the name of the phase (e.g. "forward"). */
+    static const char* getPhaseName(ProfilePhase phase);
+    
+    /** makes room for the counters of numLayers layers in numCopies+1 
+     * copies. Clears all counters. */
+    void resize(int numLayers, int numCopies);
+    /** sets all counters back to zero. */
+    void reset();
+    
+    int getNumLayers() const { return numLayers; }        ///< number of layers (including the input layer)
+    int getNumCopies() const { return numCopies; }        ///< number of copies (without copy 0)
+    
+    /** time spent in the phase of the given layer, summed over all copies. */
+    double getSeconds(int layer, ProfilePhase phase) const;
+    /** time spent in the phase of the given layer in one particular copy. */
+    double getSeconds(int layer, ProfilePhase phase, int copy) const;
+    /** number of measurements in the phase of the given layer, summed over all copies. */
+    long getCalls(int layer, ProfilePhase phase) const;
+    /** number of measurements in the phase of the given layer in one particular copy. */
+    long getCalls(int layer, ProfilePhase phase, int copy) const;
+    /** time spent in the phase, summed over all layers and copies. */
+    double getTotalSeconds(ProfilePhase phase) const;
+    
+    /** tries to count hardware events in all threads that work on the net.
+     * Returns false, if the counters are not available (not compiled with 
+     * NPP2_PROFILING, not running on Linux or no permission to use 
+     * perf_event_open, as it's often the case in containers). Then, only
+     * the time is measured. Must not be called during training or testing. */
+    bool enableHardwareCounters(bool enable=true);
+    /** returns true, if hardware events are counted. */
+    bool hasHardwareCounters() const { return hwEnabled; }
+    /** returns true, if the particular event can be counted on this machine. */
+    bool isEventAvailable(ProfileEvent event) const { return hwEnabled && hwAvailable[event]; }
+    /** returns the name of the event (e.g. "cycles"). */
+    static const char* getEventName(ProfileEvent event);
+    
+    /** number of events counted in the phase of the given layer, summed 
+     * over all copies. */
+    unsigned long long getEventCount(int layer, ProfilePhase phase, ProfileEvent event) const;
+    /** number of events counted in the phase of the given layer in one 
+     * particular copy. */
+    unsigned long long getEventCount(int layer, ProfilePhase phase, ProfileEvent event, int copy) const;
+    /** instructions per cycle in the phase of the given layer. */
+    double getInstructionsPerCycle(int layer, ProfilePhase phase) const;
+    /** estimated memory bandwidth (bytes per second and thread) in the phase 
+     * of the given layer, calculated from the read misses of the last level
+     * cache (one cache line per miss). */
+    double getBandwidth(int layer, ProfilePhase phase) const;
+    
+    /** opens the hardware counters of the calling thread for the given copy.
+     * Does nothing, if the hardware counters have not been enabled. */
+    void attachThread(int copy);
+    /** closes the hardware counters of the given copy. */
+    void detachThread(int copy);
+    
+    /** writes a table of the breakdown to the stream. */
+    void writeToStream(std::ostream& out) const;
+    
+    /** starts recording a timeline of the spans of all phases. Only the 
+     * last eventsPerCopy spans of each copy are kept. Must not be called
+     * while the net is training or testing. Returns false, if the library
+     * has been compiled without NPP2_PROFILING. */
+    bool startTracing(int eventsPerCopy=100000);
+    /** stops recording and discards the recorded timeline. */
+    void stopTracing();
+    /** returns true, while a timeline is recorded. */
+    bool isTracing() const { return traces != 0; }
+    /** writes the recorded timeline as Chrome trace event (JSON) to the 
+     * stream. Each copy is represented as a thread; copy 0 holds the 
+     * mini-batches and updates. */
+    void writeTrace(std::ostream& out) const;
+    
+    /** takes the time stamp (and the counter values) at the start of a phase
+     * in the given copy. */
+    inline void mark(int copy, ProfileMark& m) const
+    {
+      m.time = profileClock();
+      if (hwEnabled && hw[copy].fd[0] >= 0) readEvents(copy, m.events);
+    }
+    /** adds a measurement of the phase that started at the mark to the
+     * counters of the given copy. Must only be called by the thread working
+     * on this copy. */
+    inline void add(int copy, int layer, ProfilePhase phase, const ProfileMark& begin)
+    {
+      ProfileMark end;
+      mark(copy, end);
+      if (hwEnabled && hw[copy].fd[0] >= 0) {
+        Counter& c = counters[copy*stride + layer*PROFILE_NUM_PHASES + phase];
+        for (int e=0; e < PROFILE_NUM_EVENTS; e++) {
+          c.events[e] += end.events[e] - begin.events[e];
+        }
+      }
+      add(copy, layer, phase, begin.time, end.time);
+    }
+    /** adds a measurement of the phase that lasted from begin to end to the
+     * counters of the given copy (time only). */
+    inline void add(int copy, int layer, ProfilePhase phase, double begin, double end)
+    {
+      Counter& c = counters[copy*stride + layer*PROFILE_NUM_PHASES + phase];
+      c.seconds += end - begin;
+      c.calls++;
+      if (traces) traces[copy].record(phase, layer, begin, end);
+    }
+    /** records a span in the timeline of the copy (only while tracing). */
+    inline void span(int copy, TraceSpan kind, double begin, double end)
+    {
+      if (traces) traces[copy].record(kind, -1, begin, end);
+    }
+    /** remembers the time the worker on the given copy finished its work. */
+    inline void setFinished(int copy, double time)
+    {
+      counters[copy*stride + numLayers*PROFILE_NUM_PHASES].seconds = time;
+    }
+    /** books the time between the finishing of the workers on copies 
+     * first..last and the given time (all workers joined) as join phase of 
+     * layer 0 of the workers' copies. */
+    inline void addJoin(int first, int last, double joined)
+    {
+      for (int copy=first; copy <= last; copy++) {
+        add(copy, 0, PROFILE_JOIN, counters[copy*stride + numLayers*PROFILE_NUM_PHASES].seconds, joined);
+      }
+    }
+    
+  protected:
+    struct Counter {
+      double seconds;
+      long calls;
+      unsigned long long events[PROFILE_NUM_EVENTS];
+    };
+    
+    /** file descriptors of the hardware counters of one copy. The counters
+     * are read as a group; slot gives the position of each event in it. */
+    struct HardwareGroup {
+      int fd[PROFILE_NUM_EVENTS];   ///< fd[0] is the group leader (-1, if not open)
+      int slot[PROFILE_NUM_EVENTS]; ///< position in the group or -1, if not available
+      int numOpen;
+    };
+    
+    void readEvents(int copy, unsigned long long* events) const;
+    
+    struct TraceEvent {
+      int kind;           ///< ProfilePhase or TraceSpan
+      int layer;          ///< layer of a phase, -1 for other spans
+      double begin;
+      double end;
+    };
+    
+    /** ring buffer of the spans of one copy. */
+    struct TraceBuffer {
+      TraceEvent* events;
+      long count;         ///< number of recorded spans (including overwritten ones)
+      long capacity;
+      char padding[64];   ///< keeps the buffers of different copies apart
+      
+      inline void record(int kind, int layer, double begin, double end) 
+      {
+        TraceEvent& e = events[count % capacity];
+        e.kind = kind; e.layer = layer; e.begin = begin; e.end = end;
+        count++;
+      }
+    };
+    
+    Counter* counters;  ///< block of stride counters for each copy; the counter following the layers' counters holds the finishing time of the copy's worker
+    int stride;         ///< number of counters per copy, rounded up to whole cache lines
+    int numLayers;
+    int numCopies;
+    
+    TraceBuffer* traces;///< one buffer per copy while tracing, 0 otherwise
+    int traceCapacity;  ///< number of spans kept per copy
+    double traceOrigin; ///< time stamp of the start of the tracing
+    
+    HardwareGroup* hw;  ///< hardware counters of each copy
+    bool hwEnabled;     ///< count hardware events?
+    bool hwAvailable[PROFILE_NUM_EVENTS]; ///< events that could be opened on this machine
+    
+  private:
+    Profile(const Profile&);            // not copyable
+    Profile& operator=(const Profile&);
+  };
+  
+}
+
+#ifdef NPP2_PROFILING
+#define NPP2_PROFILE_RESET(profile) (profile)->reset()
+#define NPP2_PROFILE_BEGIN(var) double var = NPP2::profileClock()
+#define NPP2_PROFILE_BEGIN_PHASE(var, profile, copy) NPP2::ProfileMark var; (profile)->mark((copy), var)
+#define NPP2_PROFILE_END_PHASE(var, profile, copy, layer, phase) (profile)->add((copy), (layer), (phase), var)
+#define NPP2_PROFILE_ATTACH(profile, copy) (profile)->attachThread(copy)
+#define NPP2_PROFILE_DETACH(profile, copy) (profile)->detachThread(copy)
+#define NPP2_PROFILE_SPAN(var, profile, copy, kind) (profile)->span((copy), (kind), (var), NPP2::profileClock())
+#define NPP2_PROFILE_FINISHED(profile, copy) (profile)->setFinished((copy), NPP2::profileClock())
+#define NPP2_PROFILE_JOINED(profile, first, last) (profile)->addJoin((first), (last), NPP2::profileClock())
+#else
+#define NPP2_PROFILE_RESET(profile)
+#define NPP2_PROFILE_BEGIN(var)
+#define NPP2_PROFILE_BEGIN_PHASE(var, profile, copy)
+#define NPP2_PROFILE_END_PHASE(var, profile, copy, layer, phase)
+#define NPP2_PROFILE_ATTACH(profile, copy)
+#define NPP2_PROFILE_DETACH(profile, copy)
+#define NPP2_PROFILE_SPAN(var, profile, copy, kind)
+#define NPP2_PROFILE_FINISHED(profile, copy)
+#define NPP2_PROFILE_JOINED(profile, first, last)
+#endif
+
+#endif
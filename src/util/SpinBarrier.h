@@ -0,0 +1,95 @@
+#ifndef _NPP2_SPINBARRIER_H_
+#define _NPP2_SPINBARRIER_H_
+
+/*****************************************************************************
+ 
+ Copyright (c) 2009-2011, Sascha Lange, 
+ All rights reserved.
+ 
+ Redistribution and use in source and binary forms, with or without 
+ modification, are permitted provided that the following conditions are met:
+ 
+ - Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+ 
+ - Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+ 
+ - Neither the name of Sascha Lange Software nor the names of its 
+   contributors may be used to endorse or promote products derived from this
+   software without specific prior written permission.
+ 
+ THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE 
+ ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS 
+ INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN 
+ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) 
+ ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE 
+ POSSIBILITY OF SUCH DAMAGE.
+ 
+ ****************************************************************************/
+
+/*  File: SpinBarrier.h
+ *
+ *  Barrier for a fixed number of threads that busy-waits instead of 
+ *  sleeping in the kernel. Used where threads synchronize every few 
+ *  microseconds (e.g. between the layers of a single forward pass), and 
+ *  waking sleeping threads would take longer than the work itself.
+ */
+
+#include <sched.h>
+
+namespace NPP2 {
+  
+  /** Sense-reversing spin barrier. After spinning for a while without 
+   * progress, a waiting thread yields the cpu on every further check, so 
+   * idle threads do not completely block other processes. */
+  class SpinBarrier {
+  public:
+    /** constructs a barrier for the given number of threads */
+    SpinBarrier(int numThreads) : numThreads(numThreads), count(0), generation(0) {}
+    
+    /** blocks until all threads have called wait */
+    void wait() {
+      int gen = generation;
+      if (__sync_add_and_fetch(&count, 1) == numThreads) {  // last thread: release all others
+        count = 0;
+        __sync_synchronize();
+        generation = gen + 1;
+        return;
+      }
+      for (int spins = 0; generation == gen; spins++) {
+        if (spins < SPINS_BEFORE_YIELD) {
+#if defined(__i386__) || defined(__x86_64__)
+          __builtin_ia32_pause();
+#endif
+        }
+        else {
+          sched_yield();
+        }
+      }
+      __sync_synchronize();
+    }
+    
+    int getNumThreads() const { return numThreads; }
+    
+  protected:
+    static const int SPINS_BEFORE_YIELD = 1 << 12;
+    
+    const int numThreads;
+    volatile int count;        ///< number of threads that have arrived
+    volatile int generation;   ///< incremented whenever all threads have arrived
+    
+  private:
+    SpinBarrier(const SpinBarrier&);
+    SpinBarrier& operator=(const SpinBarrier&);
+  };
+  
+}
+
+#endif